@@ -67,6 +67,14 @@
 #if CORE0
 //#include <ti/resources.mmap/rsc_table.h>
 #include <ti/resources/rsc_table.h>
+#define RSC_TABLE   (&resources)
+#else
+/* CORE1's vrings are not entries of CORE0's table: it has none of its own */
+#define RSC_TABLE   NULL
+/* ...but the host still reads its SysMin buffer (SysMin.bufSize) */
+extern char * xdc_runtime_SysMin_Module_State_0_outbuf__A;
+#define TRACE_BUF   (&xdc_runtime_SysMin_Module_State_0_outbuf__A)
+#define TRACE_LEN   0x8000
 #endif
 
 /* Turn on/off printf's */
@@ -231,6 +239,12 @@ Int main(Int argc, char* argv[])
     printf("%d resources at 0x%x\n", resources.num, resources);
 #endif
 
+    /* Let VirtQueue pick up the features the host acknowledged */
+    VirtQueue_setResourceTable(RSC_TABLE);
+#if !CORE0
+    VirtQueue_setTraceBuf(TRACE_BUF, TRACE_LEN);
+#endif
+
     /* Plug vring interrupts, and spin until host handshake complete. */
     VirtQueue_startup();
 
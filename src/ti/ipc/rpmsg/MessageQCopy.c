@@ -50,14 +50,20 @@
 #include <xdc/runtime/Registry.h>
 #include <xdc/runtime/Log.h>
 #include <xdc/runtime/Diags.h>
+#include <xdc/runtime/Timestamp.h>
 
+#include <ti/sysbios/hal/Hwi.h>
 #include <ti/sysbios/knl/Swi.h>
 #include <ti/sysbios/knl/Semaphore.h>
+#include <ti/sysbios/knl/Clock.h>
 #include <ti/sysbios/heaps/HeapBuf.h>
 #include <ti/sysbios/gates/GateSwi.h>
 
 #include <ti/sdo/utils/List.h>
 #include <ti/ipc/MultiProc.h>
+#include <ti/resources/rsc_types.h>
+
+#include <string.h>
 
 #include "MessageQCopy.h"
 #include "VirtQueue.h"
@@ -68,11 +74,50 @@
  */
 
 /* Various arbitrary limits: */
-#define MAXMESSAGEQOBJECTS     256
-#define MAXMESSAGEBUFFERS      512
+#define ENDPTSPERCHUNK         256   // Endpoint table grows by this many
+#define MAXENDPTCHUNKS         64
+#define MAXMESSAGEQOBJECTS     (MAXENDPTCHUNKS * ENDPTSPERCHUNK)
+#define NOENDPT                0xFFFF
+#define SMALLBUFFERSIZE        64
+#define MEDIUMBUFFERSIZE       128
 #define MSGBUFFERSIZE          512   // Max payload + sizeof(ListElem)
-#define MAXHEAPSIZE            (MAXMESSAGEBUFFERS * MSGBUFFERSIZE)
 #define HEAPALIGNMENT          8
+#define MAXRECVBATCH           16    // Vring buffers handled per Swi batch
+#define LARGEBUFFERSIZE        4096  // MAX_DATA_SIZE + sizeof(Queue_elem)
+
+/*
+ * Blocks of each size class of copies (see allocPayload), which an image
+ * may override.  A message that finds its class empty takes a block of a
+ * larger one, so small messages queue as deep as all the classes
+ * together.  The defaults take 160KB: 32KB + 32KB + 64KB + 32KB, where a
+ * single class of 512 blocks of 512 bytes and the large class took 288KB.
+ */
+#ifndef MAXSMALLBUFFERS
+#define MAXSMALLBUFFERS        512
+#endif
+#ifndef MAXMEDIUMBUFFERS
+#define MAXMEDIUMBUFFERS       256
+#endif
+#ifndef MAXMESSAGEBUFFERS
+#define MAXMESSAGEBUFFERS      128
+#endif
+#ifndef MAXLARGEBUFFERS
+#define MAXLARGEBUFFERS        8
+#endif
+#define NUMSIZECLASSES         4
+#define MAXMSGSEGS             8     // Vring segments of a largest message
+#define MAXHELDBUFS            64    // Host buffers held for MessageQCopy_recvBuf
+#define MAXCLAIMEDBUFS         32    // Vring buffers from MessageQCopy_allocBuf
+
+/*
+ * CORE0's buffers for the vrings to and from CORE1 (see coreInit), in the
+ * IPU_MEM_CORELINK devmem entry of the resource table (rsc_table.h)
+ */
+#define COREBUFS_DA            0xA00D0000
+#define CORENUMBUFS            64    // Per vring, as CORE_VRING_NUM
+
+/* Class of the vring to CORE0 (see sendVring), beyond the host classes */
+#define TOCORE                 MessageQCopy_NUM_PRIORITIES
 
 /* The MessageQCopy Object */
 typedef struct MessageQCopy_Object {
@@ -80,16 +125,53 @@ typedef struct MessageQCopy_Object {
     Semaphore_Handle semHandle;    /* I/O Completion                        */
     List_Handle      queue;        /* Queue of pending messages             */
     Bool             unblocked;    /* Use with signal to unblock _receive() */
+    Bool             zeroCopy;     /* Has called MessageQCopy_recvBuf()     */
+    MessageQCopy_Callback callback; /* Called by the Swi instead, if set   */
+    UArg             arg;          /* Passed to callback                    */
+    struct MessageQCopy_SetObject *set; /* Set waiting on us, if any    */
+    List_Elem        memberElem;   /* On set->members while in it           */
+    List_Elem        readyElem;    /* On set->ready while onReady           */
+    Bool             onReady;
 } MessageQCopy_Object;
 
+/* The MessageQCopy_Set Object */
+typedef struct MessageQCopy_SetObject {
+    Semaphore_Handle semHandle;    /* Posted as endpoints become ready      */
+    List_Handle      members;      /* Endpoints in the set                  */
+    List_Handle      ready;        /* Endpoints that may have messages      */
+} MessageQCopy_SetObject;
+
+/*
+ * A slice of the endpoint table.  Never freed before MessageQCopy_finalize,
+ * so the table can be read ungated while it grows.
+ */
+typedef struct MessageQCopy_Chunk {
+    /* The messageQObjects of these endpoints: */
+    struct MessageQCopy_Object  *msgqObjects[ENDPTSPERCHUNK];
+    /* Priority class of each endpoint, read by MessageQCopy_send ungated: */
+    UInt8                       priorities[ENDPTSPERCHUNK];
+    /* Next endpoint on the free list, for those on it: */
+    UInt16                      nextFree[ENDPTSPERCHUNK];
+} MessageQCopy_Chunk;
+
 /* Module_State */
 typedef struct MessageQCopy_Module {
     /* Instance gate: */
     GateSwi_Handle gateSwi;
-    /* Array of messageQObjects in the system: */
-    struct MessageQCopy_Object  *msgqObjects[MAXMESSAGEQOBJECTS];
-    /* Heap from which to allocate free messages for copying: */
-    HeapBuf_Handle              heap;
+    /* Endpoint table, allocated a chunk at a time: */
+    MessageQCopy_Chunk          *chunks[MAXENDPTCHUNKS];
+    UInt                        numChunks;
+    /* Endpoints free for MessageQCopy_ASSIGN_ANY, oldest first: */
+    UInt16                      freeHead;
+    UInt16                      freeTail;
+    /* Heaps from which to allocate free messages for copying, by size: */
+    HeapBuf_Handle              heaps[NUMSIZECLASSES];
+    /* Unused elements of held[]: */
+    List_Handle                 freeHeld;
+    /* Unused elements of claimed[]: */
+    List_Handle                 freeClaimed;
+    /* Sent messages for callback endpoints, for the Swi to pass on: */
+    List_Handle                 deferred;
 } MessageQCopy_Module;
 
 /* Message Header: Must match mp_msg_hdr in virtio_rp_msg.h on Linux side. */
@@ -107,18 +189,65 @@ typedef MessageQCopy_MsgHeader *MessageQCopy_Msg;
 /* Element to hold payload copied onto receiver's queue.                  */
 typedef struct Queue_elem {
     List_Elem    elem;              /* Allow list linking.                */
-    UInt         len;               /* Length of data                     */
+    UInt16       len;               /* Length of data                     */
+    UInt16       dst;               /* Dst endpt, while on module.deferred */
     UInt32       src;               /* Src address/endpt of the msg       */
     Char         data[];            /* payload begins here                */
 } Queue_elem;
 
-/* Combine transport related objects into a struct for future migration: */
+/* Element queuing a message left in its vring buffer (MessageQCopy_recvBuf) */
+typedef struct Held_elem {
+    List_Elem        elem;          /* Allow list linking.                */
+    UInt             len;           /* Length of data                     */
+    UInt32           src;           /* Src address/endpt of the msg       */
+    Char             *data;         /* payload, in the vring buffer       */
+    VirtQueue_Handle vq;            /* vring to return it to, NULL if free */
+    Int16            token;
+} Held_elem;
+
+/* Element recording a buffer from MessageQCopy_allocBuf, until sent/freed */
+typedef struct Claim_elem {
+    List_Elem        elem;          /* Allow list linking.                */
+    MessageQCopy_Msg msg;           /* the buffer, NULL if free           */
+    VirtQueue_Handle vq;            /* vring claimed from, NULL if CORE0's */
+    Int16            token;
+} Claim_elem;
+
+/*
+ * Combine transport related objects into a struct for future migration.
+ * The vring pairs are indexed by priority class; classes without a vdev of
+ * their own share the MessageQCopy_PRIORITY_NORMAL pair.
+ */
 typedef struct MessageQCopy_Transport  {
     Swi_Handle       swiHandle;
-    VirtQueue_Handle virtQueue_toHost;
-    VirtQueue_Handle virtQueue_fromHost;
+    /* Per Swi run budget (see MessageQCopy_setSwiBudget), 0 if none: */
+    UInt             swiMaxMsgs;
+    Bits32           swiMaxCounts;  /* Timestamp counts */
+    /* Posts the Swi a tick after it ran out of budget: */
+    Clock_Handle     swiClock;
+    VirtQueue_Handle virtQueue_toHost[MessageQCopy_NUM_PRIORITIES];
+    VirtQueue_Handle virtQueue_fromHost[MessageQCopy_NUM_PRIORITIES];
+    /* Senders waiting for toHost buffers, by class (see waitToHost): */
+    Semaphore_Handle sendSem[MessageQCopy_NUM_PRIORITIES];
+    volatile UInt    sendWaiters[MessageQCopy_NUM_PRIORITIES];
+    /* Vrings to and from the other M3 core, NULL if not linked (coreInit): */
+    VirtQueue_Handle virtQueue_toCore;
+    VirtQueue_Handle virtQueue_fromCore;
+    UInt16           coreProcId;    /* MultiProc_INVALIDID if none */
+    Bool             coreDriver;    /* we are CORE0, which drives both */
+    UInt             coreBufsUnused; /* CORE0: toCore buffers not sent yet */
+    /* CORE0: toCore buffers given back by MessageQCopy_freeBuf: */
+    MessageQCopy_Msg coreBufsFree[CORENUMBUFS];
+    UInt             numCoreBufsFree;
 } MessageQCopy_Transport;
 
+/* Order in which the Swi drains the classes' vrings */
+static const UInt drainOrder[MessageQCopy_NUM_PRIORITIES] = {
+    MessageQCopy_PRIORITY_HIGH,
+    MessageQCopy_PRIORITY_NORMAL,
+    MessageQCopy_PRIORITY_BULK
+};
+
 
 /* module diags mask */
 Registry_Desc Registry_CURDESC;
@@ -126,294 +255,1231 @@ Registry_Desc Registry_CURDESC;
 static MessageQCopy_Module      module;
 static MessageQCopy_Transport   transport;
 
-/* We create a fixed size heap over this memory for copying received msgs */
+/* We create fixed size heaps over this memory for copying received msgs */
+#pragma DATA_ALIGN (small_buffers, HEAPALIGNMENT)
+static UInt8 small_buffers[MAXSMALLBUFFERS * SMALLBUFFERSIZE];
+
+#pragma DATA_ALIGN (medium_buffers, HEAPALIGNMENT)
+static UInt8 medium_buffers[MAXMEDIUMBUFFERS * MEDIUMBUFFERSIZE];
+
 #pragma DATA_ALIGN (recv_buffers, HEAPALIGNMENT)
-static UInt8 recv_buffers[MAXHEAPSIZE];
+static UInt8 recv_buffers[MAXMESSAGEBUFFERS * MSGBUFFERSIZE];
+
+/* ... and one over this memory for the (few) larger ones */
+#pragma DATA_ALIGN (large_buffers, HEAPALIGNMENT)
+static UInt8 large_buffers[MAXLARGEBUFFERS * LARGEBUFFERSIZE];
+
+/* The size classes of those heaps, smallest first */
+static const struct {
+    UInt   blockSize;
+    UInt   numBlocks;
+    UInt8  *buf;
+} sizeClasses[NUMSIZECLASSES] = {
+    { SMALLBUFFERSIZE,  MAXSMALLBUFFERS,   small_buffers },
+    { MEDIUMBUFFERSIZE, MAXMEDIUMBUFFERS,  medium_buffers },
+    { MSGBUFFERSIZE,    MAXMESSAGEBUFFERS, recv_buffers },
+    { LARGEBUFFERSIZE,  MAXLARGEBUFFERS,   large_buffers }
+};
+
+/* Queued messages not copied out of the host's buffers: */
+static Held_elem held[MAXHELDBUFS];
+
+/* Vring buffers reserved by MessageQCopy_allocBuf: */
+static Claim_elem claimed[MAXCLAIMEDBUFS];
 
 /* Module ref count: */
 static Int curInit = 0;
 
+static Void callback_availBufReady(VirtQueue_Handle vq);
+
 /*
- *  ======== MessageQCopy_swiFxn ========
+ *  ======== getObject ========
+ *  The messageQObject of an endpoint, NULL if none.
  */
-#define FXNN "MessageQCopy_swiFxn"
-static Void MessageQCopy_swiFxn(UArg arg0, UArg arg1)
+static inline MessageQCopy_Object *getObject(UInt32 endpt)
 {
-    Int16             token;
-    MessageQCopy_Msg  msg;
-    UInt16            dstProc = MultiProc_self();
-    Bool              usedBufAdded = FALSE;
-    int len;
+    MessageQCopy_Chunk *chunk;
 
-    Log_print0(Diags_ENTRY, "--> "FXNN);
-
-    /* Process all available buffers: */
-    while ((token = VirtQueue_getAvailBuf(transport.virtQueue_fromHost,
-                                         (Void **)&msg, &len))
-         >= 0) {
+    if ((endpt >= MAXMESSAGEQOBJECTS) ||
+        ((chunk = module.chunks[endpt / ENDPTSPERCHUNK]) == NULL)) {
+        return (NULL);
+    }
 
-        Log_print3(Diags_INFO, FXNN": \n\tReceived msg: from: 0x%x, "
-                   "to: 0x%x, dataLen: %d",
-                  (IArg)msg->srcAddr, (IArg)msg->dstAddr, (IArg)msg->dataLen);
+    return (chunk->msgqObjects[endpt % ENDPTSPERCHUNK]);
+}
 
-        /* Pass to desitination queue (which is on this proc): */
-        MessageQCopy_send(dstProc, msg->dstAddr, msg->srcAddr,
-                         (Ptr)msg->payload, msg->dataLen);
+/*
+ *  ======== setObject ========
+ *  Call within gateSwi, for an endpoint in the table.
+ */
+static inline Void setObject(UInt32 endpt, MessageQCopy_Object *obj)
+{
+    module.chunks[endpt / ENDPTSPERCHUNK]->msgqObjects[endpt %
+            ENDPTSPERCHUNK] = obj;
+}
 
-        VirtQueue_addUsedBuf(transport.virtQueue_fromHost, token, RP_MSG_BUF_SIZE);
-        usedBufAdded = TRUE;
-    }
+/*
+ *  ======== getPriority ========
+ *  The priority class of an endpoint, MessageQCopy_PRIORITY_NORMAL if none.
+ */
+static inline UInt getPriority(UInt32 endpt)
+{
+    MessageQCopy_Chunk *chunk;
 
-    if (usedBufAdded)  {
-       /* Tell host we've processed the buffers: */
-       VirtQueue_kick(transport.virtQueue_fromHost);
+    if ((endpt >= MAXMESSAGEQOBJECTS) ||
+        ((chunk = module.chunks[endpt / ENDPTSPERCHUNK]) == NULL)) {
+        return (MessageQCopy_PRIORITY_NORMAL);
     }
 
-    Log_print0(Diags_EXIT, "<-- "FXNN);
+    return (chunk->priorities[endpt % ENDPTSPERCHUNK]);
 }
-#undef FXNN
 
-#define FXNN "callback_availBufReady"
-static Void callback_availBufReady(VirtQueue_Handle vq)
+/*
+ *  ======== putFree ========
+ *  Add an endpoint to the tail of the free list.  Call within gateSwi.
+ */
+static Void putFree(UInt16 endpt)
 {
+    module.chunks[endpt / ENDPTSPERCHUNK]->nextFree[endpt %
+            ENDPTSPERCHUNK] = NOENDPT;
 
-    if (vq == transport.virtQueue_fromHost)  {
-       /* Post a SWI to process all incoming messages */
-        Log_print0(Diags_INFO, FXNN": virtQueue_fromHost kicked");
-        Swi_post(transport.swiHandle);
+    if (module.freeHead == NOENDPT) {
+        module.freeHead = endpt;
     }
-    else if (vq == transport.virtQueue_toHost) {
-       /* Note: We post nothing for transport.virtQueue_toHost, as we assume the
-        * host has already made all buffers available for sending.
-        */
-        Log_print0(Diags_INFO, FXNN": virtQueue_toHost kicked");
+    else {
+        module.chunks[module.freeTail / ENDPTSPERCHUNK]->nextFree[
+                module.freeTail % ENDPTSPERCHUNK] = endpt;
     }
+    module.freeTail = endpt;
 }
-#undef FXNN
-
-/* =============================================================================
- *  MessageQCopy Functions:
- * =============================================================================
- */
 
 /*
- *  ======== MessasgeQCopy_init ========
- *
- *
+ *  ======== growTable ========
+ *  Add a chunk to the endpoint table, its endpoints but the reserved ones
+ *  to the free list.  Call within gateSwi.  Returns FALSE if full.
  */
-#define FXNN "MessageQCopy_init"
-Void MessageQCopy_init(UInt16 remoteProcId)
+static Bool growTable()
 {
-    GateSwi_Params gatePrms;
-    HeapBuf_Params prms;
-    int     i;
-    Registry_Result result;
+    MessageQCopy_Chunk *chunk;
+    UInt               base = module.numChunks * ENDPTSPERCHUNK;
+    Int                i;
 
-    Log_print1(Diags_ENTRY, "--> "FXNN": (remoteProcId=%d)",
-                (IArg)remoteProcId);
+    if (module.numChunks == MAXENDPTCHUNKS) {
+        return (FALSE);
+    }
 
-    if (curInit++ != 0) {
-        return; /* module already initialized */
+    chunk = Memory_alloc(NULL, sizeof(MessageQCopy_Chunk), 0, NULL);
+    if (chunk == NULL) {
+        return (FALSE);
     }
 
-    /* register with xdc.runtime to get a diags mask */
-    result = Registry_addModule(&Registry_CURDESC, MODULE_NAME);
-    Assert_isTrue(result == Registry_SUCCESS, (Assert_Id)NULL);
+    for (i = 0; i < ENDPTSPERCHUNK; i++) {
+        chunk->msgqObjects[i] = NULL;
+        chunk->priorities[i] = MessageQCopy_PRIORITY_NORMAL;
+    }
+    module.chunks[module.numChunks++] = chunk;
 
-    /* Gate to protect module object and lists: */
-    GateSwi_Params_init(&gatePrms);
-    module.gateSwi = GateSwi_create(&gatePrms, NULL);
+    for (i = 0; i < ENDPTSPERCHUNK; i++) {
+        if (base + i > MessageQCopy_MAX_RESERVED_ENDPOINT) {
+            putFree(base + i);
+        }
+    }
+
+    return (TRUE);
+}
+
+/*
+ *  ======== ownVrings ========
+ *  Whether priority class 'priority' has vrings of its own.
+ */
+static inline Bool ownVrings(UInt priority)
+{
+    return ((priority == MessageQCopy_PRIORITY_NORMAL) ||
+            (transport.virtQueue_fromHost[priority] !=
+             transport.virtQueue_fromHost[MessageQCopy_PRIORITY_NORMAL]));
+}
+
+/*
+ *  ======== waitToHost ========
+ *  Claim a buffer on the toHost vring of class 'priority', waiting up to
+ *  'timeout' ticks for the host to return one.  Returns its token, or -1.
+ */
+static Int16 waitToHost(UInt priority, Void **buf, Int *len, UInt timeout)
+{
+    VirtQueue_Handle vq = transport.virtQueue_toHost[priority];
+    Semaphore_Handle sem = transport.sendSem[priority];
+    UInt32 start = Clock_getTicks();
+    UInt32 elapsed;
+    UInt   wait = MessageQCopy_FOREVER;
+    Int16  token;
+    UInt   key;
+
+    key = Hwi_disable();
+    transport.sendWaiters[priority]++;
+    Hwi_restore(key);
+
+    for (;;) {
+        /* Arm the kick before looking again, so no buffer goes unnoticed */
+        VirtQueue_enableCallback(vq);
+        token = VirtQueue_claimAvailBuf(vq, buf, len);
+        if (token >= 0) {
+            break;
+        }
 
-    /* Initialize Module State: */
-    for (i = 0; i < MAXMESSAGEQOBJECTS; i++) {
-       module.msgqObjects[i] = NULL;
+        if (timeout != MessageQCopy_FOREVER) {
+            elapsed = Clock_getTicks() - start;
+            if (elapsed >= timeout) {
+                break;
+            }
+            wait = timeout - elapsed;
+        }
+        Semaphore_pend(sem, wait);
     }
 
-    HeapBuf_Params_init(&prms);
-    prms.blockSize    = MSGBUFFERSIZE;
-    prms.numBlocks    = MAXMESSAGEBUFFERS;
-    prms.buf          = recv_buffers;
-    prms.bufSize      = MAXHEAPSIZE;
-    prms.align        = HEAPALIGNMENT;
-    module.heap       = HeapBuf_create(&prms, NULL);
-    if (module.heap == 0) {
-       System_abort("MessageQCopy_init: HeapBuf_create returned 0\n");
+    key = Hwi_disable();
+    if (--transport.sendWaiters[priority] == 0) {
+        /* The last waiter gone: back to no kicks, as MessageQCopy_init set */
+        VirtQueue_disableCallback(vq);
+    }
+    else if (token >= 0) {
+        /* The host may have returned more than one: pass the wakeup on */
+        Semaphore_post(sem);
     }
+    Hwi_restore(key);
 
-    /*
-     * Create a pair VirtQueues (one for sending, one for receiving).
-     *
-     * Note: order of these calls determines the virtqueue indices identifying
-     * the vrings toHost and fromHost:  toHost is first!
-     */
-    transport.virtQueue_toHost   = VirtQueue_create(callback_availBufReady,
-                                                    remoteProcId,
-						    ID_SYSM3_TO_A9);
-    transport.virtQueue_fromHost = VirtQueue_create(callback_availBufReady,
-                                                    remoteProcId,
-						    ID_A9_TO_SYSM3);
+    return (token);
+}
 
-    /* construct the Swi to process incoming messages: */
-    transport.swiHandle = Swi_create(MessageQCopy_swiFxn, NULL, NULL);
+/*
+ *  ======== allocPayload ========
+ *  A block from the smallest size class that fits, or from a larger one
+ *  if that has none left.  HeapBuf_alloc() and HeapBuf_free() disable
+ *  interrupts for themselves, so need no gate.
+ */
+static Queue_elem *allocPayload(UInt size)
+{
+    Queue_elem *payload = NULL;
+    Int        i;
 
-    Log_print0(Diags_EXIT, "<-- "FXNN);
+    for (i = 0; (i < NUMSIZECLASSES) && (payload == NULL); i++) {
+        if (size <= sizeClasses[i].blockSize) {
+            payload = (Queue_elem *)HeapBuf_alloc(module.heaps[i],
+                    sizeClasses[i].blockSize, 0, NULL);
+        }
+    }
+
+    return (payload);
 }
-#undef FXNN
 
 /*
- *  ======== MessasgeQCopy_finalize ========
+ *  ======== freePayload ========
+ *  Back to the heap whose memory it is from: the payload's length does
+ *  not tell which, when allocPayload had to use a larger class.
  */
-#define FXNN "MessageQCopy_finalize"
-Void MessageQCopy_finalize()
+static Void freePayload(Queue_elem *payload)
 {
+    UInt8 *block = (UInt8 *)payload;
+    Int   i;
+
+    for (i = 0; i < NUMSIZECLASSES; i++) {
+        if ((block >= sizeClasses[i].buf) && (block < sizeClasses[i].buf +
+                sizeClasses[i].numBlocks * sizeClasses[i].blockSize)) {
+            HeapBuf_free(module.heaps[i], (Ptr)payload,
+                         sizeClasses[i].blockSize);
+            return;
+        }
+    }
+}
 
-   Log_print0(Diags_ENTRY, "--> "FXNN);
-   if (--curInit != 0) {
-        return; /* module still in use */
-   }
-
-   /* Tear down Module: */
-   HeapBuf_delete(&(module.heap));
+/*
+ *  ======== signalEndpt ========
+ *  Wake whoever waits for a message on an endpoint: its receiver, and the
+ *  set it is in, if not told already.
+ */
+static Void signalEndpt(MessageQCopy_Object *obj)
+{
+    MessageQCopy_SetObject *set;
+    UInt                   key;
 
-   Swi_delete(&(transport.swiHandle));
+    Semaphore_post(obj->semHandle);
 
-   GateSwi_delete(&module.gateSwi);
+    key = Hwi_disable();
+    if (((set = obj->set) != NULL) && !obj->onReady) {
+        obj->onReady = TRUE;
+        List_put(set->ready, &obj->readyElem);
+        Semaphore_post(set->semHandle);
+    }
+    Hwi_restore(key);
+}
 
-    Log_print0(Diags_EXIT, "<-- "FXNN);
+/*
+ *  ======== deferLocal ========
+ *  Leave a copied message for callback endpoint dstEndpt to the Swi (see
+ *  callDeferred), so the callback always runs there.
+ */
+static Void deferLocal(Queue_elem *payload, UInt32 dstEndpt)
+{
+    payload->dst = (UInt16)dstEndpt;
+    List_put(module.deferred, (List_Elem *)payload);
+    Swi_post(transport.swiHandle);
 }
-#undef FXNN
 
 /*
- *  ======== MessageQCopy_create ========
+ *  ======== callDeferred ========
+ *  Pass the messages deferLocal left on to their callbacks.  Called by the
+ *  Swi, so needs no gate for the lookup (see callLocal).  Those for an
+ *  endpoint deleted since are dropped.
  */
-#define FXNN "MessageQCopy_create"
-MessageQCopy_Handle MessageQCopy_create(UInt32 reserved, UInt32 * endpoint)
+static Void callDeferred()
 {
-    MessageQCopy_Object    *obj = NULL;
-    Bool                   found = FALSE;
-    Int                    i;
-    UInt16                 queueIndex = 0;
-    IArg key;
+    MessageQCopy_Object *obj;
+    Queue_elem          *payload;
 
-    Log_print2(Diags_ENTRY, "--> "FXNN": (reserved=%d, endpoint=0x%x)",
-                (IArg)reserved, (IArg)endpoint);
+    while ((payload = (Queue_elem *)List_get(module.deferred)) != NULL) {
+        obj = getObject(payload->dst);
+        if ((obj != NULL) && (obj->callback != NULL)) {
+            obj->callback(obj, obj->arg, payload->data, payload->len,
+                          payload->src);
+        }
+        freePayload(payload);
+    }
+}
 
-    Assert_isTrue((curInit > 0) , NULL);
+/*
+ *  ======== putLocal ========
+ *  Copy a message, gathered from one or more segments, onto the queue of
+ *  local endpoint dstEndpt.  For a callback endpoint, the Swi passes it
+ *  on instead: right away if we are that Swi (inSwi) and the message is
+ *  contiguous, or else from the copy, put on module.deferred.
+ */
+#define FXNN "putLocal"
+static Int putLocal(UInt32 dstEndpt, UInt32 srcEndpt, VirtQueue_Seg segs[],
+                    Int numSegs, UInt16 len, Bool inSwi)
+{
+    Int                 status = MessageQCopy_S_SUCCESS;
+    MessageQCopy_Object *obj;
+    Queue_elem          *payload;
+    Char                *data;
+    UInt                remaining = len;
+    UInt                chunk;
+    UInt                size = 0;
+    IArg                key;
+    Int                 i;
+
+    for (i = 0; i < numSegs; i++) {
+        size += segs[i].len;
+    }
+    if (size < len) {
+        Log_print1(Diags_STATUS, FXNN": message truncated, len: %d",
+               (IArg)len);
+        return (MessageQCopy_E_FAIL);
+    }
 
+    /* Protect from MessageQCopy_delete */
     key = GateSwi_enter(module.gateSwi);
+    obj = getObject(dstEndpt);
+    GateSwi_leave(module.gateSwi, key);
 
-    if (reserved == MessageQCopy_ASSIGN_ANY)  {
-       /* Search the array for a free slot above reserved: */
-       for (i = MessageQCopy_MAX_RESERVED_ENDPOINT + 1;
-           (i < MAXMESSAGEQOBJECTS) && (found == FALSE) ; i++) {
-           if (module.msgqObjects[i] == NULL) {
-            queueIndex = i;
-            found = TRUE;
-            break;
-           }
-       }
+    if (obj == NULL) {
+        Log_print1(Diags_STATUS, FXNN": no object for endpoint: %d",
+               (IArg)dstEndpt);
+        return (MessageQCopy_E_NOENDPT);
     }
-    else if ((queueIndex = reserved) <= MessageQCopy_MAX_RESERVED_ENDPOINT) {
-       if (module.msgqObjects[queueIndex] == NULL) {
-           found = TRUE;
-       }
+
+    if ((obj->callback != NULL) && (numSegs == 1) && inSwi) {
+        /* Callback endpoint: no need to copy a contiguous message */
+        obj->callback(obj, obj->arg, segs[0].buf, len, srcEndpt);
+        return (status);
     }
 
-    if (found)  {
-       obj = Memory_alloc(NULL, sizeof(MessageQCopy_Object), 0, NULL);
-       if (obj != NULL) {
-           /* Allocate a semaphore to signal when messages received: */
-           obj->semHandle = Semaphore_create(0, NULL, NULL);
+    /* Allocate a buffer to copy the payload: */
+    payload = allocPayload(len + sizeof(Queue_elem));
 
-           /* Create our queue of to be received messages: */
-           obj->queue = List_create(NULL, NULL);
+    if (payload != NULL)  {
+        data = payload->data;
+        for (i = 0; (i < numSegs) && (remaining > 0); i++) {
+            chunk = (segs[i].len < remaining) ? segs[i].len : remaining;
+            memcpy(data, segs[i].buf, chunk);
+            data += chunk;
+            remaining -= chunk;
+        }
+        payload->len = len;
+        payload->src = srcEndpt;
 
-           /* Store our endpoint, and object: */
-           obj->queueId = queueIndex;
-           module.msgqObjects[queueIndex] = obj;
+        if (obj->callback != NULL) {
+            deferLocal(payload, dstEndpt);
+        }
+        else {
+            /* Put on the endpoint's queue and signal: */
+            List_put(obj->queue, (List_Elem *)payload);
+            signalEndpt(obj);
+        }
+    }
+    else {
+        status = MessageQCopy_E_MEMORY;
+        Log_print0(Diags_STATUS, FXNN": HeapBuf_alloc failed!");
+    }
 
-           /* See MessageQCopy_unblock() */
-           obj->unblocked = FALSE;
+    return (status);
+}
+#undef FXNN
 
-           *endpoint    = queueIndex;
-           Log_print1(Diags_LIFECYCLE, FXNN": endPt created: %d",
-                        (IArg)queueIndex);
-       }
+/*
+ *  ======== callLocal ========
+ *  Hand a message from the host straight to local endpoint dstEndpt, if
+ *  it was created with a callback.  Called by the Swi, so needs no gate for
+ *  the lookup: MessageQCopy_delete() nulls the slot within gateSwi before
+ *  it tears the object down, so one found here is whole until we return.
+ */
+static inline Bool callLocal(MessageQCopy_Msg msg)
+{
+    MessageQCopy_Object *obj = getObject(msg->dstAddr);
+
+    if ((obj == NULL) || (obj->callback == NULL)) {
+        return (FALSE);
     }
 
-    GateSwi_leave(module.gateSwi, key);
+    obj->callback(obj, obj->arg, msg->payload, msg->dataLen, msg->srcAddr);
 
-    Log_print1(Diags_EXIT, "<-- "FXNN": 0x%x", (IArg)obj);
-    return (obj);
+    return (TRUE);
 }
-#undef FXNN
 
 /*
- *  ======== MessageQCopy_delete ========
+ *  ======== isHeld ========
+ *  Whether an element of an endpoint's queue is a Held_elem.
  */
-#define FXNN "MessageQCopy_delete"
-Int MessageQCopy_delete(MessageQCopy_Handle *handlePtr)
+static inline Bool isHeld(Ptr elem)
 {
-    Int                    status = MessageQCopy_S_SUCCESS;
-    MessageQCopy_Object    *obj;
-    Queue_elem             *payload;
-    IArg                   key;
+    return (((Held_elem *)elem >= &held[0]) &&
+            ((Held_elem *)elem < &held[MAXHELDBUFS]));
+}
 
-    Log_print1(Diags_ENTRY, "--> "FXNN": (handlePtr=0x%x)", (IArg)handlePtr);
+/*
+ *  ======== holdLocal ========
+ *  Queue a message for local endpoint dstEndpt in place, if it takes
+ *  messages with MessageQCopy_recvBuf: its vring buffer then goes back
+ *  to the host only once released (see releaseHeld).  Called by the Swi.
+ */
+static Bool holdLocal(VirtQueue_Handle vq, Int16 token, MessageQCopy_Msg msg)
+{
+    MessageQCopy_Object *obj;
+    Held_elem           *h = NULL;
+    IArg                key;
 
-    Assert_isTrue((curInit > 0) , NULL);
+    key = GateSwi_enter(module.gateSwi);
 
-    if (handlePtr && (obj = (MessageQCopy_Object *)(*handlePtr)))  {
+    obj = getObject(msg->dstAddr);
+    if ((obj != NULL) && obj->zeroCopy &&
+        ((h = (Held_elem *)List_get(module.freeHeld)) != NULL)) {
+        h->len = msg->dataLen;
+        h->src = msg->srcAddr;
+        h->data = (Char *)msg->payload;
+        h->vq = vq;
+        h->token = token;
+
+        List_put(obj->queue, (List_Elem *)h);
+        signalEndpt(obj);
+    }
 
-       Semaphore_delete(&(obj->semHandle));
+    GateSwi_leave(module.gateSwi, key);
 
-       /* Free/discard all queued message buffers: */
-       while ((payload = (Queue_elem *)List_get(obj->queue)) != NULL) {
-           HeapBuf_free(module.heap, (Ptr)payload, MSGBUFFERSIZE);
-       }
+    return (h != NULL);
+}
 
-       List_delete(&(obj->queue));
+/*
+ *  ======== releaseHeld ========
+ *  Give the vring buffer of a held message back to the host.
+ */
+static Void releaseHeld(Held_elem *h)
+{
+    IArg key;
 
-       /* Null out our slot: */
-       key = GateSwi_enter(module.gateSwi);
-       module.msgqObjects[obj->queueId] = NULL;
-       GateSwi_leave(module.gateSwi, key);
+    /* The Swi adds used buffers to the same vring */
+    key = GateSwi_enter(module.gateSwi);
+    VirtQueue_addUsedBuf(h->vq, h->token, 0);
+    VirtQueue_kick(h->vq);
+    h->vq = NULL;
+    GateSwi_leave(module.gateSwi, key);
 
-       Log_print1(Diags_LIFECYCLE, FXNN": endPt deleted: %d",
-                        (IArg)obj->queueId);
+    List_put(module.freeHeld, (List_Elem *)h);
+}
 
-       /* Now free the obj */
-       Memory_free(NULL, obj, sizeof(MessageQCopy_Object));
+/*
+ *  ======== recvBatch ========
+ *  Pass on a batch of messages from the host, and return their buffers
+ *  with a single used index update, but for those held for
+ *  MessageQCopy_recvBuf.  Returns the number of messages, at most 'max'.
+ */
+#define FXNN "recvBatch"
+static Int recvBatch(VirtQueue_Handle vq, Int max)
+{
+    Int16             tokens[MAXRECVBATCH];
+    MessageQCopy_Msg  msgs[MAXRECVBATCH];
+    int               lens[MAXRECVBATCH];
+    VirtQueue_Seg     segs[MAXMSGSEGS];
+    Int               numSegs;
+    MessageQCopy_Msg  msg;
+    UInt16            dstProc = MultiProc_self();
+    /* CORE0 takes back the buffers of the core vring in order only */
+    Bool              hold = (vq != transport.virtQueue_fromCore);
+    Int               count;
+    Int               used = 0;
+    Int               i;
 
-       *handlePtr = NULL;
+    count = VirtQueue_getAvailBufs(vq, tokens, (Void **)msgs, lens,
+                                   (max < MAXRECVBATCH) ? max : MAXRECVBATCH);
+
+    for (i = 0; i < count; i++) {
+        msg = msgs[i];
+
+        Log_print3(Diags_INFO, FXNN": \n\tReceived msg: from: 0x%x, "
+                   "to: 0x%x, dataLen: %d",
+                  (IArg)msg->srcAddr, (IArg)msg->dstAddr,
+                  (IArg)msg->dataLen);
+
+        if (msg->dataLen + sizeof(MessageQCopy_MsgHeader) <= lens[i]) {
+            if (callLocal(msg)) {
+                /* Done with already: returned with the others */
+            }
+            else if (hold && holdLocal(vq, tokens[i], msg)) {
+                /* Returned by MessageQCopy_releaseBuf() */
+                continue;
+            }
+            else {
+                /* Pass to desitination queue (which is on this proc): */
+                MessageQCopy_send(dstProc, msg->dstAddr, msg->srcAddr,
+                                 (Ptr)msg->payload, msg->dataLen);
+            }
+        }
+        else {
+            /* The rest of the message is in chained segments */
+            numSegs = VirtQueue_getBufChain(vq, tokens[i], segs, MAXMSGSEGS);
+            segs[0].buf = msg->payload;
+            segs[0].len -= sizeof(MessageQCopy_MsgHeader);
+            putLocal(msg->dstAddr, msg->srcAddr, segs, numSegs,
+                     msg->dataLen, TRUE);
+        }
+
+        /* Nothing written to it, so nothing to write back */
+        tokens[used] = tokens[i];
+        lens[used++] = 0;
     }
 
-    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
-    return(status);
+    if (used > 0) {
+        VirtQueue_addUsedBufs(vq, tokens, lens, used);
+    }
+
+    return (count);
 }
 #undef FXNN
 
 /*
- *  ======== MessageQCopy_recv ========
+ *  ======== recvCore ========
+ *  Pass on up to 'max' messages from the other M3 core.  On CORE0, which
+ *  drives the vring, they come back as used buffers, each handed straight
+ *  back for CORE1 to send the next one in.  Returns the number of messages.
  */
-#define FXNN "MessageQCopy_recv"
-Int MessageQCopy_recv(MessageQCopy_Handle handle, Ptr data, UInt16 *len,
-                      UInt32 *rplyEndpt, UInt timeout)
+#define FXNN "recvCore"
+static Int recvCore(Int max)
 {
-    Int                 status = MessageQCopy_S_SUCCESS;
-    MessageQCopy_Object *obj = (MessageQCopy_Object *)handle;
-    Bool                semStatus;
-    Queue_elem          *payload;
+    VirtQueue_Handle  vq = transport.virtQueue_fromCore;
+    VirtQueue_Seg     seg;
+    MessageQCopy_Msg  msg;
+    Int               count;
+
+    if (vq == NULL) {
+        return (0);
+    }
+    if (!transport.coreDriver) {
+        return (recvBatch(vq, max));
+    }
+
+    for (count = 0; count < max; count++) {
+        msg = VirtQueue_getUsedBuf(vq);
+        if (msg == NULL) {
+            break;
+        }
+
+        Log_print3(Diags_INFO, FXNN": \n\tReceived msg: from: 0x%x, "
+                   "to: 0x%x, dataLen: %d",
+                  (IArg)msg->srcAddr, (IArg)msg->dstAddr,
+                  (IArg)msg->dataLen);
+
+        if (msg->dataLen + sizeof(MessageQCopy_MsgHeader) <= RP_MSG_BUF_SIZE) {
+            seg.buf = msg->payload;
+            seg.len = msg->dataLen;
+            putLocal(msg->dstAddr, msg->srcAddr, &seg, 1, msg->dataLen,
+                     TRUE);
+        }
+
+        VirtQueue_addAvailBuf(vq, msg);
+    }
+
+    return (count);
+}
+#undef FXNN
+
+/*
+ *  ======== getCoreBuf ========
+ *  CORE0: a buffer to send to CORE1 in, one CORE1 has returned, or one
+ *  not sent yet.  Call within gateSwi.
+ */
+static MessageQCopy_Msg getCoreBuf()
+{
+    MessageQCopy_Msg  msg;
+
+    msg = VirtQueue_getUsedBuf(transport.virtQueue_toCore);
+    if ((msg == NULL) && (transport.numCoreBufsFree > 0)) {
+        msg = transport.coreBufsFree[--transport.numCoreBufsFree];
+    }
+    if ((msg == NULL) && (transport.coreBufsUnused > 0)) {
+        msg = (MessageQCopy_Msg)(COREBUFS_DA + RP_MSG_BUF_SIZE *
+                (2 * CORENUMBUFS - transport.coreBufsUnused--));
+    }
+
+    return (msg);
+}
+
+/*
+ *  ======== sendCore ========
+ *  CORE0: send a message to CORE1 on the vring we drive.  Call within
+ *  gateSwi.
+ */
+static Int sendCore(UInt32 dstEndpt, UInt32 srcEndpt, Ptr data, UInt16 len)
+{
+    VirtQueue_Handle  vq = transport.virtQueue_toCore;
+    MessageQCopy_Msg  msg;
+
+    /* These vrings have no chained buffers */
+    if (len + sizeof(MessageQCopy_MsgHeader) > RP_MSG_BUF_SIZE) {
+        return (MessageQCopy_E_FAIL);
+    }
+
+    if ((msg = getCoreBuf()) == NULL) {
+        return (MessageQCopy_E_FAIL);
+    }
+
+    memcpy(msg->payload, data, len);
+    msg->dataLen = len;
+    msg->dstAddr = dstEndpt;
+    msg->srcAddr = srcEndpt;
+    msg->flags = 0;
+    msg->reserved = 0;
+
+    VirtQueue_addAvailBuf(vq, msg);
+    VirtQueue_kick(vq);
+
+    return (MessageQCopy_S_SUCCESS);
+}
+
+/*
+ *  ======== coreInit ========
+ *  Set up the vrings to and from the other M3 core, from MessageQCopy_init.
+ *  CORE0 drives both; on CORE1, VirtQueue_create waits for CORE0 to have
+ *  laid them out.  A CORE1 that CORE0 does not answer in time sends to it
+ *  through the host instead.
+ */
+#define FXNN "coreInit"
+static Void coreInit()
+{
+    VirtQueue_Handle  toCore;
+    VirtQueue_Handle  fromCore;
+    Int               i;
+
+    if (transport.coreProcId == MultiProc_INVALIDID) {
+        return;
+    }
+
+    if (transport.coreDriver) {
+        fromCore = VirtQueue_create(callback_availBufReady,
+                transport.coreProcId, ID_CORE1_TO_CORE0);
+        toCore = VirtQueue_create(callback_availBufReady,
+                transport.coreProcId, ID_CORE0_TO_CORE1);
+        if (!fromCore || !toCore) {
+            System_abort("MessageQCopy_init: VirtQueue_create failed\n");
+        }
+
+        /* The first half of our buffers are for CORE1 to send in */
+        for (i = 0; i < CORENUMBUFS; i++) {
+            VirtQueue_addAvailBuf(fromCore,
+                    (Void *)(COREBUFS_DA + RP_MSG_BUF_SIZE * i));
+        }
+        transport.coreBufsUnused = CORENUMBUFS;
+    }
+    else {
+        fromCore = VirtQueue_create(callback_availBufReady,
+                transport.coreProcId, ID_CORE0_TO_CORE1);
+        if (fromCore == NULL) {
+            Log_print0(Diags_INFO, FXNN": CORE0 did not answer, going "
+                       "through the host");
+            return;
+        }
+        toCore = VirtQueue_create(callback_availBufReady,
+                transport.coreProcId, ID_CORE1_TO_CORE0);
+        if (toCore == NULL) {
+            System_abort("MessageQCopy_init: VirtQueue_create failed\n");
+        }
+    }
+
+    /* Senders never wait on toCore, so it need not kick us */
+    VirtQueue_disableCallback(toCore);
+
+    Log_print2(Diags_INFO, FXNN": linked to core %d as %s",
+               (IArg)transport.coreProcId,
+               (IArg)(transport.coreDriver ? "driver" : "device"));
+
+    transport.virtQueue_toCore = toCore;
+    transport.virtQueue_fromCore = fromCore;
+
+    /* Pick up anything CORE0 sent before we got here */
+    Swi_post(transport.swiHandle);
+}
+#undef FXNN
+
+/*
+ *  ======== repostSwi ========
+ *  Clock function: resume draining after the Swi ran out of budget.
+ */
+static Void repostSwi(UArg arg)
+{
+    Swi_post((Swi_Handle)arg);
+}
+
+/*
+ *  ======== MessageQCopy_swiFxn ========
+ *  Drains the vrings from the host a batch at a time, always from the
+ *  highest priority class with messages pending, so a control message
+ *  waits behind at most one batch of bulk traffic.
+ *
+ *  With a budget set, it stops once that many messages are processed or
+ *  that much time has passed, and leaves the rest to a run a Clock tick
+ *  later: a Swi posted again right away would run before any Task.
+ *
+ *  Messages from the other M3 core, once linked, come after all of those,
+ *  and those sent to callback endpoints from this processor before.
+ */
+#define FXNN "MessageQCopy_swiFxn"
+static Void MessageQCopy_swiFxn(UArg arg0, UArg arg1)
+{
+    Bool              usedBufAdded[MessageQCopy_NUM_PRIORITIES];
+    Bool              coreUsed = FALSE;
+    VirtQueue_Handle  fromCore = transport.virtQueue_fromCore;
+    Bool              pending;
+    Bool              overBudget = FALSE;
+    UInt              priority;
+    Int               left = -1;   /* Messages left in the budget */
+    Bits32            start = 0;
+    Int               count;
+    Int               i;
+
+    Log_print0(Diags_ENTRY, "--> "FXNN);
+
+    callDeferred();
+
+    if (transport.swiMaxMsgs != 0) {
+        left = transport.swiMaxMsgs;
+    }
+    if (transport.swiMaxCounts != 0) {
+        start = Timestamp_get32();
+    }
+
+    for (priority = 0; priority < MessageQCopy_NUM_PRIORITIES; priority++) {
+        usedBufAdded[priority] = FALSE;
+
+        /* No need for the host to kick us while we are draining the vring */
+        if (ownVrings(priority)) {
+            VirtQueue_disableCallback(transport.virtQueue_fromHost[priority]);
+        }
+    }
+    if (fromCore) {
+        VirtQueue_disableCallback(fromCore);
+    }
+
+    do {
+        /* Process all available buffers, starting over after each batch */
+        i = 0;
+        while (i <= MessageQCopy_NUM_PRIORITIES) {
+            /* The time budget is checked between batches */
+            if ((left == 0) || ((transport.swiMaxCounts != 0) &&
+                    (Timestamp_get32() - start >= transport.swiMaxCounts))) {
+                overBudget = TRUE;
+                break;
+            }
+
+            if (i == MessageQCopy_NUM_PRIORITIES) {
+                /* Last, the vring from the other core */
+                if ((count = recvCore((left < 0) ? MAXRECVBATCH : left)) > 0) {
+                    coreUsed = TRUE;
+                    if (left > 0) {
+                        left -= count;
+                    }
+                    i = 0;
+                }
+                else {
+                    i++;
+                }
+                continue;
+            }
+
+            priority = drainOrder[i];
+            if (ownVrings(priority) &&
+                ((count = recvBatch(transport.virtQueue_fromHost[priority],
+                        (left < 0) ? MAXRECVBATCH : left)) > 0)) {
+                usedBufAdded[priority] = TRUE;
+                if (left > 0) {
+                    left -= count;
+                }
+                i = 0;
+            }
+            else {
+                i++;
+            }
+        }
+
+        if (overBudget) {
+            /* Leave the kicks off: the next run picks up where we stopped */
+            Log_print0(Diags_INFO, FXNN": out of budget");
+            Clock_start(transport.swiClock);
+            break;
+        }
+
+        /* Re-arm the kicks; catch buffers added before the host saw them */
+        pending = FALSE;
+        for (i = 0; i < MessageQCopy_NUM_PRIORITIES; i++) {
+            if (ownVrings(i) &&
+                !VirtQueue_enableCallback(transport.virtQueue_fromHost[i])) {
+                pending = TRUE;
+            }
+        }
+        if (fromCore && !VirtQueue_enableCallback(fromCore)) {
+            pending = TRUE;
+        }
+    } while (pending);
+
+    for (i = 0; i < MessageQCopy_NUM_PRIORITIES; i++) {
+        if (usedBufAdded[i])  {
+            /* Tell host we've processed the buffers: */
+            VirtQueue_kick(transport.virtQueue_fromHost[i]);
+        }
+    }
+    if (coreUsed) {
+        VirtQueue_kick(fromCore);
+    }
+
+    Log_print0(Diags_EXIT, "<-- "FXNN);
+}
+#undef FXNN
+
+#define FXNN "callback_availBufReady"
+static Void callback_availBufReady(VirtQueue_Handle vq)
+{
+    UInt priority;
+
+    for (priority = 0; priority < MessageQCopy_NUM_PRIORITIES; priority++) {
+        if (vq == transport.virtQueue_fromHost[priority])  {
+           /* Post a SWI to process all incoming messages */
+            Log_print1(Diags_INFO, FXNN": virtQueue_fromHost[%d] kicked",
+                       (IArg)priority);
+            VirtQueue_disableCallback(vq);
+            Swi_post(transport.swiHandle);
+            return;
+        }
+    }
+
+    if (vq == transport.virtQueue_fromCore) {
+        Log_print0(Diags_INFO, FXNN": virtQueue_fromCore kicked");
+        VirtQueue_disableCallback(vq);
+        Swi_post(transport.swiHandle);
+        return;
+    }
+
+    for (priority = 0; priority < MessageQCopy_NUM_PRIORITIES; priority++) {
+        if (vq == transport.virtQueue_toHost[priority])  {
+            /* The host returned buffers: wake a sender waiting for one */
+            Log_print1(Diags_INFO, FXNN": virtQueue_toHost[%d] kicked",
+                       (IArg)priority);
+            VirtQueue_disableCallback(vq);
+            if (transport.sendWaiters[priority] > 0) {
+                Semaphore_post(transport.sendSem[priority]);
+            }
+            return;
+        }
+    }
+}
+#undef FXNN
+
+/* =============================================================================
+ *  MessageQCopy Functions:
+ * =============================================================================
+ */
+
+/*
+ *  ======== MessasgeQCopy_init ========
+ *
+ *
+ */
+#define FXNN "MessageQCopy_init"
+Void MessageQCopy_init(UInt16 remoteProcId)
+{
+    GateSwi_Params gatePrms;
+    Clock_Params   clockPrms;
+    HeapBuf_Params prms;
+    int     i;
+    Int     id;
+    Registry_Result result;
+
+    Log_print1(Diags_ENTRY, "--> "FXNN": (remoteProcId=%d)",
+                (IArg)remoteProcId);
+
+    if (curInit++ != 0) {
+        return; /* module already initialized */
+    }
+
+    /* register with xdc.runtime to get a diags mask */
+    result = Registry_addModule(&Registry_CURDESC, MODULE_NAME);
+    Assert_isTrue(result == Registry_SUCCESS, (Assert_Id)NULL);
+
+    /* Gate to protect module object and lists: */
+    GateSwi_Params_init(&gatePrms);
+    module.gateSwi = GateSwi_create(&gatePrms, NULL);
+
+    /* Initialize Module State, the endpoint table with the reserved ids: */
+    for (i = 0; i < MAXENDPTCHUNKS; i++) {
+       module.chunks[i] = NULL;
+    }
+    module.numChunks = 0;
+    module.freeHead = NOENDPT;
+    do {
+       if (!growTable()) {
+           System_abort("MessageQCopy_init: Memory_alloc failed\n");
+       }
+    } while (module.numChunks * ENDPTSPERCHUNK <=
+             MessageQCopy_MAX_RESERVED_ENDPOINT);
+
+    for (i = 0; i < NUMSIZECLASSES; i++) {
+       HeapBuf_Params_init(&prms);
+       prms.blockSize    = sizeClasses[i].blockSize;
+       prms.numBlocks    = sizeClasses[i].numBlocks;
+       prms.buf          = sizeClasses[i].buf;
+       prms.bufSize      = sizeClasses[i].numBlocks * sizeClasses[i].blockSize;
+       prms.align        = HEAPALIGNMENT;
+       module.heaps[i]   = HeapBuf_create(&prms, NULL);
+       if (module.heaps[i] == 0) {
+          System_abort("MessageQCopy_init: HeapBuf_create returned 0\n");
+       }
+    }
+
+    module.freeHeld = List_create(NULL, NULL);
+    module.deferred = List_create(NULL, NULL);
+    for (i = 0; i < MAXHELDBUFS; i++) {
+       held[i].vq = NULL;
+       List_put(module.freeHeld, (List_Elem *)&held[i]);
+    }
+
+    module.freeClaimed = List_create(NULL, NULL);
+    for (i = 0; i < MAXCLAIMEDBUFS; i++) {
+       claimed[i].msg = NULL;
+       List_put(module.freeClaimed, (List_Elem *)&claimed[i]);
+    }
+
+    /*
+     * Create a pair VirtQueues (one for sending, one for receiving).
+     *
+     * Note: order of these calls determines the virtqueue indices identifying
+     * the vrings toHost and fromHost:  toHost is first!
+     */
+    transport.virtQueue_toHost[MessageQCopy_PRIORITY_NORMAL] =
+            VirtQueue_create(callback_availBufReady, remoteProcId,
+                             ID_SYSM3_TO_A9);
+    transport.virtQueue_fromHost[MessageQCopy_PRIORITY_NORMAL] =
+            VirtQueue_create(callback_availBufReady, remoteProcId,
+                             ID_A9_TO_SYSM3);
+
+    /*
+     * The other classes get the vrings of the further rpmsg vdevs of the
+     * resource table, if any, in the same order: toHost first.
+     */
+    for (i = 0; i < MessageQCopy_NUM_PRIORITIES; i++) {
+        transport.virtQueue_toHost[i] =
+                transport.virtQueue_toHost[MessageQCopy_PRIORITY_NORMAL];
+        transport.virtQueue_fromHost[i] =
+                transport.virtQueue_fromHost[MessageQCopy_PRIORITY_NORMAL];
+
+        if ((i == MessageQCopy_PRIORITY_NORMAL) ||
+            ((id = VirtQueue_findVrings(VIRTIO_ID_RPMSG, i, 2)) < 0)) {
+            continue;
+        }
+
+        transport.virtQueue_toHost[i] = VirtQueue_create(
+                callback_availBufReady, remoteProcId, id);
+        transport.virtQueue_fromHost[i] = VirtQueue_create(
+                callback_availBufReady, remoteProcId, id + 1);
+        if (!transport.virtQueue_toHost[i] || !transport.virtQueue_fromHost[i]) {
+            System_abort("MessageQCopy_init: VirtQueue_create failed\n");
+        }
+        Log_print2(Diags_INFO, FXNN": priority %d on vrings %d", (IArg)i,
+                   (IArg)id);
+    }
+
+    /*
+     * Only senders out of toHost buffers wait for the host to return some
+     * (see waitToHost), so until then ask it not to kick us each time.
+     */
+    for (i = 0; i < MessageQCopy_NUM_PRIORITIES; i++) {
+        transport.sendWaiters[i] = 0;
+        if (ownVrings(i)) {
+            transport.sendSem[i] = Semaphore_create(0, NULL, NULL);
+            VirtQueue_disableCallback(transport.virtQueue_toHost[i]);
+        }
+        else {
+            transport.sendSem[i] = NULL;
+        }
+    }
+
+    /* construct the Swi to process incoming messages: */
+    transport.swiHandle = Swi_create(MessageQCopy_swiFxn, NULL, NULL);
+
+    /* ... and a one-shot Clock to re-post it when it runs out of budget */
+    transport.swiMaxMsgs = 0;
+    transport.swiMaxCounts = 0;
+    Clock_Params_init(&clockPrms);
+    clockPrms.arg = (UArg)transport.swiHandle;
+    transport.swiClock = Clock_create(repostSwi, 1, &clockPrms, NULL);
+
+    /* The two M3 cores also talk directly, over vrings CORE0 drives */
+    transport.virtQueue_toCore = NULL;
+    transport.virtQueue_fromCore = NULL;
+    transport.coreDriver = (MultiProc_self() == MultiProc_getId("CORE0"));
+    if (transport.coreDriver) {
+        transport.coreProcId = MultiProc_getId("CORE1");
+    }
+    else if (MultiProc_self() == MultiProc_getId("CORE1")) {
+        transport.coreProcId = MultiProc_getId("CORE0");
+    }
+    else {
+        transport.coreProcId = MultiProc_INVALIDID;
+    }
+    coreInit();
+
+    Log_print0(Diags_EXIT, "<-- "FXNN);
+}
+#undef FXNN
+
+/*
+ *  ======== MessasgeQCopy_finalize ========
+ */
+#define FXNN "MessageQCopy_finalize"
+Void MessageQCopy_finalize()
+{
+   Int i;
+
+   Log_print0(Diags_ENTRY, "--> "FXNN);
+   if (--curInit != 0) {
+        return; /* module still in use */
+   }
+
+   /* Tear down Module: */
+   for (i = 0; i < NUMSIZECLASSES; i++) {
+       HeapBuf_delete(&(module.heaps[i]));
+   }
+   List_delete(&(module.freeHeld));
+   List_delete(&(module.freeClaimed));
+   List_delete(&(module.deferred));
+
+   for (i = 0; i < module.numChunks; i++) {
+       Memory_free(NULL, module.chunks[i], sizeof(MessageQCopy_Chunk));
+       module.chunks[i] = NULL;
+   }
+   module.numChunks = 0;
+
+   Clock_delete(&(transport.swiClock));
+   Swi_delete(&(transport.swiHandle));
+
+   for (i = 0; i < MessageQCopy_NUM_PRIORITIES; i++) {
+       if (transport.sendSem[i]) {
+           Semaphore_delete(&(transport.sendSem[i]));
+       }
+   }
+
+   GateSwi_delete(&module.gateSwi);
+
+    Log_print0(Diags_EXIT, "<-- "FXNN);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_create ========
+ */
+MessageQCopy_Handle MessageQCopy_create(UInt32 reserved, UInt32 * endpoint)
+{
+    return (MessageQCopy_createWithCallback(reserved, endpoint, NULL, 0));
+}
+
+/*
+ *  ======== MessageQCopy_createWithCallback ========
+ */
+#define FXNN "MessageQCopy_createWithCallback"
+MessageQCopy_Handle MessageQCopy_createWithCallback(UInt32 reserved,
+                                                    UInt32 * endpoint,
+                                                    MessageQCopy_Callback fxn,
+                                                    UArg arg)
+{
+    MessageQCopy_Object    *obj = NULL;
+    Bool                   found = FALSE;
+    UInt32                 queueIndex = 0;
+    IArg key;
+
+    Log_print4(Diags_ENTRY, "--> "FXNN": (reserved=%d, endpoint=0x%x, "
+                "fxn=0x%x, arg=0x%x)", (IArg)reserved, (IArg)endpoint,
+                (IArg)fxn, (IArg)arg);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    key = GateSwi_enter(module.gateSwi);
+
+    if (reserved == MessageQCopy_ASSIGN_ANY)  {
+       /* Take the endpoint free longest, growing the table if none: */
+       if ((module.freeHead != NOENDPT) || growTable()) {
+           queueIndex = module.freeHead;
+           module.freeHead = module.chunks[queueIndex / ENDPTSPERCHUNK]->
+                   nextFree[queueIndex % ENDPTSPERCHUNK];
+           found = TRUE;
+       }
+    }
+    else if ((queueIndex = reserved) <= MessageQCopy_MAX_RESERVED_ENDPOINT) {
+       if (getObject(queueIndex) == NULL) {
+           found = TRUE;
+       }
+    }
+
+    if (found)  {
+       obj = Memory_alloc(NULL, sizeof(MessageQCopy_Object), 0, NULL);
+       if (obj != NULL) {
+           /* Allocate a semaphore to signal when messages received: */
+           obj->semHandle = Semaphore_create(0, NULL, NULL);
+
+           /* Create our queue of to be received messages: */
+           obj->queue = List_create(NULL, NULL);
+
+           /* Store our endpoint, and object: */
+           obj->queueId = queueIndex;
+           setObject(queueIndex, obj);
+
+           /* See MessageQCopy_unblock() */
+           obj->unblocked = FALSE;
+
+           /* See MessageQCopy_recvBuf() */
+           obj->zeroCopy = FALSE;
+
+           /* See MessageQCopy_addToSet() */
+           obj->set = NULL;
+           obj->onReady = FALSE;
+
+           /* NULL but for MessageQCopy_createWithCallback() */
+           obj->callback = fxn;
+           obj->arg = arg;
+
+           /* See MessageQCopy_setPriority() */
+           module.chunks[queueIndex / ENDPTSPERCHUNK]->priorities[
+                   queueIndex % ENDPTSPERCHUNK] = MessageQCopy_PRIORITY_NORMAL;
+
+           *endpoint    = queueIndex;
+           Log_print1(Diags_LIFECYCLE, FXNN": endPt created: %d",
+                        (IArg)queueIndex);
+       }
+       else if (reserved == MessageQCopy_ASSIGN_ANY) {
+           putFree(queueIndex);
+       }
+    }
+
+    GateSwi_leave(module.gateSwi, key);
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": 0x%x", (IArg)obj);
+    return (obj);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_delete ========
+ */
+#define FXNN "MessageQCopy_delete"
+Int MessageQCopy_delete(MessageQCopy_Handle *handlePtr)
+{
+    Int                    status = MessageQCopy_S_SUCCESS;
+    MessageQCopy_Object    *obj;
+    Queue_elem             *payload;
+    IArg                   key;
+
+    Log_print1(Diags_ENTRY, "--> "FXNN": (handlePtr=0x%x)", (IArg)handlePtr);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    if (handlePtr && (obj = (MessageQCopy_Object *)(*handlePtr)))  {
+
+       if (obj->set != NULL) {
+           MessageQCopy_removeFromSet(obj->set, obj);
+       }
 
-    Log_print5(Diags_ENTRY, "--> "FXNN": (handle=0x%x, data=0x%x, len=0x%x,"
-               "rplyEndpt=0x%x, timeout=%d)", (IArg)handle, (IArg)data,
-               (IArg)len, (IArg)rplyEndpt, (IArg)timeout);
+       /*
+        * Null out our slot first: the Swi, which looks objects up without
+        * the gate (see callLocal), can then no longer find this one.
+        */
+       key = GateSwi_enter(module.gateSwi);
+       setObject(obj->queueId, NULL);
+       if (obj->queueId > MessageQCopy_MAX_RESERVED_ENDPOINT) {
+           putFree(obj->queueId);
+       }
+       GateSwi_leave(module.gateSwi, key);
 
-    Assert_isTrue((curInit > 0) , NULL);
+       Semaphore_delete(&(obj->semHandle));
+
+       /* Free/discard all queued message buffers: */
+       while ((payload = (Queue_elem *)List_get(obj->queue)) != NULL) {
+           if (isHeld(payload)) {
+               releaseHeld((Held_elem *)payload);
+           }
+           else {
+               freePayload(payload);
+           }
+       }
+
+       List_delete(&(obj->queue));
+
+       Log_print1(Diags_LIFECYCLE, FXNN": endPt deleted: %d",
+                        (IArg)obj->queueId);
+
+       /* Now free the obj */
+       Memory_free(NULL, obj, sizeof(MessageQCopy_Object));
+
+       *handlePtr = NULL;
+    }
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
+    return(status);
+}
+#undef FXNN
+
+/*
+ *  ======== getPayload ========
+ *  Wait up to 'timeout' for the next element of an endpoint's queue: a
+ *  Queue_elem, or a Held_elem for a message left in its vring buffer.
+ */
+#define FXNN "getPayload"
+static Int getPayload(MessageQCopy_Object *obj, UInt timeout, Ptr *elem)
+{
+    Int                 status = MessageQCopy_S_SUCCESS;
+    Bool                semStatus;
 
     /* Check vring for pending messages before we block: */
     Swi_post(transport.swiHandle);
 
+    /* None for us yet: maybe the host is about to send one */
+    if ((Semaphore_getCount(obj->semHandle) == 0) &&
+        VirtQueue_poll(transport.virtQueue_fromHost[
+                getPriority(obj->queueId)])) {
+        Swi_post(transport.swiHandle);
+    }
+
     /*  Block until notified. */
     semStatus = Semaphore_pend(obj->semHandle, timeout);
 
@@ -424,22 +1490,493 @@ Int MessageQCopy_recv(MessageQCopy_Handle handle, Ptr data, UInt16 *len,
     else if (obj->unblocked) {
        status = MessageQCopy_E_UNBLOCKED;
     }
-    else  {
-       payload = (Queue_elem *)List_get(obj->queue);
-
-       if (!payload) {
-           System_abort("MessageQCopy_recv: got a NULL payload\n");
-       }
+    else  {
+       *elem = List_get(obj->queue);
+
+       if (!*elem) {
+           System_abort("MessageQCopy_recv: got a NULL payload\n");
+       }
+    }
+
+    return (status);
+}
+#undef FXNN
+
+/*
+ *  ======== payloadInfo ========
+ *  Where the data of a queue element is, for MessageQCopy_recvBuf(): in
+ *  its vring buffer if held, or else the copy (local or chained message).
+ */
+static Void payloadInfo(Ptr elem, Ptr *data, UInt16 *len, UInt32 *src)
+{
+    Held_elem  *h;
+    Queue_elem *payload;
+
+    if (isHeld(elem)) {
+        h = (Held_elem *)elem;
+        *data = h->data;
+        *len = h->len;
+        *src = h->src;
+    }
+    else {
+        payload = (Queue_elem *)elem;
+        *data = payload->data;
+        *len = payload->len;
+        *src = payload->src;
+    }
+}
+
+/*
+ *  ======== MessageQCopy_recv ========
+ */
+#define FXNN "MessageQCopy_recv"
+Int MessageQCopy_recv(MessageQCopy_Handle handle, Ptr data, UInt16 *len,
+                      UInt32 *rplyEndpt, UInt timeout)
+{
+    Int                 status;
+    MessageQCopy_Object *obj = (MessageQCopy_Object *)handle;
+    Ptr                 elem;
+    Queue_elem          *payload;
+    Held_elem           *h;
+
+    Log_print5(Diags_ENTRY, "--> "FXNN": (handle=0x%x, data=0x%x, len=0x%x,"
+               "rplyEndpt=0x%x, timeout=%d)", (IArg)handle, (IArg)data,
+               (IArg)len, (IArg)rplyEndpt, (IArg)timeout);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    status = getPayload(obj, timeout, &elem);
+
+    if ((status == MessageQCopy_S_SUCCESS) && isHeld(elem)) {
+       /* Copy out of the vring buffer, and give it back to the host */
+       h = (Held_elem *)elem;
+       memcpy(data, h->data, h->len);
+       *len = h->len;
+       *rplyEndpt = h->src;
+
+       releaseHeld(h);
+    }
+    else if (status == MessageQCopy_S_SUCCESS)  {
+       /* Now, copy payload to client and free our internal msg */
+       payload = (Queue_elem *)elem;
+       memcpy(data, payload->data, payload->len);
+       *len = payload->len;
+       *rplyEndpt = payload->src;
+
+       freePayload(payload);
+    }
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
+    return (status);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_recvBuf ========
+ */
+#define FXNN "MessageQCopy_recvBuf"
+Int MessageQCopy_recvBuf(MessageQCopy_Handle handle, Ptr *data, UInt16 *len,
+                         UInt32 *rplyEndpt, UInt timeout)
+{
+    Int                 status;
+    MessageQCopy_Object *obj = (MessageQCopy_Object *)handle;
+    Ptr                 elem;
+
+    Log_print5(Diags_ENTRY, "--> "FXNN": (handle=0x%x, data=0x%x, len=0x%x,"
+               "rplyEndpt=0x%x, timeout=%d)", (IArg)handle, (IArg)data,
+               (IArg)len, (IArg)rplyEndpt, (IArg)timeout);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    /* From now on, leave the host's messages for us in their buffers */
+    obj->zeroCopy = TRUE;
+
+    status = getPayload(obj, timeout, &elem);
+
+    if (status == MessageQCopy_S_SUCCESS) {
+       payloadInfo(elem, data, len, rplyEndpt);
+    }
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
+    return (status);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_recvMany ========
+ */
+#define FXNN "MessageQCopy_recvMany"
+Int MessageQCopy_recvMany(MessageQCopy_Handle handle,
+                          MessageQCopy_RecvMsg msgs[], UInt max,
+                          UInt *count, UInt timeout)
+{
+    Int                 status;
+    MessageQCopy_Object *obj = (MessageQCopy_Object *)handle;
+    Ptr                 elem;
+    UInt                n = 0;
+
+    Log_print5(Diags_ENTRY, "--> "FXNN": (handle=0x%x, msgs=0x%x, max=%d,"
+               "count=0x%x, timeout=%d)", (IArg)handle, (IArg)msgs,
+               (IArg)max, (IArg)count, (IArg)timeout);
+
+    Assert_isTrue((curInit > 0) , NULL);
+    Assert_isTrue((max > 0) , NULL);
+
+    /* As MessageQCopy_recvBuf(), the messages left in their buffers */
+    obj->zeroCopy = TRUE;
+
+    status = getPayload(obj, timeout, &elem);
+
+    if (status == MessageQCopy_S_SUCCESS) {
+       payloadInfo(elem, &msgs[0].data, &msgs[0].len, &msgs[0].rplyEndpt);
+       n = 1;
+
+       /*
+        * Take the others already queued without blocking: each was put on
+        * the queue before its post, so a count taken is a message there.
+        */
+       while ((n < max) && !obj->unblocked &&
+              Semaphore_pend(obj->semHandle, 0)) {
+           if ((elem = List_get(obj->queue)) == NULL) {
+               /*
+                * That was MessageQCopy_unblock()'s post: put it back, for
+                * the next receive to return MessageQCopy_E_UNBLOCKED.
+                */
+               Semaphore_post(obj->semHandle);
+               break;
+           }
+           payloadInfo(elem, &msgs[n].data, &msgs[n].len,
+                       &msgs[n].rplyEndpt);
+           n++;
+       }
+    }
+
+    *count = n;
+
+    Log_print2(Diags_EXIT, "<-- "FXNN": %d, count=%d", (IArg)status,
+               (IArg)n);
+    return (status);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_releaseBuf ========
+ */
+#define FXNN "MessageQCopy_releaseBuf"
+Int MessageQCopy_releaseBuf(MessageQCopy_Handle handle, Ptr data)
+{
+    Int                 status = MessageQCopy_S_SUCCESS;
+    Queue_elem          *payload;
+    Int                 i;
+
+    Log_print2(Diags_ENTRY, "--> "FXNN": (handle=0x%x, data=0x%x)",
+               (IArg)handle, (IArg)data);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    if (data == NULL) {
+        status = MessageQCopy_E_FAIL;
+    }
+    else {
+        for (i = 0; i < MAXHELDBUFS; i++) {
+            if ((held[i].vq != NULL) && (held[i].data == (Char *)data)) {
+                break;
+            }
+        }
+
+        if (i < MAXHELDBUFS) {
+            releaseHeld(&held[i]);
+        }
+        else {
+            payload = (Queue_elem *)((Char *)data -
+                                     offsetof(Queue_elem, data));
+            freePayload(payload);
+        }
+    }
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
+    return (status);
+}
+#undef FXNN
+
+/*
+ *  ======== unclaimBuf ========
+ *  Give back a claimed vring buffer unsent.  If buffers claimed since wait
+ *  for it, it is returned as an empty message to no endpoint, which the
+ *  receiver drops.
+ */
+static Void unclaimBuf(VirtQueue_Handle vq, Int16 token, MessageQCopy_Msg msg,
+                       UInt32 srcEndpt)
+{
+    if (!VirtQueue_unclaimAvailBuf(vq, token)) {
+        msg->dataLen = 0;
+        msg->dstAddr = MessageQCopy_ASSIGN_ANY;
+        msg->srcAddr = srcEndpt;
+        msg->flags = 0;
+        msg->reserved = 0;
+        VirtQueue_publishUsedBuf(vq, token, sizeof(MessageQCopy_MsgHeader));
+        VirtQueue_kick(vq);
+    }
+}
+
+/*
+ *  ======== findClaim ========
+ *  The claimed[] element of a buffer from MessageQCopy_allocBuf, given its
+ *  data pointer, NULL if none.
+ */
+static Claim_elem *findClaim(Ptr data)
+{
+    MessageQCopy_Msg msg;
+    UInt             i;
+
+    msg = (MessageQCopy_Msg)((Char *)data - sizeof(MessageQCopy_MsgHeader));
+    for (i = 0; i < MAXCLAIMEDBUFS; i++) {
+        if (claimed[i].msg == msg) {
+            return (&claimed[i]);
+        }
+    }
+
+    return (NULL);
+}
+
+/*
+ *  ======== releaseClaim ========
+ */
+static inline Void releaseClaim(Claim_elem *c)
+{
+    c->msg = NULL;
+    List_put(module.freeClaimed, (List_Elem *)c);
+}
+
+/*
+ *  ======== sendVring ========
+ *  The vring a message from srcEndpt to remote processor dstProc is sent
+ *  on, as claimed from: that of the endpoint's priority class, or, on
+ *  CORE1 once linked, the one to CORE0 (class TOCORE).
+ */
+static VirtQueue_Handle sendVring(UInt16 dstProc, UInt32 srcEndpt,
+                                  UInt *priority)
+{
+    if ((dstProc == transport.coreProcId) && transport.virtQueue_toCore) {
+        /* CORE1 to CORE0, whose buffers we fill as on the host's */
+        *priority = TOCORE;
+        return (transport.virtQueue_toCore);
+    }
+
+    /* Send on the vrings of the source endpoint's priority class */
+    *priority = MessageQCopy_PRIORITY_NORMAL;
+    if (ownVrings(getPriority(srcEndpt))) {
+        *priority = getPriority(srcEndpt);
+    }
+
+    return (transport.virtQueue_toHost[*priority]);
+}
+
+/*
+ *  ======== MessageQCopy_send ========
+ */
+Int MessageQCopy_send(UInt16 dstProc,
+                      UInt32 dstEndpt,
+                      UInt32 srcEndpt,
+                      Ptr    data,
+                      UInt16 len)
+{
+    return (MessageQCopy_sendTimeout(dstProc, dstEndpt, srcEndpt, data, len,
+                                     0));
+}
+
+/*
+ *  ======== MessageQCopy_sendTimeout ========
+ */
+#define FXNN "MessageQCopy_sendTimeout"
+Int MessageQCopy_sendTimeout(UInt16 dstProc,
+                             UInt32 dstEndpt,
+                             UInt32 srcEndpt,
+                             Ptr    data,
+                             UInt16 len,
+                             UInt   timeout)
+{
+    Int               status = MessageQCopy_S_SUCCESS;
+    Int16             token = 0;
+    UInt              priority;
+    VirtQueue_Handle  vq;
+    MessageQCopy_Msg  msg;
+    VirtQueue_Seg     segs[MAXMSGSEGS];
+    Int               numSegs = 1;
+    UInt              size;
+    UInt              chunk;
+    Char              *src;
+    Int               i;
+    int length;
+    IArg key;
+
+    Log_print6(Diags_ENTRY, "--> "FXNN": (dstProc=%d, dstEndpt=%d, "
+               "srcEndpt=%d, data=0x%x, len=%d, timeout=%d", (IArg)dstProc,
+               (IArg)dstEndpt, (IArg)srcEndpt, (IArg)data, (IArg)len,
+               (IArg)timeout);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    if (len > MessageQCopy_MAX_DATA_SIZE) {
+        Log_print1(Diags_STATUS, FXNN": message too large, len: %d",
+                   (IArg)len);
+        return (MessageQCopy_E_FAIL);
+    }
+
+    if ((dstProc == transport.coreProcId) && transport.coreDriver) {
+        /* CORE0 to CORE1, on the vring we drive: */
+        key = GateSwi_enter(module.gateSwi);
+        status = sendCore(dstEndpt, srcEndpt, data, len);
+        GateSwi_leave(module.gateSwi, key);
+        if (status != MessageQCopy_S_SUCCESS) {
+            Log_print0(Diags_STATUS, FXNN": no buffer to core");
+        }
+    }
+    else if (dstProc != MultiProc_self()) {
+        /* Send to remote processor: */
+        vq = sendVring(dstProc, srcEndpt, &priority);
+        if (priority == TOCORE) {
+            /* Only the host's vrings kick senders waiting for buffers */
+            timeout = 0;
+        }
+
+        /* No gate: concurrent senders each claim and fill their own buffer */
+        token = VirtQueue_claimAvailBuf(vq, (Void **)&msg, &length);
+        if ((token < 0) && (timeout != 0)) {
+            token = waitToHost(priority, (Void **)&msg, &length, timeout);
+            if (token < 0) {
+                status = MessageQCopy_E_TIMEOUT;
+            }
+        }
+
+        if ((token >= 0) &&
+            (len + sizeof(MessageQCopy_MsgHeader) > length)) {
+            /* Too large for one buffer: use the rest of its chain, if any */
+            numSegs = VirtQueue_getBufChain(vq, token, segs, MAXMSGSEGS);
+            for (i = 0, size = 0; i < numSegs; i++) {
+                size += segs[i].len;
+            }
+            if (size < len + sizeof(MessageQCopy_MsgHeader)) {
+                unclaimBuf(vq, token, msg, srcEndpt);
+                token = -1;
+            }
+        }
+
+        if (token >= 0) {
+            /* Copy the payload and set message header: */
+            if (numSegs == 1) {
+                memcpy(msg->payload, data, len);
+            }
+            else {
+                /* Scatter over the chain, the header taking up segs[0] */
+                segs[0].buf = msg->payload;
+                segs[0].len -= sizeof(MessageQCopy_MsgHeader);
+                src = (Char *)data;
+                for (i = 0, size = len; size > 0; i++) {
+                    chunk = (segs[i].len < size) ? segs[i].len : size;
+                    memcpy(segs[i].buf, src, chunk);
+                    src += chunk;
+                    size -= chunk;
+                }
+            }
+            length = len + sizeof(MessageQCopy_MsgHeader);
+            msg->dataLen = len;
+            msg->dstAddr = dstEndpt;
+            msg->srcAddr = srcEndpt;
+            msg->flags = 0;
+            msg->reserved = 0;
+
+            VirtQueue_publishUsedBuf(vq, token, length);
+            VirtQueue_kick(vq);
+        }
+        else {
+            if (status != MessageQCopy_E_TIMEOUT) {
+                status = MessageQCopy_E_FAIL;
+            }
+            Log_print0(Diags_STATUS, FXNN": getAvailBuf failed!");
+        }
+    }
+    else {
+        /* Put on a Message queue on this processor: */
+        segs[0].buf = data;
+        segs[0].len = len;
+        status = putLocal(dstEndpt, srcEndpt, segs, 1, len, FALSE);
+    }
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
+    return (status);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_allocBuf ========
+ *  A vring buffer stays claimed until MessageQCopy_sendBuf publishes it
+ *  or MessageQCopy_freeBuf gives it back; meanwhile claimed[] records
+ *  where it came from.
+ */
+#define FXNN "MessageQCopy_allocBuf"
+Int MessageQCopy_allocBuf(UInt16 dstProc, UInt32 srcEndpt, Ptr *data,
+                          UInt16 *maxLen)
+{
+    Int               status = MessageQCopy_S_SUCCESS;
+    Int16             token = -1;
+    UInt              priority;
+    VirtQueue_Handle  vq = NULL;
+    MessageQCopy_Msg  msg = NULL;
+    Queue_elem        *payload;
+    Claim_elem        *c = NULL;
+    int length = 0;
+    IArg key;
+
+    Log_print4(Diags_ENTRY, "--> "FXNN": (dstProc=%d, srcEndpt=%d, "
+               "data=0x%x, maxLen=0x%x)", (IArg)dstProc, (IArg)srcEndpt,
+               (IArg)data, (IArg)maxLen);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    if (dstProc == MultiProc_self()) {
+        /* To this processor: straight onto the destination's queue */
+        payload = allocPayload(MSGBUFFERSIZE);
+        if (payload != NULL) {
+            *data = payload->data;
+            *maxLen = MSGBUFFERSIZE - sizeof(Queue_elem);
+        }
+        else {
+            status = MessageQCopy_E_MEMORY;
+        }
+    }
+    else if ((c = (Claim_elem *)List_get(module.freeClaimed)) != NULL) {
+        if ((dstProc == transport.coreProcId) && transport.coreDriver) {
+            /* CORE0 to CORE1, on the vring we drive: */
+            key = GateSwi_enter(module.gateSwi);
+            msg = getCoreBuf();
+            GateSwi_leave(module.gateSwi, key);
+            length = RP_MSG_BUF_SIZE;
+        }
+        else {
+            vq = sendVring(dstProc, srcEndpt, &priority);
+            token = VirtQueue_claimAvailBuf(vq, (Void **)&msg, &length);
+            if (token < 0) {
+                msg = NULL;
+            }
+        }
     }
 
-    if (status == MessageQCopy_S_SUCCESS)  {
-       /* Now, copy payload to client and free our internal msg */
-       memcpy(data, payload->data, payload->len);
-       *len = payload->len;
-       *rplyEndpt = payload->src;
-
-       HeapBuf_free(module.heap, (Ptr)payload,
-                    (payload->len + sizeof(Queue_elem)));
+    if (dstProc != MultiProc_self()) {
+        if (msg != NULL) {
+            c->vq = vq;
+            c->token = token;
+            c->msg = msg;
+            *data = msg->payload;
+            *maxLen = length - sizeof(MessageQCopy_MsgHeader);
+        }
+        else {
+            if (c != NULL) {
+                List_put(module.freeClaimed, (List_Elem *)c);
+            }
+            status = MessageQCopy_E_FAIL;
+            Log_print0(Diags_STATUS, FXNN": no free buffer");
+        }
     }
 
     Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
@@ -448,92 +1985,125 @@ Int MessageQCopy_recv(MessageQCopy_Handle handle, Ptr data, UInt16 *len,
 #undef FXNN
 
 /*
- *  ======== MessageQCopy_send ========
+ *  ======== MessageQCopy_sendBuf ========
  */
-#define FXNN "MessageQCopy_send"
-Int MessageQCopy_send(UInt16 dstProc,
-                      UInt32 dstEndpt,
-                      UInt32 srcEndpt,
-                      Ptr    data,
-                      UInt16 len)
+#define FXNN "MessageQCopy_sendBuf"
+Int MessageQCopy_sendBuf(UInt16 dstProc,
+                         UInt32 dstEndpt,
+                         UInt32 srcEndpt,
+                         Ptr    data,
+                         UInt16 len)
 {
-    Int               status = MessageQCopy_S_SUCCESS;
-    MessageQCopy_Object   *obj;
-    Int16             token = 0;
-    MessageQCopy_Msg  msg;
-    Queue_elem        *payload;
-    UInt              size;
-    IArg              key;
-    int length;
+    Int                 status = MessageQCopy_S_SUCCESS;
+    MessageQCopy_Object *obj;
+    VirtQueue_Handle    vq;
+    MessageQCopy_Msg    msg;
+    Queue_elem          *payload;
+    Claim_elem          *c;
+    Int16               token;
+    IArg                key;
 
     Log_print5(Diags_ENTRY, "--> "FXNN": (dstProc=%d, dstEndpt=%d, "
-               "srcEndpt=%d, data=0x%x, len=%d", (IArg)dstProc, (IArg)dstEndpt,
-               (IArg)srcEndpt, (IArg)data, (IArg)len);
+               "srcEndpt=%d, data=0x%x, len=%d)", (IArg)dstProc,
+               (IArg)dstEndpt, (IArg)srcEndpt, (IArg)data, (IArg)len);
 
     Assert_isTrue((curInit > 0) , NULL);
 
-    if (dstProc != MultiProc_self()) {
-        /* Send to remote processor: */
-        key = GateSwi_enter(module.gateSwi);  // Protect vring structs.
-        token = VirtQueue_getAvailBuf(transport.virtQueue_toHost,
-                                      (Void **)&msg, &length);
-        GateSwi_leave(module.gateSwi, key);
+    if (dstProc == MultiProc_self()) {
+        payload = (Queue_elem *)((Char *)data - offsetof(Queue_elem, data));
+        payload->len = len;
+        payload->src = srcEndpt;
 
-        if (token >= 0) {
-            /* Copy the payload and set message header: */
-            memcpy(msg->payload, data, len);
-            msg->dataLen = len;
-            msg->dstAddr = dstEndpt;
-            msg->srcAddr = srcEndpt;
-            msg->flags = 0;
-            msg->reserved = 0;
+        /* Put on the endpoint's queue and signal, or leave to the Swi: */
+        key = GateSwi_enter(module.gateSwi);
+        obj = getObject(dstEndpt);
+        if ((obj != NULL) && (obj->callback != NULL)) {
+            deferLocal(payload, dstEndpt);
+        }
+        else if (obj != NULL) {
+            List_put(obj->queue, (List_Elem *)payload);
+            signalEndpt(obj);
+        }
+        GateSwi_leave(module.gateSwi, key);
 
-            key = GateSwi_enter(module.gateSwi);  // Protect vring structs.
-            VirtQueue_addUsedBuf(transport.virtQueue_toHost, token, RP_MSG_BUF_SIZE);
-            VirtQueue_kick(transport.virtQueue_toHost);
+        if (obj == NULL) {
+            freePayload(payload);
+            status = MessageQCopy_E_NOENDPT;
+            Log_print1(Diags_STATUS, FXNN": no object for endpoint: %d",
+                       (IArg)dstEndpt);
+        }
+    }
+    else if ((c = findClaim(data)) != NULL) {
+        msg = c->msg;
+        vq = c->vq;
+        token = c->token;
+        releaseClaim(c);
+
+        msg->dataLen = len;
+        msg->dstAddr = dstEndpt;
+        msg->srcAddr = srcEndpt;
+        msg->flags = 0;
+        msg->reserved = 0;
+
+        if (vq == NULL) {
+            key = GateSwi_enter(module.gateSwi);
+            VirtQueue_addAvailBuf(transport.virtQueue_toCore, msg);
+            VirtQueue_kick(transport.virtQueue_toCore);
             GateSwi_leave(module.gateSwi, key);
         }
         else {
-            status = MessageQCopy_E_FAIL;
-            Log_print0(Diags_STATUS, FXNN": getAvailBuf failed!");
+            VirtQueue_publishUsedBuf(vq, token,
+                                     len + sizeof(MessageQCopy_MsgHeader));
+            VirtQueue_kick(vq);
         }
     }
     else {
-        /* Put on a Message queue on this processor: */
-
-        /* Protect from MessageQCopy_delete */
-        key = GateSwi_enter(module.gateSwi);
-        obj = module.msgqObjects[dstEndpt];
-        GateSwi_leave(module.gateSwi, key);
+        status = MessageQCopy_E_FAIL;
+        Log_print1(Diags_STATUS, FXNN": 0x%x not from allocBuf", (IArg)data);
+    }
 
-        if (obj == NULL) {
-            Log_print1(Diags_STATUS, FXNN": no object for endpoint: %d",
-                   (IArg)dstEndpt);
-            status = MessageQCopy_E_NOENDPT;
-            return status;
-        }
+    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
+    return (status);
+}
+#undef FXNN
 
-        /* Allocate a buffer to copy the payload: */
-        size = len + sizeof(Queue_elem);
+/*
+ *  ======== MessageQCopy_freeBuf ========
+ */
+#define FXNN "MessageQCopy_freeBuf"
+Int MessageQCopy_freeBuf(UInt16 dstProc, UInt32 srcEndpt, Ptr data)
+{
+    Int                 status = MessageQCopy_S_SUCCESS;
+    MessageQCopy_Msg    msg;
+    Queue_elem          *payload;
+    Claim_elem          *c;
+    IArg                key;
 
-        /* HeapBuf_alloc() is non-blocking, so needs protection: */
-        key = GateSwi_enter(module.gateSwi);
-        payload = (Queue_elem *)HeapBuf_alloc(module.heap, size, 0, NULL);
-        GateSwi_leave(module.gateSwi, key);
+    Log_print3(Diags_ENTRY, "--> "FXNN": (dstProc=%d, srcEndpt=%d, "
+               "data=0x%x)", (IArg)dstProc, (IArg)srcEndpt, (IArg)data);
 
-        if (payload != NULL)  {
-            memcpy(payload->data, data, len);
-            payload->len = len;
-            payload->src = srcEndpt;
+    Assert_isTrue((curInit > 0) , NULL);
 
-            /* Put on the endpoint's queue and signal: */
-            List_put(obj->queue, (List_Elem *)payload);
-            Semaphore_post(obj->semHandle);
+    if (dstProc == MultiProc_self()) {
+        payload = (Queue_elem *)((Char *)data - offsetof(Queue_elem, data));
+        freePayload(payload);
+    }
+    else if ((c = findClaim(data)) != NULL) {
+        msg = c->msg;
+        if (c->vq == NULL) {
+            /* CORE0's own buffer: the next to send to CORE1 in */
+            key = GateSwi_enter(module.gateSwi);
+            transport.coreBufsFree[transport.numCoreBufsFree++] = msg;
+            GateSwi_leave(module.gateSwi, key);
         }
         else {
-            status = MessageQCopy_E_MEMORY;
-            Log_print0(Diags_STATUS, FXNN": HeapBuf_alloc failed!");
+            unclaimBuf(c->vq, c->token, msg, srcEndpt);
         }
+        releaseClaim(c);
+    }
+    else {
+        status = MessageQCopy_E_FAIL;
+        Log_print1(Diags_STATUS, FXNN": 0x%x not from allocBuf", (IArg)data);
     }
 
     Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
@@ -553,7 +2123,352 @@ Void MessageQCopy_unblock(MessageQCopy_Handle handle)
 
     /* Set instance to 'unblocked' state, and post */
     obj->unblocked = TRUE;
-    Semaphore_post(obj->semHandle);
+    signalEndpt(obj);
+    Log_print0(Diags_EXIT, "<-- "FXNN);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_createSet ========
+ */
+#define FXNN "MessageQCopy_createSet"
+MessageQCopy_SetHandle MessageQCopy_createSet()
+{
+    MessageQCopy_SetObject *set;
+
+    Log_print0(Diags_ENTRY, "--> "FXNN);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    set = Memory_alloc(NULL, sizeof(MessageQCopy_SetObject), 0, NULL);
+    if (set != NULL) {
+        set->semHandle = Semaphore_create(0, NULL, NULL);
+        set->members = List_create(NULL, NULL);
+        set->ready = List_create(NULL, NULL);
+    }
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": 0x%x", (IArg)set);
+    return (set);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_deleteSet ========
+ */
+#define FXNN "MessageQCopy_deleteSet"
+Int MessageQCopy_deleteSet(MessageQCopy_SetHandle *setPtr)
+{
+    MessageQCopy_SetObject *set;
+    MessageQCopy_Object    *obj;
+    List_Elem              *elem;
+    UInt                   key;
+
+    Log_print1(Diags_ENTRY, "--> "FXNN": (setPtr=0x%x)", (IArg)setPtr);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    if (setPtr && (set = *setPtr)) {
+        /* Let go of the endpoints still in the set */
+        key = Hwi_disable();
+        while ((elem = List_get(set->members)) != NULL) {
+            obj = (MessageQCopy_Object *)((Char *)elem -
+                    offsetof(MessageQCopy_Object, memberElem));
+            obj->set = NULL;
+            obj->onReady = FALSE;
+        }
+        while (List_get(set->ready) != NULL) {
+            /* Their onReady is cleared already */
+        }
+        Hwi_restore(key);
+
+        List_delete(&(set->members));
+        List_delete(&(set->ready));
+        Semaphore_delete(&(set->semHandle));
+        Memory_free(NULL, set, sizeof(MessageQCopy_SetObject));
+
+        *setPtr = NULL;
+    }
+
+    Log_print0(Diags_EXIT, "<-- "FXNN);
+    return (MessageQCopy_S_SUCCESS);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_addToSet ========
+ */
+#define FXNN "MessageQCopy_addToSet"
+Int MessageQCopy_addToSet(MessageQCopy_SetHandle set,
+                          MessageQCopy_Handle handle)
+{
+    Int                 status = MessageQCopy_S_SUCCESS;
+    MessageQCopy_Object *obj = (MessageQCopy_Object *)handle;
+    UInt                key;
+
+    Log_print2(Diags_ENTRY, "--> "FXNN": (set=0x%x, handle=0x%x)",
+               (IArg)set, (IArg)handle);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    key = Hwi_disable();
+    if (obj->set != NULL) {
+        status = MessageQCopy_E_FAIL;
+    }
+    else {
+        obj->set = set;
+        List_put(set->members, &obj->memberElem);
+
+        /* Messages may be waiting already */
+        if (Semaphore_getCount(obj->semHandle) > 0) {
+            obj->onReady = TRUE;
+            List_put(set->ready, &obj->readyElem);
+            Semaphore_post(set->semHandle);
+        }
+    }
+    Hwi_restore(key);
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
+    return (status);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_removeFromSet ========
+ */
+#define FXNN "MessageQCopy_removeFromSet"
+Int MessageQCopy_removeFromSet(MessageQCopy_SetHandle set,
+                               MessageQCopy_Handle handle)
+{
+    Int                 status = MessageQCopy_S_SUCCESS;
+    MessageQCopy_Object *obj = (MessageQCopy_Object *)handle;
+    UInt                key;
+
+    Log_print2(Diags_ENTRY, "--> "FXNN": (set=0x%x, handle=0x%x)",
+               (IArg)set, (IArg)handle);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    key = Hwi_disable();
+    if (obj->set != set) {
+        status = MessageQCopy_E_FAIL;
+    }
+    else {
+        if (obj->onReady) {
+            List_remove(set->ready, &obj->readyElem);
+            obj->onReady = FALSE;
+        }
+        List_remove(set->members, &obj->memberElem);
+        obj->set = NULL;
+    }
+    Hwi_restore(key);
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
+    return (status);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_waitSet ========
+ *  Level triggered: an endpoint is returned as long as its queue has
+ *  messages, whether or not they were there at the previous call.
+ */
+#define FXNN "MessageQCopy_waitSet"
+Int MessageQCopy_waitSet(MessageQCopy_SetHandle set,
+                         MessageQCopy_Handle handles[], UInt max,
+                         UInt *count, UInt timeout)
+{
+    Int                 status = MessageQCopy_S_SUCCESS;
+    MessageQCopy_Object *obj;
+    List_Elem           *elem;
+    UInt32              start = Clock_getTicks();
+    UInt32              elapsed;
+    UInt                wait = timeout;
+    UInt                n = 0;
+    UInt                i;
+    UInt                key;
+
+    Log_print5(Diags_ENTRY, "--> "FXNN": (set=0x%x, handles=0x%x, max=%d,"
+               "count=0x%x, timeout=%d)", (IArg)set, (IArg)handles,
+               (IArg)max, (IArg)count, (IArg)timeout);
+
+    Assert_isTrue((curInit > 0) , NULL);
+    Assert_isTrue((max > 0) , NULL);
+
+    /* Check vring for pending messages before we block: */
+    Swi_post(transport.swiHandle);
+
+    for (;;) {
+        /* Take the ready endpoints that do have messages */
+        while ((n < max) && ((elem = List_get(set->ready)) != NULL)) {
+            obj = (MessageQCopy_Object *)((Char *)elem -
+                    offsetof(MessageQCopy_Object, readyElem));
+
+            /* A message from now on puts it back */
+            key = Hwi_disable();
+            obj->onReady = FALSE;
+            Hwi_restore(key);
+
+            if ((Semaphore_getCount(obj->semHandle) > 0) || obj->unblocked) {
+                handles[n++] = obj;
+            }
+        }
+
+        if (n > 0) {
+            break;
+        }
+
+        if (timeout != MessageQCopy_FOREVER) {
+            elapsed = Clock_getTicks() - start;
+            if (elapsed >= timeout) {
+                status = MessageQCopy_E_TIMEOUT;
+                break;
+            }
+            wait = timeout - elapsed;
+        }
+
+        if (!Semaphore_pend(set->semHandle, wait)) {
+            status = MessageQCopy_E_TIMEOUT;
+            break;
+        }
+    }
+
+    /*
+     * Those returned stay ready while messages are left on their queues:
+     * put them back for the next call, unless a message did already.  The
+     * next call looks at the list before it waits, so no post is needed.
+     */
+    key = Hwi_disable();
+    for (i = 0; i < n; i++) {
+        obj = handles[i];
+        if ((obj->set == set) && !obj->onReady &&
+            ((Semaphore_getCount(obj->semHandle) > 0) || obj->unblocked)) {
+            obj->onReady = TRUE;
+            List_put(set->ready, &obj->readyElem);
+        }
+    }
+    Hwi_restore(key);
+
+    *count = n;
+
+    Log_print2(Diags_EXIT, "<-- "FXNN": %d, count=%d", (IArg)status,
+               (IArg)n);
+    return (status);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_setPollBudget ========
+ */
+#define FXNN "MessageQCopy_setPollBudget"
+Void MessageQCopy_setPollBudget(UInt spins)
+{
+    UInt i;
+
+    Log_print1(Diags_ENTRY, "--> "FXNN": (spins=%d)", (IArg)spins);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    for (i = 0; i < MessageQCopy_NUM_PRIORITIES; i++) {
+        if (ownVrings(i)) {
+            VirtQueue_setPollBudget(transport.virtQueue_fromHost[i], spins);
+        }
+    }
+
+    Log_print0(Diags_EXIT, "<-- "FXNN);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_setSwiBudget ========
+ */
+#define FXNN "MessageQCopy_setSwiBudget"
+Int MessageQCopy_setSwiBudget(UInt maxMsgs, UInt maxUsecs)
+{
+    Types_FreqHz freq;
+    UInt64 counts = 0;
+    IArg key;
+
+    Log_print2(Diags_ENTRY, "--> "FXNN": (maxMsgs=%d, maxUsecs=%d)",
+               (IArg)maxMsgs, (IArg)maxUsecs);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    if (maxUsecs != 0) {
+        Timestamp_getFreq(&freq);
+        counts = ((((UInt64)freq.hi << 32) | freq.lo) * maxUsecs) / 1000000;
+
+        /* The Swi compares 32 bit Timestamp differences against it */
+        if ((counts == 0) || (counts > (Bits32)~0)) {
+            Log_print1(Diags_STATUS, FXNN": %d usecs out of range",
+                       (IArg)maxUsecs);
+            return (MessageQCopy_E_FAIL);
+        }
+    }
+
+    key = GateSwi_enter(module.gateSwi);
+    transport.swiMaxMsgs = maxMsgs;
+    transport.swiMaxCounts = (Bits32)counts;
+    GateSwi_leave(module.gateSwi, key);
+
+    Log_print0(Diags_EXIT, "<-- "FXNN);
+
+    return (MessageQCopy_S_SUCCESS);
+}
+#undef FXNN
+
+/*
+ *  ======== MessageQCopy_dumpStats ========
+ */
+#define FXNN "MessageQCopy_dumpStats"
+Void MessageQCopy_dumpStats()
+{
+    UInt i;
+
+    Log_print0(Diags_ENTRY, "--> "FXNN);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    for (i = 0; i < MessageQCopy_NUM_PRIORITIES; i++) {
+        if (ownVrings(i)) {
+            VirtQueue_dumpStats(transport.virtQueue_toHost[i]);
+            VirtQueue_dumpStats(transport.virtQueue_fromHost[i]);
+        }
+    }
+    if (transport.virtQueue_fromCore) {
+        VirtQueue_dumpStats(transport.virtQueue_toCore);
+        VirtQueue_dumpStats(transport.virtQueue_fromCore);
+    }
+
     Log_print0(Diags_EXIT, "<-- "FXNN);
 }
 #undef FXNN
+
+/*
+ *  ======== MessageQCopy_setPriority ========
+ */
+#define FXNN "MessageQCopy_setPriority"
+Int MessageQCopy_setPriority(MessageQCopy_Handle handle, UInt priority)
+{
+    Int                 status = MessageQCopy_S_SUCCESS;
+    MessageQCopy_Object *obj = (MessageQCopy_Object *)handle;
+    IArg                key;
+
+    Log_print2(Diags_ENTRY, "--> "FXNN": (handle=0x%x, priority=%d)",
+               (IArg)handle, (IArg)priority);
+
+    Assert_isTrue((curInit > 0) , NULL);
+
+    if (priority < MessageQCopy_NUM_PRIORITIES) {
+        key = GateSwi_enter(module.gateSwi);
+        module.chunks[obj->queueId / ENDPTSPERCHUNK]->priorities[
+                obj->queueId % ENDPTSPERCHUNK] = priority;
+        GateSwi_leave(module.gateSwi, key);
+    }
+    else {
+        status = MessageQCopy_E_FAIL;
+    }
+
+    Log_print1(Diags_EXIT, "<-- "FXNN": %d", (IArg)status);
+    return (status);
+}
+#undef FXNN
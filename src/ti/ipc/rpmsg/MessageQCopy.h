@@ -61,7 +61,6 @@
  *  Questions:
  *  - Workout how connections exist: how does Ducati side cleanup when Linux
  *    side goes down?
- *  - Client needs to know max size of data buffer to allocate for receive.
  *  - Do we need procID's buried in the message header addresses anymore, or
  *    isn't that now implicit in the vrings/transport.
  *  - Do we want MessageQ_Unblock in this version?  (Normally used in RCM).
@@ -136,11 +135,78 @@ extern "C" {
  *  @brief  Maximum Value for System Reserved Endpoints.
  */
 #define MessageQCopy_ASSIGN_ANY             0xFFFFFFFF
+
+/*!
+ *  @def    MessageQCopy_MAX_DATA_SIZE
+ *  @brief  Maximum amount of data in a message.
+ *
+ *  Data that does not fit in a single vring buffer (whose size the host
+ *  chooses, less the message header) travels in chained or indirect
+ *  vring buffers.
+ */
+#define MessageQCopy_MAX_DATA_SIZE          4080
+
+/*!
+ *  @def    MessageQCopy_PRIORITY_NORMAL
+ *  @brief  Priority class of the rpmsg vdev's vrings: that of every
+ *          endpoint, unless set otherwise.
+ */
+#define MessageQCopy_PRIORITY_NORMAL        0
+
+/*!
+ *  @def    MessageQCopy_PRIORITY_HIGH
+ *  @brief  Priority class for control messages, which must not wait
+ *          behind bulk traffic.
+ */
+#define MessageQCopy_PRIORITY_HIGH          1
+
+/*!
+ *  @def    MessageQCopy_PRIORITY_BULK
+ *  @brief  Priority class for streaming data.
+ */
+#define MessageQCopy_PRIORITY_BULK          2
+
+/*!
+ *  @def    MessageQCopy_NUM_PRIORITIES
+ *  @brief  Number of priority classes.
+ *
+ *  Each class has its own pair of vrings if the resource table declares
+ *  that many rpmsg vdevs: the first is the normal class, the second the
+ *  high, the third the bulk class.  A class without its own vdev shares
+ *  the normal class' vrings.
+ *
+ *  To Linux, each of those vdevs is an rpmsg bus of its own, with its own
+ *  endpoint addresses, and a host driver only sees the bus its channel
+ *  was announced on.  As an endpoint sends everything, its name service
+ *  announcement (NameMap_register()) and its replies included, on its
+ *  class' vrings, set its class before announcing it: the host then
+ *  talks to it on that bus only, which is where its replies go.
+ */
+#define MessageQCopy_NUM_PRIORITIES         3
+
 /*!
  *  @brief  MessageQCopy_Handle type
  */
 typedef struct MessageQCopy_Object *MessageQCopy_Handle;
 
+/*!
+ *  @brief  MessageQCopy_SetHandle type
+ */
+typedef struct MessageQCopy_SetObject *MessageQCopy_SetHandle;
+
+/*!
+ *  @brief  Function an endpoint created with MessageQCopy_createWithCallback()
+ *          is passed its messages to, instead of queuing them
+ *
+ *  @param[in]  handle      The endpoint's MessageQCopy handle.
+ *  @param[in]  arg         Argument given at creation.
+ *  @param[in]  data        Message data, valid only during the call.
+ *  @param[in]  len         Amount of data.
+ *  @param[in]  srcEndpt    Endpoint of source (for replies).
+ */
+typedef Void (*MessageQCopy_Callback)(MessageQCopy_Handle handle, UArg arg,
+                                      Ptr data, UInt16 len, UInt32 srcEndpt);
+
 /* =============================================================================
  *  MessageQCopy Functions:
  * =============================================================================
@@ -152,6 +218,10 @@ typedef struct MessageQCopy_Object *MessageQCopy_Handle;
  *
  *  Note: Multiple clients must serialize calls to this function.
  *
+ *  On the M3 cores, this also links them over their own vrings.  CORE1
+ *  polls until CORE0's MessageQCopy_init() has laid those out, so both
+ *  cores should call it early, e.g. from main() as the examples do.
+ *
  *  @param[in]  remoteProcId      MultiProc ID of the peer.
  */
 Void MessageQCopy_init(UInt16 remoteProcId);
@@ -177,12 +247,46 @@ Void MessageQCopy_finalize();
  *  @param[out]  endpoint     Endpoint ID for this side of the connection.
  *
  *
+ *  Endpoints from MessageQCopy_ASSIGN_ANY are those free the longest;
+ *  the table of them grows as needed, up to 16384 endpoints.
+ *
  *  @return     MessageQ Handle, or NULL if:
  *                            - reserved endpoint already taken;
+ *                            - no endpoint left;
  *                            - could not allocate object
  */
 MessageQCopy_Handle MessageQCopy_create(UInt32 reserved, UInt32 * endpoint);
 
+/*!
+ *  @brief      Create an endpoint whose messages are passed to a function
+ *
+ *  As MessageQCopy_create(), but rather than being queued for
+ *  MessageQCopy_recv(), each message is passed to fxn as it is received:
+ *  straight from the vring buffer, with no copy, by the Swi processing the
+ *  vrings from the host.  Messages from this processor, and messages
+ *  spread over chained vring buffers, are copied whole and passed by that
+ *  Swi too.  So fxn always runs in that Swi, one call at a time, and need
+ *  not be reentrant.
+ *
+ *  fxn delays all the other endpoints' messages, so must be short and
+ *  must not block; it may send (but not wait for a buffer to).  It suits
+ *  endpoints that only reply or record, such as ping responders, without
+ *  a Task of their own.
+ *
+ *  @param[in]   reserved     As for MessageQCopy_create().
+ *  @param[out]  endpoint     Endpoint ID for this side of the connection.
+ *  @param[in]   fxn          Function called with each message.
+ *  @param[in]   arg          Passed to fxn.
+ *
+ *  @return     MessageQ Handle, or NULL as for MessageQCopy_create().
+ *
+ *  @sa         MessageQCopy_Callback
+ */
+MessageQCopy_Handle MessageQCopy_createWithCallback(UInt32 reserved,
+                                                    UInt32 * endpoint,
+                                                    MessageQCopy_Callback fxn,
+                                                    UArg arg);
+
 /*!
  *  @brief      Receives a message from a message queue
  *
@@ -201,7 +305,9 @@ MessageQCopy_Handle MessageQCopy_create(UInt32 reserved, UInt32 * endpoint);
  *  status is returned.
  *
  *  @param[in]  handle      MessageQ handle
- *  @param[out] data        Pointer to the client's data buffer.
+ *  @param[out] data        Pointer to the client's data buffer, large
+ *                          enough for any message it may receive (at most
+ *                          #MessageQCopy_MAX_DATA_SIZE bytes).
  *  @param[out] len         Amount of data received.
  *  @param[out] rplyEndpt   Endpoint of source (for replies).
  *  @param[in]  timeout     Maximum duration to wait for a message in
@@ -218,6 +324,87 @@ MessageQCopy_Handle MessageQCopy_create(UInt32 reserved, UInt32 * endpoint);
 Int MessageQCopy_recv(MessageQCopy_Handle handle, Ptr data, UInt16 *len,
                       UInt32 *rplyEndpt, UInt timeout);
 
+/*!
+ *  @brief      Receives a message from a message queue without copying it
+ *
+ *  As MessageQCopy_recv(), but returns a pointer to the message data
+ *  rather than copying it.  Once an endpoint has called this function,
+ *  further messages for it from the host stay in the host's vring
+ *  buffer, which goes back to the host only when the caller hands it to
+ *  MessageQCopy_releaseBuf().  The vring is as many buffers short
+ *  meanwhile, so release them promptly.  Messages that could not be held
+ *  (up to 64 are, across all endpoints), those from this processor and
+ *  those spread over chained buffers are copied as usual, and also
+ *  released with MessageQCopy_releaseBuf().
+ *
+ *  MessageQCopy_recv() still works on the endpoint, and releases the
+ *  buffer itself.
+ *
+ *  @param[in]  handle      MessageQ handle
+ *  @param[out] data        Pointer to the message data.
+ *  @param[out] len         Amount of data received.
+ *  @param[out] rplyEndpt   Endpoint of source (for replies).
+ *  @param[in]  timeout     Maximum duration to wait for a message in
+ *                          microseconds.
+ *
+ *  @return     MessageQ status, as MessageQCopy_recv().
+ *
+ *  @sa         MessageQCopy_releaseBuf MessageQCopy_recv
+ */
+Int MessageQCopy_recvBuf(MessageQCopy_Handle handle, Ptr *data, UInt16 *len,
+                         UInt32 *rplyEndpt, UInt timeout);
+
+/*!
+ *  @brief      A message returned by MessageQCopy_recvMany()
+ */
+typedef struct MessageQCopy_RecvMsg {
+    Ptr     data;       /*!< Message data, to MessageQCopy_releaseBuf() */
+    UInt16  len;        /*!< Amount of data received */
+    UInt32  rplyEndpt;  /*!< Endpoint of source (for replies) */
+} MessageQCopy_RecvMsg;
+
+/*!
+ *  @brief      Receives up to max messages from a message queue at once
+ *
+ *  As MessageQCopy_recvBuf(), waiting for a first message, but then also
+ *  returns any more already queued, up to max, so a busy endpoint's Task
+ *  wakes up once per batch rather than per message.  Each message must
+ *  be released with MessageQCopy_releaseBuf().
+ *
+ *  @param[in]  handle      MessageQ handle
+ *  @param[out] msgs        Array of at least max messages received.
+ *  @param[in]  max         Most messages to return, at least 1.
+ *  @param[out] count       Number of messages returned in msgs, 0 unless
+ *                          the status is #MessageQCopy_S_SUCCESS.
+ *  @param[in]  timeout     Maximum duration to wait for the first message,
+ *                          as for MessageQCopy_recv().
+ *
+ *  @return     MessageQ status, as MessageQCopy_recv().
+ *
+ *  @sa         MessageQCopy_recvBuf MessageQCopy_releaseBuf
+ */
+Int MessageQCopy_recvMany(MessageQCopy_Handle handle,
+                          MessageQCopy_RecvMsg msgs[], UInt max,
+                          UInt *count, UInt timeout);
+
+/*!
+ *  @brief      Release a message returned by MessageQCopy_recvBuf() or
+ *              MessageQCopy_recvMany()
+ *
+ *  Gives its vring buffer back to the host, or frees its copy.  Messages
+ *  still held when the endpoint is deleted must be released first.
+ *
+ *  @param[in]  handle      MessageQ handle the message was received on.
+ *  @param[in]  data        Message data, as returned by
+ *                          MessageQCopy_recvBuf().
+ *
+ *  @return     MessageQCopy_S_SUCCESS, or MessageQCopy_E_FAIL if data is
+ *              NULL.
+ *
+ *  @sa         MessageQCopy_recvBuf
+ */
+Int MessageQCopy_releaseBuf(MessageQCopy_Handle handle, Ptr data);
+
 /*!
  *  @brief      Sends data to a remote processor, or copies onto a local
  *              messageQ.
@@ -231,6 +418,15 @@ Int MessageQCopy_recv(MessageQCopy_Handle handle, Ptr data, UInt16 *len,
  *  @param[in]  data        Data payload to be copied and sent.
  *  @param[in]  len         Amount of data to be copied, including Msg header.
  *
+ *  Up to #MessageQCopy_MAX_DATA_SIZE bytes may be sent.  Messages for a
+ *  remote processor that are larger than a vring buffer need the host to
+ *  have made a chained (or indirect) buffer available.
+ *
+ *  Messages between the two M3 cores go over a vring pair of their own,
+ *  without the host, which MessageQCopy_init() sets up; those are limited
+ *  to one vring buffer.  If CORE0 did not answer CORE1 then, they go
+ *  through the host, as to any other processor.
+ *
  *  @return     Status of the call.
  *              - #MessageQCopy_S_SUCCESS denotes success.
  *              - #MessageQCopy_E_FAIL denotes failure.
@@ -242,6 +438,124 @@ Int MessageQCopy_send(UInt16 dstProc,
                       Ptr    data,
                       UInt16 len);
 
+/*!
+ *  @brief      Reserve a buffer to build a message to send in place
+ *
+ *  Returns a pointer to the payload area of a buffer for a message from
+ *  srcEndpt to dstProc: one from the vring to it, or for this processor,
+ *  one to be put on the destination queue.  Write up to maxLen bytes of
+ *  data there, then pass it to MessageQCopy_sendBuf(), with the same
+ *  dstProc and srcEndpt, or give it back unsent with
+ *  MessageQCopy_freeBuf(): the vring cannot reuse it before.
+ *
+ *  Unlike MessageQCopy_sendTimeout(), this does not wait for the host
+ *  to return a buffer, and only ever reserves one, so maxLen is at most
+ *  that of one vring buffer, less the message header.
+ *
+ *  @param[in]  dstProc     Destination ProcId.
+ *  @param[in]  srcEndpt    Source Endpoint, which picks the vring as for
+ *                          MessageQCopy_send().
+ *  @param[out] data        Where to write the message data.
+ *  @param[out] maxLen      Most data that fits.
+ *
+ *  @return     Status of the call.
+ *              - #MessageQCopy_S_SUCCESS denotes success.
+ *              - #MessageQCopy_E_MEMORY: no buffer for a local message.
+ *              - #MessageQCopy_E_FAIL: no vring buffer free.
+ *
+ *  @sa         MessageQCopy_sendBuf, MessageQCopy_freeBuf
+ */
+Int MessageQCopy_allocBuf(UInt16 dstProc, UInt32 srcEndpt, Ptr *data,
+                          UInt16 *maxLen);
+
+/*!
+ *  @brief      Send a message built in a buffer from MessageQCopy_allocBuf()
+ *
+ *  Fills in the message header and hands the buffer on, without copying
+ *  the data.
+ *
+ *  @param[in]  dstProc     Destination ProcId, as given to
+ *                          MessageQCopy_allocBuf().
+ *  @param[in]  dstEndpt    Destination Endpoint.
+ *  @param[in]  srcEndpt    Source Endpoint, as given to
+ *                          MessageQCopy_allocBuf().
+ *  @param[in]  data        Data pointer returned by MessageQCopy_allocBuf().
+ *  @param[in]  len         Amount of data written, at most its maxLen.
+ *
+ *  @return     Status of the call.
+ *              - #MessageQCopy_S_SUCCESS denotes success.
+ *              - #MessageQCopy_E_NOENDPT: no such local endpoint; the
+ *                buffer is freed.
+ *              - #MessageQCopy_E_FAIL: data is not from
+ *                MessageQCopy_allocBuf().
+ *
+ *  @sa         MessageQCopy_allocBuf
+ */
+Int MessageQCopy_sendBuf(UInt16 dstProc,
+                         UInt32 dstEndpt,
+                         UInt32 srcEndpt,
+                         Ptr    data,
+                         UInt16 len);
+
+/*!
+ *  @brief      Give back a buffer from MessageQCopy_allocBuf() unsent
+ *
+ *  E.g. when the message turned out not to be needed, or too large.  A
+ *  vring buffer becomes available again; one claimed before others that
+ *  are still outstanding is returned to the receiver as an empty message,
+ *  which it drops.
+ *
+ *  @param[in]  dstProc     Destination ProcId, as given to
+ *                          MessageQCopy_allocBuf().
+ *  @param[in]  srcEndpt    Source Endpoint, as given to
+ *                          MessageQCopy_allocBuf().
+ *  @param[in]  data        Data pointer returned by MessageQCopy_allocBuf().
+ *
+ *  @return     Status of the call.
+ *              - #MessageQCopy_S_SUCCESS denotes success.
+ *              - #MessageQCopy_E_FAIL: data is not from
+ *                MessageQCopy_allocBuf().
+ *
+ *  @sa         MessageQCopy_allocBuf
+ */
+Int MessageQCopy_freeBuf(UInt16 dstProc, UInt32 srcEndpt, Ptr data);
+
+/*!
+ *  @brief      Sends data as MessageQCopy_send(), waiting for a free buffer
+ *              if the host has not returned any.
+ *
+ *  Rather than failing at once when every buffer of the vring to the
+ *  remote processor is in use, the caller blocks until the host returns
+ *  one or the timeout expires.  Waiting senders are woken by the host's
+ *  kick, so they take no CPU while the host is stalled.  Must be called
+ *  from a Task when the timeout is not zero.  Sends to the other M3 core
+ *  do not wait.
+ *
+ *  @param[in]  dstProc     Destination ProcId.
+ *  @param[in]  dstEndpt    Destination Endpoint.
+ *  @param[in]  srcEndpt    Source Endpoint.
+ *  @param[in]  data        Data payload to be copied and sent.
+ *  @param[in]  len         Amount of data to be copied.
+ *  @param[in]  timeout     Maximum duration to wait for a buffer, in the
+ *                          same units as for MessageQCopy_recv();
+ *                          #MessageQCopy_FOREVER to wait indefinitely, 0
+ *                          not to wait, as MessageQCopy_send().
+ *
+ *  @return     Status of the call.
+ *              - #MessageQCopy_S_SUCCESS denotes success.
+ *              - #MessageQCopy_E_TIMEOUT: no buffer was returned in time.
+ *              - #MessageQCopy_E_FAIL denotes failure.
+ *                The send was not successful.
+ *
+ *  @sa         MessageQCopy_send
+ */
+Int MessageQCopy_sendTimeout(UInt16 dstProc,
+                             UInt32 dstEndpt,
+                             UInt32 srcEndpt,
+                             Ptr    data,
+                             UInt16 len,
+                             UInt   timeout);
+
 /*!
  *  @brief      Delete a created MessageQ instance.
  *
@@ -275,6 +589,158 @@ Int MessageQCopy_delete(MessageQCopy_Handle *handlePtr);
  */
 Void MessageQCopy_unblock(MessageQCopy_Handle handle);
 
+/*!
+ *  @brief      Poll for messages from the host before blocking in recv
+ *
+ *  For request/response traffic, where the next message tends to follow
+ *  soon: MessageQCopy_recv spins on the vring for a while before waiting
+ *  for the host's interrupt, if there is no message for it yet.  Polling
+ *  backs off by itself while messages come too far apart.
+ *
+ *  @param[in]  spins       Vring checks per MessageQCopy_recv; 0 (the
+ *                          default) disables polling.
+ *
+ *  @sa         MessageQCopy_recv, VirtQueue_poll
+ */
+Void MessageQCopy_setPollBudget(UInt spins);
+
+/*!
+ *  @brief      Bound the work of each run of the receive Swi
+ *
+ *  The Swi that passes messages from the host on to their endpoints runs
+ *  ahead of every Task.  To bound how long a burst from the host can hold
+ *  them off, it stops after @c maxMsgs messages or @c maxUsecs
+ *  microseconds, whichever comes first.  It returns the buffers it
+ *  processed to the host as usual, and carries on at the next Clock tick,
+ *  so Tasks run in between.
+ *
+ *  The time is checked between batches of up to 16 messages, so a run
+ *  may overshoot by the time that batch takes.
+ *
+ *  @param[in]  maxMsgs     Messages per run; 0 (the default) for no limit.
+ *  @param[in]  maxUsecs    Microseconds per run; 0 (the default) for no
+ *                          limit.
+ *
+ *  @return     Status of the call.
+ *              - #MessageQCopy_S_SUCCESS denotes success.
+ *              - #MessageQCopy_E_FAIL if @c maxUsecs is less than one
+ *                Timestamp count, or more than 32 bits of them; the
+ *                budget is left as it was.
+ *
+ *  @sa         MessageQCopy_setPollBudget
+ */
+Int MessageQCopy_setSwiBudget(UInt maxMsgs, UInt maxUsecs);
+
+/*!
+ *  @brief      Bind an endpoint to a priority class
+ *
+ *  Messages sent from the endpoint go to the host on the vrings of that
+ *  class, and MessageQCopy_recv polls those (see
+ *  MessageQCopy_setPollBudget).  Incoming messages are processed by class,
+ *  highest first, whatever their destination.
+ *
+ *  Call this before announcing the endpoint to the host: each class with
+ *  vrings of its own is a separate rpmsg bus (see
+ *  #MessageQCopy_NUM_PRIORITIES).
+ *
+ *  @param[in]  handle      MessageQCopy handle.
+ *  @param[in]  priority    MessageQCopy_PRIORITY_NORMAL, _HIGH or _BULK.
+ *
+ *  @return     MessageQCopy_S_SUCCESS, or MessageQCopy_E_FAIL if the
+ *              priority is out of range.
+ *
+ *  @sa         MessageQCopy_NUM_PRIORITIES
+ */
+Int MessageQCopy_setPriority(MessageQCopy_Handle handle, UInt priority);
+
+/*!
+ *  @brief      Create a set of endpoints to wait on together
+ *
+ *  One Task can serve many endpoints by waiting on a set of them with
+ *  MessageQCopy_waitSet(), rather than each endpoint needing a Task of
+ *  its own blocked in MessageQCopy_recv().
+ *
+ *  @return     Set handle, or NULL if it could not be allocated.
+ *
+ *  @sa         MessageQCopy_addToSet MessageQCopy_waitSet
+ */
+MessageQCopy_SetHandle MessageQCopy_createSet();
+
+/*!
+ *  @brief      Delete a set
+ *
+ *  The endpoints still in it are removed, not deleted.
+ *
+ *  @param[in,out]  setPtr  Pointer to the set handle, set to NULL.
+ *
+ *  @return     MessageQCopy_S_SUCCESS.
+ */
+Int MessageQCopy_deleteSet(MessageQCopy_SetHandle *setPtr);
+
+/*!
+ *  @brief      Add an endpoint to a set
+ *
+ *  An endpoint can be in one set at a time.  Deleting it removes it from
+ *  its set.
+ *
+ *  @param[in]  set         Set handle.
+ *  @param[in]  handle      MessageQCopy handle.
+ *
+ *  @return     MessageQCopy_S_SUCCESS, or MessageQCopy_E_FAIL if the
+ *              endpoint is in a set already.
+ */
+Int MessageQCopy_addToSet(MessageQCopy_SetHandle set,
+                          MessageQCopy_Handle handle);
+
+/*!
+ *  @brief      Remove an endpoint from a set
+ *
+ *  @param[in]  set         Set handle.
+ *  @param[in]  handle      MessageQCopy handle.
+ *
+ *  @return     MessageQCopy_S_SUCCESS, or MessageQCopy_E_FAIL if the
+ *              endpoint is not in that set.
+ */
+Int MessageQCopy_removeFromSet(MessageQCopy_SetHandle set,
+                               MessageQCopy_Handle handle);
+
+/*!
+ *  @brief      Wait until endpoints of a set have messages
+ *
+ *  Returns the endpoints of the set with messages queued (or unblocked
+ *  with MessageQCopy_unblock()), waiting for one if there are none.  An
+ *  endpoint is returned again by each call until its queue is empty, so
+ *  the caller need not receive all of its messages at once: receive them
+ *  with a timeout of 0, or with MessageQCopy_recvMany().
+ *
+ *  Only one Task should wait on a set at a time.
+ *
+ *  @param[in]  set         Set handle.
+ *  @param[out] handles     Array of at least max ready endpoints.
+ *  @param[in]  max         Most endpoints to return, at least 1.
+ *  @param[out] count       Number of endpoints returned in handles.
+ *  @param[in]  timeout     Maximum duration to wait, as for
+ *                          MessageQCopy_recv().
+ *
+ *  @return     MessageQCopy_S_SUCCESS, or MessageQCopy_E_TIMEOUT if no
+ *              endpoint got ready in time.
+ *
+ *  @sa         MessageQCopy_createSet MessageQCopy_recvMany
+ */
+Int MessageQCopy_waitSet(MessageQCopy_SetHandle set,
+                         MessageQCopy_Handle handles[], UInt max,
+                         UInt *count, UInt timeout);
+
+/*!
+ *  @brief      Print the counters of the transport's vrings
+ *
+ *  Shows, among others, how full the host kept the vrings, to tell whether
+ *  they are sized right.
+ *
+ *  @sa         VirtQueue_dumpStats
+ */
+Void MessageQCopy_dumpStats();
+
 #if defined (__cplusplus)
 }
 #endif /* defined (__cplusplus) */
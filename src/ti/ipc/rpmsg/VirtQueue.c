@@ -44,6 +44,15 @@
  *  - The notify function is implicit in the implementation, and not provided
  *    by the client, as it is in Linux virtio.
  *
+ *  Built with VIRTIO_RING_PACKED defined, the vrings use the virtio 1.1
+ *  packed layout (one descriptor array) instead of the split one.  The host
+ *  must be built to match: VIRTIO_F_RING_PACKED is feature bit 34, beyond
+ *  the 32 bit feature words of the resource table.
+ *
+ *  Built with VIRTQUEUE_CACHED_IPC defined, for IPC memory mapped
+ *  cacheable, each operation writes back or invalidates just the vring
+ *  entries and buffers it touches.
+ *
  *  All VirtQueue operations can be called in any context.
  *
  *  The virtio header should be included in an application as follows:
@@ -71,13 +80,38 @@
 #include <ti/pm/IpcPower.h>
 
 #include <ti/ipc/MultiProc.h>
+#include <ti/resources/rsc_types.h>
 
 #include <string.h>
 
 #include "virtio_ring.h"
 
-/* Used for defining the size of the virtqueue registry */
-#define NUM_QUEUES                      5
+/*
+ * Used for defining the size of the virtqueue registry.  The most any core
+ * registers is SysM3's: a pair for each of MessageQCopy's three rpmsg
+ * vdevs (RPMSG_PRIORITY_VDEVS), the console pair (rpmsgcio.c) and the pair
+ * to AppM3.
+ */
+#define MIN_QUEUES                      (2 * 3 + 2 + 2)
+
+#ifndef NUM_QUEUES
+#define NUM_QUEUES                      MIN_QUEUES
+#endif
+
+#if NUM_QUEUES < MIN_QUEUES
+#error NUM_QUEUES is too small for the vrings SysM3 registers
+#endif
+
+/* Largest notify id (mailbox payload) a VirtQueue can have */
+#define MAX_NOTIFY_ID                   255
+
+/* Largest number of carveout and devmem entries used for translation */
+#ifndef MAX_XLATE
+#define MAX_XLATE                       16
+#endif
+
+/* The host sets aside whole pages of this size for each vring */
+#define VRING_PAGE_SIZE                 4096
 
 /* Predefined device addresses */
 #define IPU_MEM_VRING0          0xA0000000
@@ -90,13 +124,36 @@
 #define IPU_MEM_VRING3          0xA0014000
 
 /*
- * Sizes of the virtqueues (expressed in number of buffers supported,
- * and must be power of two)
+ * CORE0 <-> CORE1 vrings, which the host never sees: CORE0 lays them out
+ * and drives both.  They are in CORE_LINK, the IPU_MEM_CORELINK devmem
+ * entry of the resource table (rsc_table.h), which keeps the host off that
+ * memory.  Each has a VirtQueue_CoreSync at CORE_VRING_SYNC, by which
+ * CORE1 makes sure the vring it attaches to was laid out by this boot's
+ * CORE0, not left over from before a reload:
+ *
+ *  - CORE1 writes req, a value gen does not have, kicks CORE0, and waits
+ *    (up to CORE_VRING_WAIT polls) for gen to take that value.
+ *  - CORE0 clears gen, lays the vring out and registers it, then copies
+ *    req to gen, and does so again on each kick of the vring (see
+ *    VirtQueue_isr) for a request made after that.
+ *
+ * So only a CORE0 done laying out can make gen match, whatever the words
+ * held before.  Recovery (remoteproc) reloads both cores, and each boot
+ * does the above afresh; restarting CORE1 alone is not supported, as
+ * CORE0 would answer it without laying the vring out again.
  */
-#define VQ0_SIZE                256
-#define VQ1_SIZE                256
-#define VQ2_SIZE                256
-#define VQ3_SIZE                256
+#define CORE_LINK               0xA00C0000
+#define CORE_LINK_SIZE          0x00040000
+#define CORE_VRING0             0xA00C0000  /* ID_CORE1_TO_CORE0 */
+#define CORE_VRING1             0xA00C4000  /* ID_CORE0_TO_CORE1 */
+#define CORE_VRING_SYNC         0xA00C8000
+#define CORE_VRING_NUM          64
+#define CORE_VRING_WAIT         0x1000000
+
+typedef struct VirtQueue_CoreSync {
+    volatile UInt32         req;    /* CORE1: value it waits for in gen */
+    volatile UInt32         gen;    /* CORE0: 0 while laying out, else req */
+} VirtQueue_CoreSync;
 
 /*
  * enum - Predefined Mailbox Messages
@@ -133,12 +190,13 @@ enum {
     RP_MSG_HIBERNATION          = (Int)0xFFFFFF07
 };
 
-#define DIV_ROUND_UP(n,d)   (((n) + (d) - 1) / (d))
-#define RP_MSG_NUM_BUFS     (VQ0_SIZE) /* must be power of two */
+/*
+ * Vring geometry for vrings the resource table does not describe (AppM3's).
+ * Others take theirs from their fw_rsc_vdev_vring entry.
+ */
+#define RP_MSG_NUM_BUFS     (256) /* must be power of two */
 #define RP_MSG_BUF_SIZE     (512)
-#define RP_MSG_BUFS_SPACE   (RP_MSG_NUM_BUFS * RP_MSG_BUF_SIZE * 2)
 
-#define PAGE_SIZE           (4096)
 /*
  * The alignment to use between consumer and producer parts of vring.
  * Note: this is part of the "wire" protocol. If you change this, you need
@@ -146,12 +204,15 @@ enum {
  */
 #define RP_MSG_VRING_ALIGN  (4096)
 
-/* With 256 buffers, our vring will occupy 3 pages */
-#define RP_MSG_RING_SIZE    ((DIV_ROUND_UP(vring_size(RP_MSG_NUM_BUFS, \
-                            RP_MSG_VRING_ALIGN), PAGE_SIZE)) * PAGE_SIZE)
+/* Largest vring: free-running UInt16 indices must wrap cleanly */
+#define RP_MSG_MAX_NUM_BUFS (32768)
 
-/* The total IPC space needed to communicate with a remote processor */
-#define RPMSG_IPC_MEM   (RP_MSG_BUFS_SPACE + 2 * RP_MSG_RING_SIZE)
+/*
+ * Polls in vain after which VirtQueue_poll stops spinning, and polls it
+ * then lets go by before trying again.
+ */
+#define POLL_MISS_LIMIT     (8)
+#define POLL_RETRY          (64)
 
 #define ID_SYSM3_TO_A9      0
 #define ID_A9_TO_SYSM3      1
@@ -162,6 +223,19 @@ enum {
 #define ID_APPM3_TO_A9      200
 #define ID_A9_TO_APPM3      201
 
+#if defined(VIRTIO_RING_PACKED)
+/*
+ * What getAvail saw of a buffer: used descriptors, written in place, may
+ * overwrite its head descriptor before the buffer itself is returned.
+ */
+typedef struct VirtQueue_Head {
+    UInt16                  id;     /* buffer id, from its last descriptor */
+    UInt16                  segs;   /* ring descriptors it spans */
+    UInt16                  flags;  /* of its head descriptor */
+    UInt32                  len;    /* of its head descriptor */
+} VirtQueue_Head;
+#endif
+
 typedef struct VirtQueue_Object {
     /* Id for this VirtQueue_Object */
     UInt16                  id;
@@ -170,8 +244,24 @@ typedef struct VirtQueue_Object {
     VirtQueue_callback      callback;
 
     /* Shared state */
+#if defined(VIRTIO_RING_PACKED)
+    struct vring_packed     vring;
+
+    /* Each buffer got, by head position */
+    VirtQueue_Head          *heads;
+
+    /* Descriptor count of the last buffer got; see discardAvailBuf */
+    UInt16                  last_avail_segs;
+#else
     struct vring            vring;
 
+    /* Avail index each buffer was claimed at; see VirtQueue_claimAvailBuf */
+    UInt16                  *claims;
+
+    /* 1 + the index of each filled used entry; see VirtQueue_publishUsedBuf */
+    volatile UInt16         *done;
+#endif
+
     /* Number of free buffers */
     UInt16                  num_free;
 
@@ -183,23 +273,1109 @@ typedef struct VirtQueue_Object {
 
     /* Will eventually be used to kick remote processor */
     UInt16                  procId;
+
+    /* VIRTIO_RING_F_EVENT_IDX negotiated with the host */
+    Bool                    eventIdx;
+
+    /* VIRTIO_RPMSG_F_PADDED_IDX negotiated with the host */
+    Bool                    paddedIdx;
+
+    /* We are the driver (Host) side of the vring, as CORE0 is for CORE1 */
+    Bool                    driver;
+
+    /* CORE0 <-> CORE1 vrings: their handshake words, else NULL */
+    VirtQueue_CoreSync      *sync;
+
+    /* Used index when last considering a kick; updated by VirtQueue_kick */
+    UInt16                  last_kick_used_idx;
+
+    /* Part of the vring written but not yet written back, see cacheDirty */
+    UArg                    dirtyStart;
+    UArg                    dirtyEnd;
+
+    /* Vring checks per VirtQueue_poll, 0 if not polling */
+    UInt                    pollBudget;
+
+    /* VirtQueue_polls in vain in a row (see VirtQueue_poll) */
+    UInt                    pollMisses;
+
+    /* Counters; see VirtQueue_getStats */
+    VirtQueue_Stats         stats;
 } VirtQueue_Object;
 
-static struct VirtQueue_Object *queueRegistry[NUM_QUEUES];
+/*
+ * Notify id -> VirtQueue registry: queueSlot[id] is 1 + the index of the
+ * VirtQueue in queueRegistry, or 0 if it has none, so VirtQueue_isr finds
+ * a VirtQueue in constant time however many vdevs there are.
+ */
+static struct VirtQueue_Object *queueRegistry[NUM_QUEUES];
+static UInt8 queueSlot[MAX_NOTIFY_ID + 1];
+static UInt numQueues = 0;
+
+/* Resource table of this image, if any (see VirtQueue_setResourceTable) */
+static struct fw_rsc_table_hdr *rscTable = NULL;
+
+/* Trace buffer VirtQueue_cacheWb writes back (see VirtQueue_setTraceBuf) */
+static Ptr traceBuf = NULL;
+static SizeT traceLen = 0;
+
+/*
+ * PA <-> DA (our VA) translation: the carveouts and devmems of the resource
+ * table, or without one, just the 1MB IPC window.  lastPA and lastVA are
+ * the entries the last translations hit, tried first: buffers and vrings
+ * are nearly always in the same one.
+ */
+typedef struct VirtQueue_Xlate {
+    UInt32                  da;
+    UInt32                  pa;
+    UInt32                  len;
+} VirtQueue_Xlate;
+
+static VirtQueue_Xlate xlate[MAX_XLATE] = {
+    { 0xA0000000, 0xA9000000, 0x00100000 }
+};
+static UInt numXlate = 1;
+static UInt lastPA = 0;
+static UInt lastVA = 0;
+
+static UInt16 hostProcId;
+static UInt16 dspProcId;
+static UInt16 sysm3ProcId;
+static UInt16 appm3ProcId;
+
+/*
+ * Full memory barrier, ordering our vring updates against the subsequent
+ * reads of the other side's flags and indices.
+ */
+#if defined(__TI_TMS470_V7M3__)
+#define VirtQueue_mb()      asm(" dsb")
+#elif defined(__GNUC__)
+#define VirtQueue_mb()      __sync_synchronize()
+#else
+#define VirtQueue_mb()
+#endif
+
+/*
+ * ======== casU16 ========
+ * Atomic compare-and-swap, for the calls that may run concurrently (see
+ * VirtQueue_claimAvailBuf).  An exclusive access left open on a mismatch
+ * is harmless: every store-exclusive here is retried.
+ */
+static inline Bool casU16(volatile UInt16 *addr, UInt16 old, UInt16 val)
+{
+#if defined(__TI_TMS470_V7M3__)
+    do {
+        if ((UInt16)__ldrexh((Void *)addr) != old) {
+            return (FALSE);
+        }
+    } while (__strexh(val, (Void *)addr));
+
+    return (TRUE);
+#elif defined(__GNUC__)
+    return (__atomic_compare_exchange_n(addr, &old, val, FALSE,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+#else
+    UInt key = Hwi_disable();
+    Bool swapped = (*addr == old);
+
+    if (swapped) {
+        *addr = val;
+    }
+    Hwi_restore(key);
+
+    return (swapped);
+#endif
+}
+
+/*
+ * ======== xchgU16 ========
+ */
+static inline UInt16 xchgU16(volatile UInt16 *addr, UInt16 val)
+{
+    UInt16 old;
+
+    do {
+        old = *addr;
+    } while (!casU16(addr, old, val));
+
+    return (old);
+}
+
+/*
+ * ======== findXlate ========
+ * Index of the entry whose PA (or DA, if 'byDa') range holds addr, or -1.
+ */
+static Int findXlate(UInt32 addr, Bool byDa)
+{
+    UInt i;
+
+    for (i = 0; i < numXlate; i++) {
+        if (addr - (byDa ? xlate[i].da : xlate[i].pa) < xlate[i].len) {
+            return (i);
+        }
+    }
+
+    return (-1);
+}
+
+/*
+ * ======== mapPAtoVA ========
+ * Addresses come from the host: one outside of everything it gave us is
+ * an error, not something to wrap into the IPC window.
+ */
+static inline Void * mapPAtoVA(UInt pa)
+{
+    VirtQueue_Xlate *x = &xlate[lastPA];
+    Int i;
+
+    if (pa - x->pa >= x->len) {
+        if ((i = findXlate(pa, FALSE)) < 0) {
+            Log_print1(Diags_USER1, "mapPAtoVA: unknown pa 0x%x\n", pa);
+            Error_raise(NULL, Error_E_generic, pa, 0);
+            return (NULL);
+        }
+        lastPA = i;
+        x = &xlate[i];
+    }
+
+    return (Void *)(UArg)(pa - x->pa + x->da);
+}
+
+/*
+ * ======== mapVAtoPA ========
+ */
+static inline UInt mapVAtoPA(Void * va)
+{
+    VirtQueue_Xlate *x = &xlate[lastVA];
+    UInt32 da = (UInt32)(UArg)va;
+    Int i;
+
+    if (da - x->da >= x->len) {
+        if ((i = findXlate(da, TRUE)) < 0) {
+            Log_print1(Diags_USER1, "mapVAtoPA: unknown va 0x%x\n", da);
+            Error_raise(NULL, Error_E_generic, da, 0);
+            return (0);
+        }
+        lastVA = i;
+        x = &xlate[i];
+    }
+
+    return (da - x->da + x->pa);
+}
+
+/*
+ * ======== initXlate ========
+ * Build the translation table from the carveouts and devmems of the
+ * resource table.  Carveouts the host did not back (pa still 0) are left
+ * out.  Keeps the default IPC window if the table has no usable entry.
+ */
+static Void initXlate()
+{
+    struct fw_rsc_devmem *mem;
+    UInt num = 0;
+    UInt i;
+
+    for (i = 0; (i < rscTable->num) && (num < MAX_XLATE); i++) {
+        /* fw_rsc_carveout and fw_rsc_devmem have the same layout */
+        mem = (struct fw_rsc_devmem *)((Char *)rscTable + rscTable->offset[i]);
+        if (((mem->type != TYPE_CARVEOUT) && (mem->type != TYPE_DEVMEM)) ||
+            (mem->len == 0) ||
+            ((mem->type == TYPE_CARVEOUT) && (mem->pa == 0))) {
+            continue;
+        }
+
+        xlate[num].da = mem->da;
+        xlate[num].pa = mem->pa;
+        xlate[num].len = mem->len;
+        num++;
+    }
+
+    if (num > 0) {
+        numXlate = num;
+        lastPA = 0;
+        lastVA = 0;
+    }
+}
+
+/*
+ * ======== cacheInv / cacheWb / cacheDirty ========
+ * Cache maintenance of just the vring parts and buffers an operation
+ * touches.  Built with VIRTQUEUE_CACHED_IPC defined, for when the IPC
+ * memory is mapped cacheable; otherwise there is nothing to do.
+ */
+static inline Void cacheInv(Ptr addr, SizeT size)
+{
+#if defined(VIRTQUEUE_CACHED_IPC)
+    Cache_inv(addr, size, Cache_Type_ALL, TRUE);
+#endif
+}
+
+static inline Void cacheWb(Ptr addr, SizeT size)
+{
+#if defined(VIRTQUEUE_CACHED_IPC)
+    Cache_wb(addr, size, Cache_Type_ALL, TRUE);
+#endif
+}
+
+/*
+ * Mark part of vring 'vq' written but not yet written back, for
+ * VirtQueue_cacheWb.  Only for updates the host may see late, such as
+ * notification hints.  Each vring keeps its own range, so vrings far
+ * apart never make for one large write-back.
+ */
+static inline Void cacheDirty(VirtQueue_Handle vq, Ptr addr, SizeT size)
+{
+#if defined(VIRTQUEUE_CACHED_IPC)
+    UInt key = Hwi_disable();
+
+    if ((UArg)addr < vq->dirtyStart) {
+        vq->dirtyStart = (UArg)addr;
+    }
+    if ((UArg)addr + size > vq->dirtyEnd) {
+        vq->dirtyEnd = (UArg)addr + size;
+    }
+    Hwi_restore(key);
+#endif
+}
+
+/*
+ * ======== notePending ========
+ * Track the high-water mark of buffers found waiting in the vring.
+ */
+static inline Void notePending(VirtQueue_Handle vq, UInt16 pending)
+{
+    if (pending > vq->stats.maxPending) {
+        vq->stats.maxPending = pending;
+    }
+}
+
+/*
+ * ======== isCoreVring ========
+ * Whether 'id' is one of the CORE0 <-> CORE1 vrings.
+ */
+static inline Bool isCoreVring(UInt id)
+{
+    return ((id == ID_CORE1_TO_CORE0) || (id == ID_CORE0_TO_CORE1));
+}
+
+/*
+ * ======== coreLinkReserved ========
+ * Whether the resource table, if any, has the devmem entry reserving
+ * CORE_LINK.  Without a table (as on CORE1), there is nothing to check.
+ */
+static Bool coreLinkReserved()
+{
+    struct fw_rsc_devmem *mem;
+    UInt i;
+
+    if (rscTable == NULL) {
+        return (TRUE);
+    }
+
+    for (i = 0; i < rscTable->num; i++) {
+        mem = (struct fw_rsc_devmem *)((Char *)rscTable + rscTable->offset[i]);
+        if ((mem->type == TYPE_DEVMEM) && (mem->da == CORE_LINK) &&
+            (mem->len >= CORE_LINK_SIZE)) {
+            return (TRUE);
+        }
+    }
+
+    return (FALSE);
+}
+
+/*
+ * ======== coreRequest ========
+ * CORE1: ask CORE0 to confirm it has laid out this boot's vring 'vq' (see
+ * CORE_VRING_SYNC).  Returns FALSE if it did not in time.
+ */
+static Bool coreRequest(VirtQueue_Object *vq)
+{
+    VirtQueue_CoreSync *sync = vq->sync;
+    UInt32 req;
+    UInt i;
+
+    /* Any value gen does not have yet will do: 0 is CORE0 laying out */
+    req = sync->gen + 1;
+    if (req == 0) {
+        req = 1;
+    }
+    sync->req = req;
+    VirtQueue_mb();
+    InterruptM3_intSend(vq->procId, vq->id);
+
+    for (i = 0; sync->gen != req; i++) {
+        if (i == CORE_VRING_WAIT) {
+            return (FALSE);
+        }
+    }
+
+    /* The vring, as laid out, is only read after gen */
+    VirtQueue_mb();
+
+    return (TRUE);
+}
+
+/*
+ * ======== findVdev ========
+ * Find the resource table vdev owning the vring with notify id 'id'.  The
+ * host hands out notify ids in resource table order, so this is simply the
+ * id'th vring of the table.
+ */
+static struct fw_rsc_vdev *findVdev(UInt id, struct fw_rsc_vdev_vring **vring)
+{
+    struct fw_rsc_vdev *vdev;
+    UInt first = 0;
+    UInt i;
+
+    if (rscTable == NULL) {
+        return (NULL);
+    }
+
+    for (i = 0; i < rscTable->num; i++) {
+        vdev = (struct fw_rsc_vdev *)((Char *)rscTable + rscTable->offset[i]);
+        if (vdev->type != TYPE_VDEV) {
+            continue;
+        }
+
+        if (id < first + vdev->num_of_vrings) {
+            *vring = (struct fw_rsc_vdev_vring *)(vdev + 1) + (id - first);
+            return (vdev);
+        }
+        first += vdev->num_of_vrings;
+    }
+
+    return (NULL);
+}
+
+#if defined(VIRTIO_RING_PACKED)
+/*
+ * ======== descAvail ========
+ * Whether the driver made the descriptor at free-running index idx
+ * available for this lap of the ring.
+ */
+static inline Bool descAvail(VirtQueue_Handle vq, UInt16 idx)
+{
+    struct vring_packed_desc *desc;
+    UInt16 flags;
+    Bool wrap = vring_packed_wrap(&vq->vring, idx);
+
+    desc = &vq->vring.desc[vring_packed_pos(&vq->vring, idx)];
+    cacheInv(desc, sizeof(struct vring_packed_desc));
+    flags = desc->flags;
+
+    return ((((flags >> VRING_PACKED_DESC_F_AVAIL) & 1) == wrap) &&
+            (((flags >> VRING_PACKED_DESC_F_USED) & 1) != wrap));
+}
+
+/*
+ * ======== availPending ========
+ */
+static inline Bool availPending(VirtQueue_Handle vq)
+{
+    return (descAvail(vq, vq->last_avail_idx));
+}
+
+/*
+ * ======== usedFlags ========
+ * Flags marking a descriptor used, at free-running index idx.
+ */
+static inline UInt16 usedFlags(VirtQueue_Handle vq, UInt16 idx)
+{
+    if (vring_packed_wrap(&vq->vring, idx)) {
+        return ((1 << VRING_PACKED_DESC_F_AVAIL) |
+                (1 << VRING_PACKED_DESC_F_USED));
+    }
+
+    return (0);
+}
+
+/*
+ * ======== headDesc ========
+ * First descriptor of the buffer at ring position 'head': for an indirect
+ * buffer, that is the first entry of its descriptor table.
+ */
+static inline struct vring_packed_desc *headDesc(VirtQueue_Handle vq,
+                                                 UInt16 head)
+{
+    struct vring_packed_desc *desc = &vq->vring.desc[head];
+
+    if (desc->flags & VRING_DESC_F_INDIRECT) {
+        desc = mapPAtoVA(desc->addr);
+    }
+
+    return (desc);
+}
+
+/*
+ * ======== cacheBuf ========
+ * Invalidate the buffer at ring position 'head' before reading it (wb
+ * FALSE), or write back the first 'len' bytes written to it.  Its ring
+ * descriptors must have been invalidated already, by getAvail.
+ */
+static Void cacheBuf(VirtQueue_Handle vq, UInt16 head, UInt len, Bool wb)
+{
+#if defined(VIRTQUEUE_CACHED_IPC)
+    struct vring_packed_desc *desc = NULL;
+    VirtQueue_Head *h = &vq->heads[head];
+    Void *addr;
+    UInt16 flags;
+    UInt num = h->segs;
+    UInt i;
+    UInt size;
+
+    if (h->flags & VRING_DESC_F_INDIRECT) {
+        num = h->len / sizeof(struct vring_packed_desc);
+        desc = mapPAtoVA(vq->vring.desc[head].addr);
+        if (!wb) {
+            cacheInv(desc, h->len);
+        }
+    }
+
+    for (i = 0; (i < num) && (len > 0); i++) {
+        if (h->flags & VRING_DESC_F_INDIRECT) {
+            addr = mapPAtoVA(desc[i].addr);
+            size = desc[i].len;
+            flags = desc[i].flags;
+        }
+        else {
+            /* Of a ring descriptor, only the address surely survives */
+            desc = &vq->vring.desc[vring_packed_pos(&vq->vring, head + i)];
+            addr = mapPAtoVA(desc->addr);
+            size = (i == 0) ? h->len : desc->len;
+            flags = (i == 0) ? h->flags : desc->flags;
+        }
+
+        size = (size < len) ? size : len;
+        if (wb) {
+            cacheWb(addr, size);
+        }
+        else if (!(flags & VRING_DESC_F_WRITE)) {
+            /* Write-only buffers are only written back, once filled */
+            cacheInv(addr, size);
+        }
+        len -= size;
+    }
+#endif
+}
+
+/*
+ * ======== getAvail ========
+ * Take the next available buffer, which spans one descriptor or a chain of
+ * consecutive ones.  Returns its head position (the token), or -1.
+ */
+static inline Int16 getAvail(VirtQueue_Handle vq, Void **buf, int *len)
+{
+    struct vring_packed_desc *desc;
+    UInt16 head = vring_packed_pos(&vq->vring, vq->last_avail_idx);
+    UInt16 segs = 1;
+
+    if (!descAvail(vq, vq->last_avail_idx)) {
+        return (-1);
+    }
+
+    /* The buffer id is in the last descriptor of a chain */
+    desc = &vq->vring.desc[head];
+    while ((desc->flags & VRING_DESC_F_NEXT) && (segs < vq->vring.num)) {
+        desc = &vq->vring.desc[vring_packed_pos(&vq->vring,
+                                                vq->last_avail_idx + segs)];
+        cacheInv(desc, sizeof(struct vring_packed_desc));
+        segs++;
+    }
+
+    vq->heads[head].id = desc->id;
+    vq->heads[head].segs = segs;
+    vq->heads[head].flags = vq->vring.desc[head].flags;
+    vq->heads[head].len = vq->vring.desc[head].len;
+    vq->last_avail_idx += segs;
+    vq->last_avail_segs = segs;
+
+    cacheBuf(vq, head, ~0U, FALSE);
+    desc = headDesc(vq, head);
+    *buf = mapPAtoVA(desc->addr);
+    *len = desc->len;
+
+    return (head);
+}
+
+/*
+ * ======== kickDevice ========
+ * VirtQueue_kick on the driver side: the device may have asked not to be.
+ */
+static Void kickDevice(VirtQueue_Object *vq)
+{
+    VirtQueue_mb();
+    cacheInv(vq->vring.device, sizeof(struct vring_packed_desc_event));
+
+    if (vq->vring.device->flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
+        vq->stats.kicksSuppressed++;
+        return;
+    }
+
+    InterruptM3_intSend(vq->procId, vq->id);
+    vq->stats.kicks++;
+}
+
+/*!
+ * ======== VirtQueue_kick ========
+ */
+Void VirtQueue_kick(VirtQueue_Handle vq)
+{
+    struct vring_packed_desc_event *event = vq->vring.driver;
+    UInt16 used_idx = vq->last_used_idx;
+    UInt16 old_idx;
+    UInt16 event_idx;
+
+    if (vq->driver) {
+        kickDevice(vq);
+        return;
+    }
+
+    /* Make sure the used descriptors are visible before checking the host's */
+    VirtQueue_mb();
+    cacheInv(event, sizeof(struct vring_packed_desc_event));
+
+    /* Atomic, as concurrent senders may kick (see VirtQueue_claimAvailBuf) */
+    old_idx = xchgU16(&vq->last_kick_used_idx, used_idx);
+
+    if (vq->eventIdx && (event->flags == VRING_PACKED_EVENT_FLAG_DESC)) {
+        /* Turn off_wrap into a free-running index near used_idx */
+        event_idx = (used_idx & ~(vq->vring.num - 1)) |
+                    (event->off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR));
+        if ((event->off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+            vring_packed_wrap(&vq->vring, used_idx)) {
+            event_idx -= vq->vring.num;
+        }
+
+        if (!vring_need_event(event_idx, used_idx, old_idx)) {
+            Log_print0(Diags_USER1,
+                    "VirtQueue_kick: no kick because of off_wrap\n");
+            vq->stats.kicksSuppressed++;
+            return;
+        }
+    }
+    else if (event->flags == VRING_PACKED_EVENT_FLAG_DISABLE) {
+        Log_print0(Diags_USER1,
+                "VirtQueue_kick: no kick because of EVENT_FLAG_DISABLE\n");
+        vq->stats.kicksSuppressed++;
+        return;
+    }
+
+    Log_print2(Diags_USER1,
+            "VirtQueue_kick: Sending interrupt to proc %d with payload 0x%x\n",
+            (IArg)vq->procId, (IArg)vq->id);
+    InterruptM3_intSend(vq->procId, vq->id);
+    vq->stats.kicks++;
+}
+
+/*!
+ * ======== VirtQueue_addUsedBuf ========
+ */
+Int VirtQueue_addUsedBuf(VirtQueue_Handle vq, Int16 head, int len)
+{
+    struct vring_packed_desc *used;
+
+    if ((head >= vq->vring.num) || (head < 0)) {
+        Error_raise(NULL, Error_E_generic, 0, 0);
+    }
+
+    cacheBuf(vq, head, len, TRUE);
+
+    /* Used descriptors are written in place, in the order they complete */
+    used = &vq->vring.desc[vring_packed_pos(&vq->vring, vq->last_used_idx)];
+    used->id = vq->heads[head].id;
+    used->len = len;
+    cacheWb(used, sizeof(struct vring_packed_desc));
+
+    /* The descriptor must be complete before the host sees its flags */
+    VirtQueue_mb();
+    used->flags = usedFlags(vq, vq->last_used_idx);
+    cacheWb(&used->flags, sizeof(UInt16));
+
+    vq->last_used_idx += vq->heads[head].segs;
+    vq->stats.bufsUsed++;
+
+    return (0);
+}
+
+/*!
+ * ======== VirtQueue_addUsedBufs ========
+ */
+Int VirtQueue_addUsedBufs(VirtQueue_Handle vq, Int16 heads[], int lens[],
+                          Int count)
+{
+    struct vring_packed_desc *used;
+    UInt16 idx = vq->last_used_idx;
+    Int i;
+
+    for (i = 0; i < count; i++) {
+        if ((heads[i] >= vq->vring.num) || (heads[i] < 0)) {
+            Error_raise(NULL, Error_E_generic, 0, 0);
+        }
+
+        cacheBuf(vq, heads[i], lens[i], TRUE);
+
+        used = &vq->vring.desc[vring_packed_pos(&vq->vring, idx)];
+        used->id = vq->heads[heads[i]].id;
+        used->len = lens[i];
+        cacheWb(used, sizeof(struct vring_packed_desc));
+        idx += vq->heads[heads[i]].segs;
+    }
+
+    /* Publish all the descriptors after a single barrier */
+    VirtQueue_mb();
+
+    for (i = 0; i < count; i++) {
+        used = &vq->vring.desc[vring_packed_pos(&vq->vring,
+                                                vq->last_used_idx)];
+        used->flags = usedFlags(vq, vq->last_used_idx);
+        cacheWb(&used->flags, sizeof(UInt16));
+        vq->last_used_idx += vq->heads[heads[i]].segs;
+    }
+    vq->stats.bufsUsed += count;
+
+    return (0);
+}
+
+/*!
+ * ======== VirtQueue_addAvailBuf ========
+ */
+Int VirtQueue_addAvailBuf(VirtQueue_Object *vq, Void *buf)
+{
+    struct vring_packed_desc *desc;
+    UInt16 pos = vring_packed_pos(&vq->vring, vq->last_avail_idx);
+
+    if (vq->num_free == 0) {
+        /* There's no more space */
+        Error_raise(NULL, Error_E_generic, 0, 0);
+    }
+
+    vq->num_free--;
+
+    /* Buffers are returned in order, so the ring position is a fine id */
+    desc = &vq->vring.desc[pos];
+    desc->addr = mapVAtoPA(buf);
+    desc->len = RP_MSG_BUF_SIZE;
+    desc->id = pos;
+    cacheWb(desc, sizeof(struct vring_packed_desc));
+
+    VirtQueue_mb();
+    desc->flags = vring_packed_wrap(&vq->vring, vq->last_avail_idx) ?
+                  (1 << VRING_PACKED_DESC_F_AVAIL) :
+                  (1 << VRING_PACKED_DESC_F_USED);
+    cacheWb(&desc->flags, sizeof(UInt16));
+    vq->last_avail_idx++;
+
+    return (vq->num_free);
+}
+
+/*!
+ * ======== VirtQueue_getUsedBuf ========
+ */
+Void *VirtQueue_getUsedBuf(VirtQueue_Object *vq)
+{
+    struct vring_packed_desc *used;
+    UInt16 id;
+
+    used = &vq->vring.desc[vring_packed_pos(&vq->vring, vq->last_used_idx)];
+    cacheInv(used, sizeof(struct vring_packed_desc));
+
+    /* There's nothing available? */
+    if (((used->flags >> VRING_PACKED_DESC_F_USED) & 1) !=
+        vring_packed_wrap(&vq->vring, vq->last_used_idx)) {
+        return (NULL);
+    }
+
+    id = used->id;
+    vq->last_used_idx++;
+    vq->num_free++;
+
+    /* The slave only writes id, len and flags: the address is still ours */
+    return (mapPAtoVA(vq->vring.desc[id].addr));
+}
+
+/*!
+ * ======== VirtQueue_getAvailBuf ========
+ */
+Int16 VirtQueue_getAvailBuf(VirtQueue_Handle vq, Void **buf, int *len)
+{
+    Int16 head = getAvail(vq, buf, len);
+
+    /* Without an avail index, what is waiting is only seen by taking it */
+    if (head < 0) {
+        vq->stats.noBufs++;
+    }
+    else {
+        notePending(vq, 1);
+    }
+
+    return (head);
+}
+
+/*!
+ * ======== VirtQueue_getAvailBufs ========
+ */
+Int VirtQueue_getAvailBufs(VirtQueue_Handle vq, Int16 heads[], Void *bufs[],
+                           int lens[], Int max)
+{
+    Int count = 0;
+
+    while ((count < max) &&
+           ((heads[count] = getAvail(vq, &bufs[count], &lens[count])) >= 0)) {
+        count++;
+    }
+
+    if (count == 0) {
+        vq->stats.noBufs++;
+    }
+    notePending(vq, count);
+
+    return (count);
+}
+
+/*!
+ * ======== VirtQueue_claimAvailBuf ========
+ * Buffer ids and chains are read out of the descriptors, so unlike the
+ * split layout's, claiming a buffer is not a single index update: it is
+ * done with interrupts off instead.
+ */
+Int16 VirtQueue_claimAvailBuf(VirtQueue_Handle vq, Void **buf, int *len)
+{
+    UInt key = Hwi_disable();
+    Int16 head = getAvail(vq, buf, len);
+
+    Hwi_restore(key);
+
+    if (head < 0) {
+        vq->stats.noBufs++;
+    }
+
+    return (head);
+}
+
+/*!
+ * ======== VirtQueue_unclaimAvailBuf ========
+ */
+Bool VirtQueue_unclaimAvailBuf(VirtQueue_Handle vq, Int16 head)
+{
+    UInt key = Hwi_disable();
+    Bool last = (vring_packed_pos(&vq->vring,
+                        vq->last_avail_idx - vq->last_avail_segs) == head);
+
+    if (last) {
+        vq->last_avail_idx -= vq->last_avail_segs;
+        vq->last_avail_segs = 0;
+    }
+    Hwi_restore(key);
+
+    return (last);
+}
+
+/*!
+ * ======== VirtQueue_publishUsedBuf ========
+ */
+Void VirtQueue_publishUsedBuf(VirtQueue_Handle vq, Int16 head, int len)
+{
+    UInt key = Hwi_disable();
+
+    VirtQueue_addUsedBuf(vq, head, len);
+    Hwi_restore(key);
+}
+
+/*!
+ * ======== VirtQueue_getBufChain ========
+ * The chain is read from the ring, so must be got before a buffer returned
+ * out of order overwrites it (see VirtQueue_addUsedBuf).
+ */
+Int VirtQueue_getBufChain(VirtQueue_Handle vq, Int16 head,
+                          VirtQueue_Seg segs[], Int maxSegs)
+{
+    struct vring_packed_desc *desc;
+    UInt num;
+    UInt i;
+    Int count;
+
+    if ((head >= vq->vring.num) || (head < 0)) {
+        Error_raise(NULL, Error_E_generic, 0, 0);
+    }
+
+    if (vq->heads[head].flags & VRING_DESC_F_INDIRECT) {
+        /* An indirect table has no NEXT flags: all entries are chained */
+        num = vq->heads[head].len / sizeof(struct vring_packed_desc);
+        desc = mapPAtoVA(vq->vring.desc[head].addr);
+        for (count = 0; (count < maxSegs) && (count < num); count++) {
+            segs[count].buf = mapPAtoVA(desc[count].addr);
+            segs[count].len = desc[count].len;
+        }
+        return (count);
+    }
+
+    /* The head's length is as getAvail saw it, as in cacheBuf */
+    num = vq->heads[head].segs;
+    for (count = 0, i = head; (count < maxSegs) && (count < num); count++) {
+        desc = &vq->vring.desc[vring_packed_pos(&vq->vring, i++)];
+        segs[count].buf = mapPAtoVA(desc->addr);
+        segs[count].len = (count == 0) ? vq->heads[head].len : desc->len;
+    }
+
+    return (count);
+}
+
+/*!
+ * ======== VirtQueue_discardAvailBuf ========
+ */
+Void VirtQueue_discardAvailBuf(VirtQueue_Handle vq)
+{
+    vq->last_avail_idx -= vq->last_avail_segs;
+}
+
+/*!
+ * ======== VirtQueue_disableCallback ========
+ */
+Void VirtQueue_disableCallback(VirtQueue_Handle vq)
+{
+    if (vq->driver) {
+        /* Advise the slave not to kick us when it uses buffers */
+        vq->vring.driver->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+        cacheDirty(vq, vq->vring.driver,
+                   sizeof(struct vring_packed_desc_event));
+        return;
+    }
+
+    /* Advise the host not to kick us when it adds buffers */
+    vq->vring.device->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+
+    /* Only a hint: the host seeing it late just costs a kick */
+    cacheDirty(vq, vq->vring.device, sizeof(struct vring_packed_desc_event));
+}
+
+/*!
+ * ======== VirtQueue_enableCallback ========
+ */
+Bool VirtQueue_enableCallback(VirtQueue_Handle vq)
+{
+    struct vring_packed_desc *used;
+
+    if (vq->driver) {
+        vq->vring.driver->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+        cacheWb(vq->vring.driver, sizeof(struct vring_packed_desc_event));
+        VirtQueue_mb();
+
+        /* As VirtQueue_getUsedBuf, whether a used buffer is waiting */
+        used = &vq->vring.desc[vring_packed_pos(&vq->vring,
+                                                vq->last_used_idx)];
+        cacheInv(used, sizeof(struct vring_packed_desc));
+        return (((used->flags >> VRING_PACKED_DESC_F_USED) & 1) !=
+                vring_packed_wrap(&vq->vring, vq->last_used_idx));
+    }
+
+    if (vq->eventIdx) {
+        /* Kick us for the next buffer the host adds */
+        vq->vring.device->off_wrap =
+                vring_packed_pos(&vq->vring, vq->last_avail_idx) |
+                (vring_packed_wrap(&vq->vring, vq->last_avail_idx) <<
+                 VRING_PACKED_EVENT_F_WRAP_CTR);
+        cacheWb(vq->vring.device, sizeof(struct vring_packed_desc_event));
+        VirtQueue_mb();
+        vq->vring.device->flags = VRING_PACKED_EVENT_FLAG_DESC;
+    }
+    else {
+        vq->vring.device->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+    }
+    cacheWb(vq->vring.device, sizeof(struct vring_packed_desc_event));
+
+    /*
+     * The host may have added a buffer just before it saw the flag change,
+     * without kicking us: check again once the flag is visible.
+     */
+    VirtQueue_mb();
+
+    return (!availPending(vq));
+}
+
+/*
+ * ======== initRing ========
+ * Returns FALSE if out of memory for the bookkeeping of its buffers.
+ */
+static Bool initRing(VirtQueue_Object *vq, Void *vring_phys, UInt num,
+                     UInt align)
+{
+    Error_Block eb;
+
+    Error_init(&eb);
+
+    if (vq->paddedIdx) {
+        vring_packed_init_padded(&(vq->vring), num, vring_phys);
+    }
+    else {
+        vring_packed_init(&(vq->vring), num, vring_phys);
+    }
+
+    vq->heads = Memory_alloc(NULL, num * sizeof(VirtQueue_Head), 0, &eb);
+    vq->last_used_idx = 0;
+    vq->last_avail_segs = 0;
+    vq->last_kick_used_idx = 0;
+
+    return (vq->heads != NULL);
+}
+
+/*
+ * ======== freeRing ========
+ * Undo initRing.
+ */
+static Void freeRing(VirtQueue_Object *vq)
+{
+    if (vq->heads) {
+        Memory_free(NULL, vq->heads, vq->vring.num * sizeof(VirtQueue_Head));
+    }
+}
+
+#else /* VIRTIO_RING_PACKED */
+/*
+ * ======== headDesc ========
+ * First descriptor of the buffer starting at 'head': for an indirect
+ * buffer, that is the first entry of its descriptor table.
+ */
+static inline struct vring_desc *headDesc(VirtQueue_Handle vq, UInt16 head)
+{
+    struct vring_desc *desc = &vq->vring.desc[head];
+
+    if (desc->flags & VRING_DESC_F_INDIRECT) {
+        desc = mapPAtoVA(desc->addr);
+    }
+
+    return (desc);
+}
+
+/*
+ * ======== cacheBuf ========
+ * Invalidate the buffer starting at 'head', with its descriptors, before
+ * reading them (wb FALSE), or write back the first 'len' bytes written to
+ * the buffer.
+ */
+static Void cacheBuf(VirtQueue_Handle vq, UInt16 head, UInt len, Bool wb)
+{
+#if defined(VIRTQUEUE_CACHED_IPC)
+    struct vring_desc *desc = vq->vring.desc;
+    Bool table = FALSE;
+    UInt num = vq->vring.num;
+    UInt i = head;
+    UInt count;
+    UInt size;
+
+    if (!wb) {
+        cacheInv(&desc[i], sizeof(struct vring_desc));
+    }
+
+    if (desc[i].flags & VRING_DESC_F_INDIRECT) {
+        num = desc[i].len / sizeof(struct vring_desc);
+        desc = mapPAtoVA(desc[i].addr);
+        i = 0;
+        table = TRUE;
+        if (!wb) {
+            cacheInv(desc, num * sizeof(struct vring_desc));
+        }
+    }
+
+    for (count = 0; (count < num) && (len > 0); count++) {
+        if (!wb && !table && count > 0) {
+            cacheInv(&desc[i], sizeof(struct vring_desc));
+        }
+
+        size = (desc[i].len < len) ? desc[i].len : len;
+        if (wb) {
+            cacheWb(mapPAtoVA(desc[i].addr), size);
+        }
+        else if (!(desc[i].flags & VRING_DESC_F_WRITE)) {
+            /* Write-only buffers are only written back, once filled */
+            cacheInv(mapPAtoVA(desc[i].addr), size);
+        }
+        len -= size;
+
+        if (!(desc[i].flags & VRING_DESC_F_NEXT)) {
+            break;
+        }
+        i = desc[i].next;
+    }
+#endif
+}
+
+/*
+ * ======== availPending ========
+ */
+static inline Bool availPending(VirtQueue_Handle vq)
+{
+    cacheInv(&vq->vring.avail->idx, sizeof(UInt16));
+
+    return (vq->last_avail_idx != vq->vring.avail->idx);
+}
+
+/*
+ * ======== cacheWbUsed ========
+ * Write back 'count' used ring entries, from free-running index 'idx'.
+ */
+static inline Void cacheWbUsed(VirtQueue_Handle vq, UInt16 idx, UInt count)
+{
+    UInt first = idx % vq->vring.num;
+
+    if (first + count > vq->vring.num) {
+        cacheWb(&vq->vring.used->ring[0], (first + count - vq->vring.num) *
+                sizeof(struct vring_used_elem));
+        count = vq->vring.num - first;
+    }
+    cacheWb(&vq->vring.used->ring[first],
+            count * sizeof(struct vring_used_elem));
+}
+
+/*
+ * ======== getAvail ========
+ * Take the next available buffer, up to avail index avail_idx.  Returns
+ * its head (the token), or -1.
+ */
+static inline Int16 getAvail(VirtQueue_Handle vq, UInt16 avail_idx,
+                             Void **buf, int *len)
+{
+    struct vring_desc *desc;
+    UInt16 *entry;
+    UInt16 head;
+
+    /* There's nothing available? */
+    if (vq->last_avail_idx == avail_idx) {
+        return (-1);
+    }
+
+    /*
+     * Grab the next descriptor number they're advertising, and increment
+     * the index we've seen.
+     */
+    entry = &vq->vring.avail->ring[vq->last_avail_idx++ % vq->vring.num];
+    cacheInv(entry, sizeof(UInt16));
+    head = *entry;
+
+    cacheBuf(vq, head, ~0U, FALSE);
+    desc = headDesc(vq, head);
 
-static UInt16 hostProcId;
-static UInt16 dspProcId;
-static UInt16 sysm3ProcId;
-static UInt16 appm3ProcId;
+    *buf = mapPAtoVA(desc->addr);
+    *len = desc->len;
 
-static inline Void * mapPAtoVA(UInt pa)
-{
-    return (Void *)((pa & 0x000fffffU) | 0xa0000000U);
+    return (head);
 }
 
-static inline UInt mapVAtoPA(Void * va)
+/*
+ * ======== kickDevice ========
+ * VirtQueue_kick on the driver side: the device may have asked not to be.
+ */
+static Void kickDevice(VirtQueue_Object *vq)
 {
-    return ((UInt)va & 0x000fffffU) | 0xa9000000U;
+    VirtQueue_mb();
+    cacheInv(&vq->vring.used->flags, sizeof(UInt16));
+
+    if (vq->vring.used->flags & VRING_USED_F_NO_NOTIFY) {
+        vq->stats.kicksSuppressed++;
+        return;
+    }
+
+    InterruptM3_intSend(vq->procId, vq->id);
+    vq->stats.kicks++;
 }
 
 /*!
@@ -207,10 +1383,40 @@ static inline UInt mapVAtoPA(Void * va)
  */
 Void VirtQueue_kick(VirtQueue_Handle vq)
 {
+    UInt16 used_idx;
+    UInt16 old_idx;
+
+    if (vq->driver) {
+        kickDevice(vq);
+        return;
+    }
+
+    /* Make sure the used index is visible before checking the host's flags */
+    VirtQueue_mb();
+    cacheInv(&vq->vring.avail->flags, sizeof(UInt16));
+    cacheInv(&vring_used_event(&vq->vring), sizeof(UInt16));
+
     /* For now, simply interrupt remote processor */
-    if (vq->vring.avail->flags & VRING_AVAIL_F_NO_INTERRUPT) {
+    if (vq->eventIdx) {
+        /*
+         * Only kick if the host's used_event was crossed since last time.
+         * Atomic, as concurrent senders may kick (see
+         * VirtQueue_claimAvailBuf): each kick then checks its own range.
+         */
+        used_idx = vq->vring.used->idx;
+        old_idx = xchgU16(&vq->last_kick_used_idx, used_idx);
+        if (!vring_need_event(vring_used_event(&vq->vring), used_idx,
+                              old_idx)) {
+            Log_print0(Diags_USER1,
+                    "VirtQueue_kick: no kick because of used_event\n");
+            vq->stats.kicksSuppressed++;
+            return;
+        }
+    }
+    else if (vq->vring.avail->flags & VRING_AVAIL_F_NO_INTERRUPT) {
         Log_print0(Diags_USER1,
                 "VirtQueue_kick: no kick because of VRING_AVAIL_F_NO_INTERRUPT\n");
+        vq->stats.kicksSuppressed++;
         return;
     }
 
@@ -218,6 +1424,7 @@ Void VirtQueue_kick(VirtQueue_Handle vq)
             "VirtQueue_kick: Sending interrupt to proc %d with payload 0x%x\n",
             (IArg)vq->procId, (IArg)vq->id);
     InterruptM3_intSend(vq->procId, vq->id);
+    vq->stats.kicks++;
 }
 
 /*!
@@ -227,10 +1434,12 @@ Int VirtQueue_addUsedBuf(VirtQueue_Handle vq, Int16 head, int len)
 {
     struct vring_used_elem *used;
 
-    if ((head > vq->vring.num) || (head < 0)) {
+    if ((head >= vq->vring.num) || (head < 0)) {
         Error_raise(NULL, Error_E_generic, 0, 0);
     }
 
+    cacheBuf(vq, head, len, TRUE);
+
     /*
     * The virtqueue contains a ring of used buffers.  Get a pointer to the
     * next entry in that used ring.
@@ -238,8 +1447,45 @@ Int VirtQueue_addUsedBuf(VirtQueue_Handle vq, Int16 head, int len)
     used = &vq->vring.used->ring[vq->vring.used->idx % vq->vring.num];
     used->id = head;
     used->len = len;
+    cacheWb(used, sizeof(struct vring_used_elem));
 
+    /* The entry must be visible before the host sees the new index */
+    VirtQueue_mb();
     vq->vring.used->idx++;
+    cacheWb(&vq->vring.used->idx, sizeof(UInt16));
+    vq->stats.bufsUsed++;
+
+    return (0);
+}
+
+/*!
+ * ======== VirtQueue_addUsedBufs ========
+ */
+Int VirtQueue_addUsedBufs(VirtQueue_Handle vq, Int16 heads[], int lens[],
+                          Int count)
+{
+    struct vring_used_elem *used;
+    UInt16 idx = vq->vring.used->idx;
+    Int i;
+
+    for (i = 0; i < count; i++) {
+        if ((heads[i] >= vq->vring.num) || (heads[i] < 0)) {
+            Error_raise(NULL, Error_E_generic, 0, 0);
+        }
+
+        cacheBuf(vq, heads[i], lens[i], TRUE);
+
+        used = &vq->vring.used->ring[idx++ % vq->vring.num];
+        used->id = heads[i];
+        used->len = lens[i];
+    }
+    cacheWbUsed(vq, vq->vring.used->idx, count);
+
+    /* Publish all the entries with a single index update */
+    VirtQueue_mb();
+    vq->vring.used->idx = idx;
+    cacheWb(&vq->vring.used->idx, sizeof(UInt16));
+    vq->stats.bufsUsed += count;
 
     return (0);
 }
@@ -258,10 +1504,20 @@ Int VirtQueue_addAvailBuf(VirtQueue_Object *vq, Void *buf)
 
     vq->num_free--;
 
-    avail =  vq->vring.avail->idx++ % vq->vring.num;
+    /* Buffers are returned in order, so the ring position is a fine head */
+    avail = vq->vring.avail->idx % vq->vring.num;
 
     vq->vring.desc[avail].addr = mapVAtoPA(buf);
     vq->vring.desc[avail].len = RP_MSG_BUF_SIZE;
+    vq->vring.desc[avail].flags = 0;
+    vq->vring.avail->ring[avail] = avail;
+    cacheWb(&vq->vring.desc[avail], sizeof(struct vring_desc));
+    cacheWb(&vq->vring.avail->ring[avail], sizeof(UInt16));
+
+    /* The slave must see the buffer before the index that hands it over */
+    VirtQueue_mb();
+    vq->vring.avail->idx++;
+    cacheWb(&vq->vring.avail->idx, sizeof(UInt16));
 
     return (vq->num_free);
 }
@@ -275,12 +1531,16 @@ Void *VirtQueue_getUsedBuf(VirtQueue_Object *vq)
     Void *buf;
 
     /* There's nothing available? */
+    cacheInv(&vq->vring.used->idx, sizeof(UInt16));
     if (vq->last_used_idx == vq->vring.used->idx) {
         return (NULL);
     }
 
+    cacheInv(&vq->vring.used->ring[vq->last_used_idx % vq->vring.num],
+             sizeof(struct vring_used_elem));
     head = vq->vring.used->ring[vq->last_used_idx % vq->vring.num].id;
     vq->last_used_idx++;
+    vq->num_free++;
 
     buf = mapPAtoVA(vq->vring.desc[head].addr);
 
@@ -292,54 +1552,357 @@ Void *VirtQueue_getUsedBuf(VirtQueue_Object *vq)
  */
 Int16 VirtQueue_getAvailBuf(VirtQueue_Handle vq, Void **buf, int *len)
 {
-    UInt16 head;
+    UInt16 avail_idx;
 
-    Log_print6(Diags_USER1, "getAvailBuf vq: 0x%x %d %d %d 0x%x 0x%x\n",
-	(IArg)vq,
-        vq->last_avail_idx, vq->vring.avail->idx, vq->vring.num,
-        (IArg)&vq->vring.avail, (IArg)vq->vring.avail);
+    cacheInv(&vq->vring.avail->idx, sizeof(UInt16));
+    avail_idx = vq->vring.avail->idx;
 
-    /* There's nothing available? */
-    if (vq->last_avail_idx == vq->vring.avail->idx) {
-        /* We need to know about added buffers */
-        vq->vring.used->flags &= ~VRING_USED_F_NO_NOTIFY;
-        /* check again after setting flag */
-        if (vq->last_avail_idx == vq->vring.avail->idx)
-            return -1;
+    if (vq->last_avail_idx == avail_idx) {
+        vq->stats.noBufs++;
     }
+    notePending(vq, avail_idx - vq->last_avail_idx);
 
-    /* TODO: think of adding the NO_NOTIFY optimization later on */
-    /* vq->vring.used->flags |= VRING_USED_F_NO_NOTIFY; */
+    return (getAvail(vq, avail_idx, buf, len));
+}
 
-    /*
-     * Grab the next descriptor number they're advertising, and increment
-     * the index we've seen.
-     */
-    head = vq->vring.avail->ring[vq->last_avail_idx++ % vq->vring.num];
+/*!
+ * ======== VirtQueue_getAvailBufs ========
+ */
+Int VirtQueue_getAvailBufs(VirtQueue_Handle vq, Int16 heads[], Void *bufs[],
+                           int lens[], Int max)
+{
+    UInt16 avail_idx;
+    Int count = 0;
+
+    cacheInv(&vq->vring.avail->idx, sizeof(UInt16));
+    avail_idx = vq->vring.avail->idx;
+
+    if (vq->last_avail_idx == avail_idx) {
+        vq->stats.noBufs++;
+    }
+    notePending(vq, avail_idx - vq->last_avail_idx);
+
+    while ((count < max) &&
+           ((heads[count] = getAvail(vq, avail_idx, &bufs[count],
+                                     &lens[count])) >= 0)) {
+        count++;
+    }
+
+    return (count);
+}
+
+/*!
+ * ======== VirtQueue_claimAvailBuf ========
+ * Buffers are claimed by moving last_avail_idx with a compare-and-swap, so
+ * several senders each get their own without a lock.
+ */
+Int16 VirtQueue_claimAvailBuf(VirtQueue_Handle vq, Void **buf, int *len)
+{
+    struct vring_desc *desc;
+    UInt16 *entry;
+    UInt16 idx;
+    UInt16 head;
+
+    do {
+        idx = vq->last_avail_idx;
+
+        cacheInv(&vq->vring.avail->idx, sizeof(UInt16));
+        if (idx == vq->vring.avail->idx) {
+            vq->stats.noBufs++;
+            return (-1);
+        }
+    } while (!casU16(&vq->last_avail_idx, idx, idx + 1));
+
+    entry = &vq->vring.avail->ring[idx % vq->vring.num];
+    cacheInv(entry, sizeof(UInt16));
+    head = *entry;
+
+    vq->claims[head] = idx;
+
+    cacheBuf(vq, head, ~0U, FALSE);
+    desc = headDesc(vq, head);
 
-    *buf = mapPAtoVA(vq->vring.desc[head].addr);
-    *len = vq->vring.desc[head].len;
+    *buf = mapPAtoVA(desc->addr);
+    *len = desc->len;
 
     return (head);
 }
 
+/*!
+ * ======== VirtQueue_unclaimAvailBuf ========
+ */
+Bool VirtQueue_unclaimAvailBuf(VirtQueue_Handle vq, Int16 head)
+{
+    return (casU16(&vq->last_avail_idx, vq->claims[head] + 1,
+                   vq->claims[head]));
+}
+
+/*!
+ * ======== VirtQueue_publishUsedBuf ========
+ * A buffer claimed at avail index idx goes in used entry idx: each sender
+ * fills its own entry, marks it done, then moves the used index over all
+ * the consecutive done entries, its own or those of senders it overtook.
+ * The used index so only ever covers filled entries, in claim order, and
+ * nobody waits for a sender that was preempted: whoever finishes after it
+ * publishes its entry too.
+ */
+Void VirtQueue_publishUsedBuf(VirtQueue_Handle vq, Int16 head, int len)
+{
+    struct vring_used_elem *used;
+    UInt16 idx;
+
+    if ((head >= vq->vring.num) || (head < 0)) {
+        Error_raise(NULL, Error_E_generic, 0, 0);
+    }
+
+    idx = vq->claims[head];
+
+    cacheBuf(vq, head, len, TRUE);
+
+    used = &vq->vring.used->ring[idx % vq->vring.num];
+    used->id = head;
+    used->len = len;
+    cacheWb(used, sizeof(struct vring_used_elem));
+
+    /* The entry must be complete before anyone publishes it */
+    VirtQueue_mb();
+    vq->done[idx % vq->vring.num] = idx + 1;
+    VirtQueue_mb();
+
+    for (;;) {
+        idx = vq->vring.used->idx;
+        if (vq->done[idx % vq->vring.num] != (UInt16)(idx + 1)) {
+            break;
+        }
+        if (casU16(&vq->vring.used->idx, idx, idx + 1)) {
+            cacheWb(&vq->vring.used->idx, sizeof(UInt16));
+            vq->stats.bufsUsed++;
+        }
+    }
+}
+
+/*!
+ * ======== VirtQueue_getBufChain ========
+ */
+Int VirtQueue_getBufChain(VirtQueue_Handle vq, Int16 head,
+                          VirtQueue_Seg segs[], Int maxSegs)
+{
+    struct vring_desc *desc = vq->vring.desc;
+    UInt num = vq->vring.num;
+    UInt i = head;
+    Int count = 0;
+
+    if ((head >= vq->vring.num) || (head < 0)) {
+        Error_raise(NULL, Error_E_generic, 0, 0);
+    }
+
+    /* An indirect buffer is a chain in its own descriptor table */
+    if (desc[i].flags & VRING_DESC_F_INDIRECT) {
+        num = desc[i].len / sizeof(struct vring_desc);
+        desc = mapPAtoVA(desc[i].addr);
+        i = 0;
+    }
+
+    /* maxSegs also bounds a corrupted (looping) chain */
+    while ((count < maxSegs) && (i < num)) {
+        segs[count].buf = mapPAtoVA(desc[i].addr);
+        segs[count].len = desc[i].len;
+        count++;
+
+        if (!(desc[i].flags & VRING_DESC_F_NEXT)) {
+            break;
+        }
+        i = desc[i].next;
+    }
+
+    return (count);
+}
+
+/*!
+ * ======== VirtQueue_discardAvailBuf ========
+ */
+Void VirtQueue_discardAvailBuf(VirtQueue_Handle vq)
+{
+    vq->last_avail_idx--;
+}
+
 /*!
  * ======== VirtQueue_disableCallback ========
  */
-Void VirtQueue_disableCallback(VirtQueue_Object *vq)
+Void VirtQueue_disableCallback(VirtQueue_Handle vq)
 {
-    Log_print0(Diags_USER1, "VirtQueue_disableCallback called.");
+    if (vq->driver) {
+        /* Advise the slave not to kick us when it uses buffers */
+        vq->vring.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+        cacheDirty(vq, &vq->vring.avail->flags, sizeof(UInt16));
+        return;
+    }
+
+    /* Advise the host not to kick us when it adds buffers */
+    vq->vring.used->flags |= VRING_USED_F_NO_NOTIFY;
+
+    /* Only a hint: the host seeing it late just costs a kick */
+    cacheDirty(vq, &vq->vring.used->flags, sizeof(UInt16));
 }
 
 /*!
  * ======== VirtQueue_enableCallback ========
  */
-Bool VirtQueue_enableCallback(VirtQueue_Object *vq)
+Bool VirtQueue_enableCallback(VirtQueue_Handle vq)
 {
-    Log_print0(Diags_USER1, "VirtQueue_enableCallback called.");
+    if (vq->driver) {
+        vq->vring.avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+        cacheWb(&vq->vring.avail->flags, sizeof(UInt16));
+        VirtQueue_mb();
+
+        /* As VirtQueue_getUsedBuf, whether a used buffer is waiting */
+        cacheInv(&vq->vring.used->idx, sizeof(UInt16));
+        return (vq->last_used_idx == vq->vring.used->idx);
+    }
 
-    //TODO
-    return (FALSE);
+    vq->vring.used->flags &= ~VRING_USED_F_NO_NOTIFY;
+    cacheWb(&vq->vring.used->flags, sizeof(UInt16));
+    if (vq->eventIdx) {
+        /* Kick us for the next buffer the host adds */
+        vring_avail_event(&vq->vring) = vq->last_avail_idx;
+        cacheWb(&vring_avail_event(&vq->vring), sizeof(UInt16));
+    }
+
+    /*
+     * The host may have added a buffer just before it saw the flag change,
+     * without kicking us: check again once the flag is visible.
+     */
+    VirtQueue_mb();
+
+    return (!availPending(vq));
+}
+
+/*
+ * ======== initRing ========
+ * Returns FALSE if out of memory for the bookkeeping of its buffers.
+ */
+static Bool initRing(VirtQueue_Object *vq, Void *vring_phys, UInt num,
+                     UInt align)
+{
+    Error_Block eb;
+
+    Error_init(&eb);
+
+    if (vq->paddedIdx) {
+        vring_init_padded(&(vq->vring), num, vring_phys, align);
+    }
+    else {
+        vring_init(&(vq->vring), num, vring_phys, align);
+    }
+
+    /* Only the driver reads used buffers: from the start of the vring */
+    vq->last_used_idx = 0;
+    vq->last_kick_used_idx = vq->vring.used->idx;
+
+    vq->claims = Memory_alloc(NULL, num * sizeof(UInt16), 0, &eb);
+    vq->done = Memory_calloc(NULL, num * sizeof(UInt16), 0, &eb);
+
+    return ((vq->claims != NULL) && (vq->done != NULL));
+}
+
+/*
+ * ======== freeRing ========
+ * Undo initRing.
+ */
+static Void freeRing(VirtQueue_Object *vq)
+{
+    if (vq->claims) {
+        Memory_free(NULL, vq->claims, vq->vring.num * sizeof(UInt16));
+    }
+    if (vq->done) {
+        Memory_free(NULL, (Ptr)vq->done, vq->vring.num * sizeof(UInt16));
+    }
+}
+
+#endif /* VIRTIO_RING_PACKED */
+
+/*!
+ * ======== VirtQueue_setPollBudget ========
+ */
+Void VirtQueue_setPollBudget(VirtQueue_Handle vq, UInt spins)
+{
+    vq->pollBudget = spins;
+    vq->pollMisses = 0;
+}
+
+/*!
+ * ======== VirtQueue_poll ========
+ */
+Bool VirtQueue_poll(VirtQueue_Handle vq)
+{
+    UInt spins;
+
+    if (vq->pollBudget == 0) {
+        return (FALSE);
+    }
+
+    if (vq->pollMisses >= POLL_MISS_LIMIT) {
+        /* Buffers come too far apart for spinning to pay: try now and then */
+        if (++vq->pollMisses < POLL_MISS_LIMIT + POLL_RETRY) {
+            return (FALSE);
+        }
+        vq->pollMisses = POLL_MISS_LIMIT - 1;
+    }
+
+    /* No kicks while we are looking anyway */
+    VirtQueue_disableCallback(vq);
+
+    for (spins = 0; spins < vq->pollBudget; spins++) {
+        if (availPending(vq)) {
+            vq->pollMisses = 0;
+            return (TRUE);
+        }
+    }
+
+    vq->pollMisses++;
+    vq->stats.emptyPolls++;
+
+    return (!VirtQueue_enableCallback(vq));
+}
+
+/*!
+ * ======== VirtQueue_getStats ========
+ */
+Void VirtQueue_getStats(VirtQueue_Handle vq, VirtQueue_Stats *stats)
+{
+    UInt key = Hwi_disable();
+
+    /* VirtQueue_isr counts too: copy a consistent snapshot */
+    *stats = vq->stats;
+    Hwi_restore(key);
+}
+
+/*!
+ * ======== VirtQueue_resetStats ========
+ */
+Void VirtQueue_resetStats(VirtQueue_Handle vq)
+{
+    UInt key = Hwi_disable();
+
+    memset(&vq->stats, 0, sizeof(VirtQueue_Stats));
+    Hwi_restore(key);
+}
+
+/*!
+ * ======== VirtQueue_dumpStats ========
+ */
+Void VirtQueue_dumpStats(VirtQueue_Handle vq)
+{
+    VirtQueue_Stats stats;
+
+    VirtQueue_getStats(vq, &stats);
+
+    System_printf("vring %d: num %d, kicks %d (%d suppressed), "
+            "interrupts %d\n", vq->id, vq->vring.num, stats.kicks,
+            stats.kicksSuppressed, stats.interrupts);
+    System_printf("vring %d: bufs used %d, no bufs %d, empty polls %d, "
+            "max pending %d\n", vq->id, stats.bufsUsed, stats.noBufs,
+            stats.emptyPolls, stats.maxPending);
 }
 
 /*!
@@ -370,6 +1933,7 @@ Void VirtQueue_isr(UArg msg)
                 return;
 
             case (UInt)RP_MSG_FLUSH_CACHE:
+                /* The host may want anything of ours in memory: all of it */
                 Cache_wbAll();
                 return;
 
@@ -397,11 +1961,17 @@ Void VirtQueue_isr(UArg msg)
     if (MultiProc_self() == sysm3ProcId && (msg == ID_A9_TO_APPM3 || msg == ID_APPM3_TO_A9)) {
         InterruptM3_intSend(appm3ProcId, (UInt)msg);
     }
-    else {
-        vq = queueRegistry[msg];
-        if (vq) {
-            vq->callback(vq);
+    else if (msg <= MAX_NOTIFY_ID && queueSlot[msg]) {
+        vq = queueRegistry[queueSlot[msg] - 1];
+        vq->stats.interrupts++;
+        if (vq->driver && (vq->sync->gen != vq->sync->req)) {
+            /* CORE1 asks whether we laid the vring out: we did */
+            vq->sync->gen = vq->sync->req;
         }
+        vq->callback(vq);
+    }
+    else {
+        Log_print1(Diags_USER1, "VirtQueue_isr: no VirtQueue %d\n", msg);
     }
 }
 
@@ -413,7 +1983,13 @@ VirtQueue_Object *VirtQueue_create(VirtQueue_callback callback,
         UInt16 remoteProcId, int vqid)
 {
     VirtQueue_Object *vq;
-    void *vring_phys;
+    void *vring_phys = NULL;
+    struct fw_rsc_vdev *vdev;
+    struct fw_rsc_vdev_vring *rscVring;
+    UInt num = RP_MSG_NUM_BUFS;
+    UInt align = RP_MSG_VRING_ALIGN;
+    UInt size;
+    UInt paddedSize;
     Error_Block eb;
 
     Error_init(&eb);
@@ -427,13 +2003,28 @@ VirtQueue_Object *VirtQueue_create(VirtQueue_callback callback,
     vq->id = vqid;
     vq->procId = remoteProcId;
     vq->last_avail_idx = 0;
-
-    if (MultiProc_self() == appm3ProcId) {
+    vq->pollBudget = 0;
+    vq->pollMisses = 0;
+    vq->dirtyStart = ~0U;
+    vq->dirtyEnd = 0;
+    vq->driver = FALSE;
+    vq->sync = NULL;
+    memset(&vq->stats, 0, sizeof(VirtQueue_Stats));
+
+    /* Both cores use the same ids for the vrings between them */
+    if ((MultiProc_self() == appm3ProcId) && !isCoreVring(vqid)) {
         /* vqindices that belong to AppM3 should be big so they don't
 	 * collide with SysM3's virtqueues */
         vq->id += 200;
     }
 
+    if ((vq->id > MAX_NOTIFY_ID) || queueSlot[vq->id] ||
+        (numQueues == NUM_QUEUES)) {
+        Log_print1(Diags_USER1, "vring: %d can't be registered\n", vq->id);
+        Memory_free(NULL, vq, sizeof(VirtQueue_Object));
+        return (NULL);
+    }
+
     switch (vq->id) {
 	/* sysm3 rpmsg vrings */
         case ID_SYSM3_TO_A9:
@@ -458,19 +2049,199 @@ VirtQueue_Object *VirtQueue_create(VirtQueue_callback callback,
         case ID_A9_TO_APPM3:
             vring_phys = (struct vring *) IPU_MEM_VRING3;
             break;
+
+	/* CORE0 <-> CORE1 vrings */
+        case ID_CORE1_TO_CORE0:
+            vring_phys = (struct vring *) CORE_VRING0;
+            num = CORE_VRING_NUM;
+            break;
+        case ID_CORE0_TO_CORE1:
+            vring_phys = (struct vring *) CORE_VRING1;
+            num = CORE_VRING_NUM;
+            break;
+    }
+
+    /* The resource table, if any, has the final say on the geometry */
+    vdev = findVdev(vq->id, &rscVring);
+    if (vdev) {
+        vring_phys = (Void *)rscVring->da;
+        num = rscVring->num;
+        align = rscVring->align;
+    }
+
+    if (vring_phys == NULL) {
+        Log_print1(Diags_USER1, "vring: %d unknown\n", vq->id);
+        Memory_free(NULL, vq, sizeof(VirtQueue_Object));
+        return (NULL);
+    }
+
+    if ((num == 0) || (num > RP_MSG_MAX_NUM_BUFS) || (num & (num - 1))) {
+        Log_print2(Diags_USER1, "vring: %d bad size %d\n", vq->id, num);
+        Memory_free(NULL, vq, sizeof(VirtQueue_Object));
+        return (NULL);
+    }
+
+    /* Use event indices if we offered them and the host acknowledged */
+    vq->eventIdx = FALSE;
+    if (vdev && (vdev->dfeatures & vdev->gfeatures &
+                 (1 << VIRTIO_RING_F_EVENT_IDX))) {
+        vq->eventIdx = TRUE;
     }
 
-    Log_print3(Diags_USER1,
-            "vring: %d 0x%x (0x%x)\n", vq->id, (IArg)vring_phys,
-            RP_MSG_RING_SIZE);
+    /*
+     * Likewise the padded layout, which must fit where the standard one
+     * does.  Its feature bit only means that for an rpmsg vdev.
+     */
+    vq->paddedIdx = FALSE;
+    if (vdev && (vdev->id == VIRTIO_ID_RPMSG) &&
+        (vdev->dfeatures & vdev->gfeatures &
+         (1 << VIRTIO_RPMSG_F_PADDED_IDX))) {
+        vq->paddedIdx = TRUE;
+#if defined(VIRTIO_RING_PACKED)
+        size = vring_packed_size(num);
+        paddedSize = vring_packed_size_padded(num);
+#else
+        size = vring_size(num, align);
+        paddedSize = vring_size_padded(num, align);
+#endif
+        if (paddedSize > ((size + VRING_PAGE_SIZE - 1) & ~(VRING_PAGE_SIZE - 1))) {
+            Log_print2(Diags_USER1, "vring: %d padded size 0x%x too big\n",
+                    vq->id, paddedSize);
+            Memory_free(NULL, vq, sizeof(VirtQueue_Object));
+            return (NULL);
+        }
+    }
+
+#if defined(VIRTIO_RING_PACKED)
+    Log_print5(Diags_USER1, "vring: %d 0x%x num %d (0x%x)%s\n", vq->id,
+            (IArg)vring_phys, num, vq->paddedIdx ?
+            vring_packed_size_padded(num) : vring_packed_size(num),
+            (IArg)(vq->paddedIdx ? " padded" : ""));
+#else
+    Log_print5(Diags_USER1, "vring: %d 0x%x num %d (0x%x)%s\n", vq->id,
+            (IArg)vring_phys, num, vq->paddedIdx ?
+            vring_size_padded(num, align) : vring_size(num, align),
+            (IArg)(vq->paddedIdx ? " padded" : ""));
+#endif
+
+    if (isCoreVring(vq->id)) {
+        if (!coreLinkReserved()) {
+            Log_print1(Diags_USER1, "vring: %d not in resource table\n",
+                    vq->id);
+            Memory_free(NULL, vq, sizeof(VirtQueue_Object));
+            return (NULL);
+        }
+
+        vq->sync = (VirtQueue_CoreSync *)CORE_VRING_SYNC +
+                (vq->id - ID_CORE1_TO_CORE0);
+        if (MultiProc_self() == sysm3ProcId) {
+            /* Lay the vring out afresh, and drive it as the host would */
+            vq->driver = TRUE;
+            vq->sync->gen = 0;
+            VirtQueue_mb();
+#if defined(VIRTIO_RING_PACKED)
+            memset(vring_phys, 0, vring_packed_size(num));
+#else
+            memset(vring_phys, 0, vring_size(num, align));
+#endif
+        }
+        else if (!coreRequest(vq)) {
+            Log_print1(Diags_USER1, "vring: %d not laid out by CORE0\n",
+                    vq->id);
+            Memory_free(NULL, vq, sizeof(VirtQueue_Object));
+            return (NULL);
+        }
+    }
+
+    if (!initRing(vq, vring_phys, num, align)) {
+        Log_print1(Diags_USER1, "vring: %d out of memory\n", vq->id);
+        freeRing(vq);
+        Memory_free(NULL, vq, sizeof(VirtQueue_Object));
+        return (NULL);
+    }
 
-    vring_init(&(vq->vring), RP_MSG_NUM_BUFS, vring_phys, RP_MSG_VRING_ALIGN);
+    if (vq->driver) {
+        vq->num_free = num;
+    }
 
-    queueRegistry[vq->id] = vq;
+    /* Registered last, so VirtQueue_isr never sees a half-made VirtQueue */
+    queueRegistry[numQueues] = vq;
+    queueSlot[vq->id] = ++numQueues;
+
+    if (vq->driver) {
+        /*
+         * CORE1 may use the vring from now on.  A request it made before
+         * was registered is answered here, any later one in VirtQueue_isr.
+         */
+        VirtQueue_mb();
+        vq->sync->gen = vq->sync->req;
+    }
 
     return (vq);
 }
 
+/*!
+ * ======== VirtQueue_findVrings ========
+ */
+Int VirtQueue_findVrings(UInt32 devId, UInt index, UInt num)
+{
+    struct fw_rsc_vdev *vdev;
+    UInt first = 0;
+    UInt i;
+
+    /* AppM3's vring ids are not resource table positions */
+    if ((rscTable == NULL) || (MultiProc_self() == appm3ProcId)) {
+        return (-1);
+    }
+
+    for (i = 0; i < rscTable->num; i++) {
+        vdev = (struct fw_rsc_vdev *)((Char *)rscTable + rscTable->offset[i]);
+        if (vdev->type != TYPE_VDEV) {
+            continue;
+        }
+
+        if ((vdev->id == devId) && (index-- == 0)) {
+            return ((vdev->num_of_vrings >= num) ? first : -1);
+        }
+        first += vdev->num_of_vrings;
+    }
+
+    return (-1);
+}
+
+/*!
+ * ======== VirtQueue_setResourceTable ========
+ */
+Void VirtQueue_setResourceTable(Ptr table)
+{
+    struct fw_rsc_trace *trace;
+    UInt i;
+
+    rscTable = (struct fw_rsc_table_hdr *)table;
+
+    if (rscTable) {
+        initXlate();
+
+        for (i = 0; i < rscTable->num; i++) {
+            trace = (struct fw_rsc_trace *)((Char *)rscTable +
+                                            rscTable->offset[i]);
+            if (trace->type == TYPE_TRACE) {
+                VirtQueue_setTraceBuf((Ptr)trace->da, trace->len);
+                break;
+            }
+        }
+    }
+}
+
+/*!
+ * ======== VirtQueue_setTraceBuf ========
+ */
+Void VirtQueue_setTraceBuf(Ptr buf, SizeT len)
+{
+    traceBuf = buf;
+    traceLen = len;
+}
+
 /*!
  * ======== VirtQueue_startup ========
  */
@@ -511,17 +2282,42 @@ Void postCrashToMailbox(Error_Block * eb)
 /*!
  * ======== VirtQueue_cacheWb ========
  *
- * Used for flushing SysMin trace buffer.
+ * Used for flushing SysMin trace buffer, and what VirtQueue left dirty
+ * (see cacheDirty).  Only those ranges are written back: a whole cache
+ * write-back stalls the M3 and evicts what it is working on.  Without a
+ * trace buffer (see VirtQueue_setTraceBuf), no trace is written back.
  */
 Void VirtQueue_cacheWb()
 {
-    static UInt32 oldticks;
+    static UInt32 oldticks = 0;
+    VirtQueue_Object *vq;
+    UArg start;
+    UArg end;
+    UInt key;
+    UInt i;
+
+    for (i = 0; i < numQueues; i++) {
+        vq = queueRegistry[i];
+
+        key = Hwi_disable();
+        start = vq->dirtyStart;
+        end = vq->dirtyEnd;
+        vq->dirtyStart = ~0U;
+        vq->dirtyEnd = 0;
+        Hwi_restore(key);
+
+        if (start < end) {
+            Cache_wb((Ptr)start, end - start, Cache_Type_ALL, TRUE);
+        }
+    }
 
-    if (Clock_getTicks() >= (oldticks + CACHE_WB_TICK_PERIOD)) {
+    if (Clock_getTicks() - oldticks < CACHE_WB_TICK_PERIOD) {
         /* Don't keep flushing cache */
         return;
     }
+    oldticks = Clock_getTicks();
 
-    /* Flush the cache */
-    Cache_wbAll();
+    if (traceBuf != NULL) {
+        Cache_wb(traceBuf, traceLen, Cache_Type_ALL, TRUE);
+    }
 }
@@ -106,9 +106,48 @@ typedef struct VirtQueue_Object *VirtQueue_Handle;
  */
 typedef Void (*VirtQueue_callback)(VirtQueue_Handle);
 
+/*!
+ *  @brief  One segment of a buffer chained over several descriptors.
+ *
+ *  @sa     VirtQueue_getBufChain
+ */
+typedef struct VirtQueue_Seg {
+    Void    *buf;       /*!< Segment address */
+    int     len;        /*!< Segment length in bytes */
+} VirtQueue_Seg;
+
+/*!
+ *  @brief  Counters of a VirtQueue, since its creation or last reset.
+ *
+ *  On the VirtQueue a slave takes its send buffers from (e.g.
+ *  ID_SYSM3_TO_A9), noBufs counts sends that found the vring full.  On the
+ *  one it receives on, noBufs counts drains that ended on an empty vring,
+ *  and maxPending is the deepest backlog of messages: near the vring size,
+ *  the vring is too small for the traffic.  With the packed ring layout,
+ *  maxPending is the most buffers taken at once.
+ *
+ *  @sa     VirtQueue_getStats
+ */
+typedef struct VirtQueue_Stats {
+    UInt32  kicks;              /*!< Interrupts sent to the other side */
+    UInt32  kicksSuppressed;    /*!< Kicks the other side did not want */
+    UInt32  interrupts;         /*!< Interrupts received for this vring */
+    UInt32  emptyPolls;         /*!< VirtQueue_poll() calls in vain */
+    UInt32  bufsUsed;           /*!< Buffers given back (add_used_buf) */
+    UInt32  noBufs;             /*!< get_avail_buf calls finding none */
+    UInt16  maxPending;         /*!< Most buffers seen waiting at once */
+} VirtQueue_Stats;
+
 /*!
  *  @brief      Initialize at runtime the VirtQueue
  *
+ *  For #ID_CORE1_TO_CORE0 and #ID_CORE0_TO_CORE1, the vrings between the
+ *  two M3 cores, CORE0 is the driver side (see VirtQueue_addAvailBuf) and
+ *  lays out the vring.  Creating it on CORE1 waits, by polling, for CORE0
+ *  to have done so in this boot, and fails if it does not in time.  They are
+ *  in the memory of the IPU_MEM_CORELINK devmem entry of the resource table
+ *  (see rsc_table.h): with a resource table lacking it, creating them fails.
+ *
  *  @param[in]  callback  the clients callback function.
  *  @param[in]  procId    Processor ID associated with this VirtQueue.
  *
@@ -128,6 +167,144 @@ VirtQueue_Handle VirtQueue_create(VirtQueue_callback callback, UInt16 procId, in
  */
 Void VirtQueue_kick(VirtQueue_Handle vq);
 
+/*!
+ *  @brief      Disable the callback (interrupt) for new buffers.
+ *
+ *  Advises the other side, through the shared vring flags, that it need not
+ *  interrupt us when it adds buffers.  This is an optimization only: a
+ *  callback may still occur.  On the driver side (see
+ *  VirtQueue_addAvailBuf), this and VirtQueue_enableCallback() are about
+ *  the buffers the other side returns instead.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *
+ *  @sa         VirtQueue_enableCallback
+ */
+Void VirtQueue_disableCallback(VirtQueue_Handle vq);
+
+/*!
+ *  @brief      Re-enable the callback (interrupt) for new buffers.
+ *
+ *  Buffers added by the other side while the callback was disabled do not
+ *  generate an interrupt, so the caller must process the queue again if
+ *  this returns FALSE.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *
+ *  @return     TRUE if the queue is empty and the callback is armed;
+ *              FALSE if buffers arrived and must be processed first.
+ *
+ *  @sa         VirtQueue_disableCallback
+ */
+Bool VirtQueue_enableCallback(VirtQueue_Handle vq);
+
+/*!
+ *  @brief      Set how long VirtQueue_poll() spins for new buffers.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *  @param[in]  spins     checks of the vring per poll; 0 (the default)
+ *                        disables polling.
+ *
+ *  @sa         VirtQueue_poll
+ */
+Void VirtQueue_setPollBudget(VirtQueue_Handle vq, UInt spins);
+
+/*!
+ *  @brief      Spin for new buffers, rather than wait for the callback.
+ *
+ *  Meant for a receiver about to block: when the host sends again soon,
+ *  spinning saves the kick's interrupt and callback latency.  After too
+ *  many polls in vain, polling stops but for an occasional try, until
+ *  buffers come close enough together again.
+ *
+ *  The callback is disabled while spinning.  It stays disabled when
+ *  buffers arrived, to be re-enabled as usual once they are processed.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *
+ *  @return     TRUE if buffers are available, FALSE if the budget ran out
+ *              (or polling is off) and the callback is armed.
+ *
+ *  @sa         VirtQueue_setPollBudget, VirtQueue_enableCallback
+ */
+Bool VirtQueue_poll(VirtQueue_Handle vq);
+
+/*!
+ *  @brief      Get a snapshot of the counters of a VirtQueue.
+ *
+ *  Counting is always on and costs an increment or a compare per call, so
+ *  it can stay on in production builds, unlike Log_print tracing.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *  @param[out] stats     the counters.
+ *
+ *  @sa         VirtQueue_resetStats, VirtQueue_dumpStats
+ */
+Void VirtQueue_getStats(VirtQueue_Handle vq, VirtQueue_Stats *stats);
+
+/*!
+ *  @brief      Zero the counters of a VirtQueue.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ */
+Void VirtQueue_resetStats(VirtQueue_Handle vq);
+
+/*!
+ *  @brief      Print the counters of a VirtQueue with System_printf().
+ *
+ *  @param[in]  vq        the VirtQueue.
+ */
+Void VirtQueue_dumpStats(VirtQueue_Handle vq);
+
+/*!
+ *  @brief      Provide the resource table of this image.
+ *
+ *  VirtQueue_create() uses it to find the virtio features the host
+ *  acknowledged for each vring's vdev (e.g. VIRTIO_RING_F_EVENT_IDX, or
+ *  VIRTIO_RPMSG_F_PADDED_IDX for the cache line padded vring layout).
+ *  Without a resource table, no optional features are used.
+ *
+ *  The carveout and devmem entries, as the host loader filled them in,
+ *  also give the translation of host physical addresses in the vrings.
+ *  Without them, only the 1MB IPC window at 0xA0000000 is known.
+ *
+ *  Its trace entry, if any, is the trace buffer VirtQueue_cacheWb()
+ *  writes back (see VirtQueue_setTraceBuf()).
+ *
+ *  Should be called before VirtQueue_create().
+ *
+ *  @param[in]  table     the resource table (see rsc_table.h).
+ */
+Void VirtQueue_setResourceTable(Ptr table);
+
+/*!
+ *  @brief      Set the trace buffer VirtQueue_cacheWb() writes back.
+ *
+ *  For an image without a resource table, e.g. CORE1, whose SysMin
+ *  buffer the host still reads.  Overrides the trace entry of the
+ *  resource table, so call it after VirtQueue_setResourceTable().
+ *
+ *  @param[in]  buf       the trace buffer, or NULL for none.
+ *  @param[in]  len       its size in bytes.
+ */
+Void VirtQueue_setTraceBuf(Ptr buf, SizeT len);
+
+/*!
+ *  @brief      Find the vrings of a vdev in the resource table.
+ *
+ *  E.g. to find the vring pairs of additional rpmsg vdevs: vring ids are
+ *  positions in the resource table, counting the vrings of all vdevs in
+ *  order, and are what VirtQueue_create() takes.
+ *
+ *  @param[in]  devId     virtio device id (e.g. VIRTIO_ID_RPMSG).
+ *  @param[in]  index     which of the vdevs with that id, from 0.
+ *  @param[in]  num       number of vrings it must have.
+ *
+ *  @return     Id of its first vring, or -1 if there is no such vdev (or
+ *              no resource table).
+ */
+Int VirtQueue_findVrings(UInt32 devId, UInt index, UInt num);
+
 /*!
  *  @brief       Used at startup-time for initialization
  *
@@ -146,6 +323,9 @@ Void VirtQueue_startup();
  *  @brief      Add available buffer to virtqueue's available buffer list.
  *              Only used by Host.
  *
+ *  Also used by CORE0, the driver side of the vrings to CORE1.  Buffers
+ *  must come back in the order they were added, as the Slave returns them.
+ *
  *  @param[in]  vq        the VirtQueue.
  *  @param[in]  buf      the buffer to be processed by the slave.
  *
@@ -201,12 +381,145 @@ Int16 VirtQueue_getAvailBuf(VirtQueue_Handle vq, Void **buf, int *len);
  */
 Int VirtQueue_addUsedBuf(VirtQueue_Handle vq, Int16 token, int len);
 
+/*!
+ *  @brief      Get up to max available buffers at once.
+ *              Only used by Slave.
+ *
+ *  The host's avail index is read only once for the whole batch.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *  @param[out] tokens    tokens of the buffers, for VirtQueue_addUsedBufs();
+ *  @param[out] bufs      buffer addresses;
+ *  @param[out] lens      buffer lengths;
+ *  @param[in]  max       capacity of the three arrays.
+ *
+ *  @return     Number of buffers returned (0 if none are available).
+ *
+ *  @sa         VirtQueue_addUsedBufs
+ */
+Int VirtQueue_getAvailBufs(VirtQueue_Handle vq, Int16 tokens[], Void *bufs[],
+                           int lens[], Int max);
+
+/*!
+ *  @brief      Add several used buffers to virtqueue's used buffer list.
+ *              Only used by Slave.
+ *
+ *  All entries are written first and then published with a single update
+ *  of the used index, so a batch costs one barrier and one index write.
+ *  As with VirtQueue_addUsedBuf(), call VirtQueue_kick() once afterwards.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *  @param[in]  tokens    tokens of the buffers to be added to vring used list.
+ *  @param[in]  lens      number of bytes used in each buffer.
+ *  @param[in]  count     number of buffers.
+ *
+ *  @return     Remaining capacity of queue or a negative error.
+ *
+ *  @sa         VirtQueue_getAvailBufs
+ */
+Int VirtQueue_addUsedBufs(VirtQueue_Handle vq, Int16 tokens[], int lens[],
+                          Int count);
+
+/*!
+ *  @brief      Get all the segments of an available buffer.
+ *              Only used by Slave.
+ *
+ *  VirtQueue_getAvailBuf() and VirtQueue_getAvailBufs() only return the
+ *  first segment of a buffer.  If the host chained several descriptors
+ *  (VRING_DESC_F_NEXT), or used an indirect descriptor table
+ *  (VRING_DESC_F_INDIRECT), this returns every segment, in order.  The
+ *  buffer is still returned to the host with a single token.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *  @param[in]  token     token returned by VirtQueue_getAvailBuf().
+ *  @param[out] segs      segments of the buffer;
+ *  @param[in]  maxSegs   capacity of segs; longer chains are truncated.
+ *
+ *  @return     Number of segments returned.
+ *
+ *  @sa         VirtQueue_getAvailBuf
+ */
+Int VirtQueue_getBufChain(VirtQueue_Handle vq, Int16 token,
+                          VirtQueue_Seg segs[], Int maxSegs);
+
+/*!
+ *  @brief      Give back the last buffer got from VirtQueue_getAvailBuf().
+ *              Only used by Slave.
+ *
+ *  The buffer becomes available again, untouched, e.g. when it turned out
+ *  to be too small.  Must follow VirtQueue_getAvailBuf() without any other
+ *  access to vq in between.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *
+ *  @sa         VirtQueue_getAvailBuf
+ */
+Void VirtQueue_discardAvailBuf(VirtQueue_Handle vq);
+
+/*!
+ *  @brief      Claim the next available buffer, concurrently with others.
+ *              Only used by Slave.
+ *
+ *  Like VirtQueue_getAvailBuf(), but several threads may claim, fill and
+ *  publish buffers of the same VirtQueue at once, without a lock: e.g.
+ *  tasks sending to the host.  A VirtQueue is used either with these
+ *  calls or with VirtQueue_getAvailBuf()/VirtQueue_addUsedBuf(), not both.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *  @param[out] buf       Pointer to location of available buffer;
+ *  @param[out] len       Length of the buffer.
+ *
+ *  @return     Token of the buffer, for VirtQueue_publishUsedBuf(), or a
+ *              negative value if no buffer is available.
+ *
+ *  @sa         VirtQueue_publishUsedBuf, VirtQueue_unclaimAvailBuf
+ */
+Int16 VirtQueue_claimAvailBuf(VirtQueue_Handle vq, Void **buf, int *len);
+
+/*!
+ *  @brief      Give back a claimed buffer, untouched.
+ *              Only used by Slave.
+ *
+ *  Only possible as long as no other buffer was claimed since.  Otherwise
+ *  the buffer must be published (e.g. with an empty message), so as not
+ *  to hold up the buffers claimed after it.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *  @param[in]  token     token returned by VirtQueue_claimAvailBuf().
+ *
+ *  @return     TRUE if the buffer was given back.
+ *
+ *  @sa         VirtQueue_claimAvailBuf
+ */
+Bool VirtQueue_unclaimAvailBuf(VirtQueue_Handle vq, Int16 token);
+
+/*!
+ *  @brief      Return a claimed buffer to the host.
+ *              Only used by Slave.
+ *
+ *  Buffers reach the host in the order they were claimed: one published
+ *  before those claimed ahead of it waits for them, but the caller does
+ *  not; whoever publishes the last one of them publishes them all.  As
+ *  with VirtQueue_addUsedBuf(), call VirtQueue_kick() afterwards.
+ *
+ *  @param[in]  vq        the VirtQueue.
+ *  @param[in]  token     token returned by VirtQueue_claimAvailBuf().
+ *  @param[in]  len       number of bytes used in the buffer.
+ *
+ *  @sa         VirtQueue_claimAvailBuf
+ */
+Void VirtQueue_publishUsedBuf(VirtQueue_Handle vq, Int16 token, int len);
+
 #define ID_SYSM3_TO_A9      0
 #define ID_A9_TO_SYSM3      1
 
 #define CONSOLE_SYSM3_TO_A9 2
 #define CONSOLE_A9_TO_SYSM3 3
 
+/* Between CORE0 and CORE1, bypassing the host; CORE0 drives both vrings */
+#define ID_CORE1_TO_CORE0   100
+#define ID_CORE0_TO_CORE1   101
+
 #define RP_MSG_BUF_SIZE     (512)
 
 #if defined (__cplusplus)
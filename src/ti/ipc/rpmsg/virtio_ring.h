@@ -37,6 +37,8 @@
 #define VRING_DESC_F_NEXT   1
 /* This marks a buffer as write-only (otherwise read-only). */
 #define VRING_DESC_F_WRITE  2
+/* This means the buffer contains a list of buffer descriptors. */
+#define VRING_DESC_F_INDIRECT  4
 
 /* The Host uses this in used->flags to advise the Guest: don't kick me when
  * you add a buffer.  It's unreliable, so it's simply an optimization.  Guest
@@ -47,6 +49,21 @@
  * optimization.  */
 #define VRING_AVAIL_F_NO_INTERRUPT  1
 
+/* We support indirect buffer descriptors */
+#define VIRTIO_RING_F_INDIRECT_DESC 28
+
+/* The Guest publishes the used index for which it expects an interrupt
+ * at the end of the avail ring. Host should ignore the avail->flags field. */
+/* The Host publishes the avail index for which it expects a kick
+ * at the end of the used ring. Guest should ignore the used->flags field. */
+#define VIRTIO_RING_F_EVENT_IDX     29
+
+/* Cache line size assumed by VIRTIO_RPMSG_F_PADDED_IDX; both sides must
+ * agree on it, so it is the largest line of either (A9 and M3 use 32). */
+#ifndef VRING_CACHE_LINE
+#define VRING_CACHE_LINE            64
+#endif
+
 /* Virtio ring descriptors: 16 bytes.  These can chain together via "next". */
 struct vring_desc
 {
@@ -57,7 +74,7 @@ struct vring_desc
 
     /* Length. */
     UInt32 len;
-    /* The flags as indicated above. */  //Optional for now!
+    /* The flags as indicated above. */
     UInt16 flags;
     /* We chain unused descriptors via this, too */
     UInt16 next;
@@ -67,7 +84,8 @@ struct vring_avail
 {
     UInt16 flags;
     UInt16 idx;
-    UInt16 ring[256];
+    UInt16 ring[];
+    /* Only if VIRTIO_RING_F_EVENT_IDX: UInt16 used_event; */
 };
 
 /* u32 is used here for ids for padding reasons. */
@@ -83,7 +101,8 @@ struct vring_used
 {
     UInt16 flags;
     UInt16 idx;
-    struct vring_used_elem ring[256];
+    struct vring_used_elem ring[];
+    /* Only if VIRTIO_RING_F_EVENT_IDX: UInt16 avail_event; */
 };
 
 struct vring {
@@ -94,6 +113,11 @@ struct vring {
     struct vring_avail *avail;
 
     struct vring_used *used;
+
+    /* Only if VIRTIO_RING_F_EVENT_IDX; see vring_used/avail_event */
+    UInt16 *used_event;
+
+    UInt16 *avail_event;
 };
 
 /*
@@ -115,6 +139,7 @@ struct vring {
  *    UInt16 avail_flags;
  *    UInt16 avail_idx;
  *    UInt16 available[num];
+ *    UInt16 used_event_idx;
  *
  *    // Padding to the next page boundary.
  *    char pad[];
@@ -123,8 +148,14 @@ struct vring {
  *    UInt16 used_flags;
  *    UInt16 used_idx;
  *    struct vring_used_elem used[num];
+ *    UInt16 avail_event_idx;
  * };
  */
+/* We publish the used event index at the end of the available ring, and vice
+ * versa. They are at the end for backwards compatibility. */
+#define vring_used_event(vr) (*(vr)->used_event)
+#define vring_avail_event(vr) (*(vr)->avail_event)
+
 static inline void vring_init(struct vring *vr, unsigned int num, void *p,
                               unsigned long pagesize)
 {
@@ -132,15 +163,200 @@ static inline void vring_init(struct vring *vr, unsigned int num, void *p,
     vr->desc = p;
     vr->avail = (struct vring_avail *)
                     ((unsigned)p + (num * sizeof(struct vring_desc)));
-    vr->used = (void *)(((unsigned long)&vr->avail->ring[num] + pagesize-1)
-                & ~(pagesize - 1));
+    vr->used = (void *)(((unsigned long)&vr->avail->ring[num] + sizeof(UInt16)
+                + pagesize-1) & ~(pagesize - 1));
+    vr->used_event = &vr->avail->ring[num];
+    vr->avail_event = (UInt16 *)&vr->used->ring[num];
 }
 
 static inline unsigned vring_size(unsigned int num, unsigned long pagesize)
 {
-    return ((sizeof(struct vring_desc) * num + sizeof(UInt16) * (2 + num)
+    return ((sizeof(struct vring_desc) * num + sizeof(UInt16) * (3 + num)
                 + pagesize - 1) & ~(pagesize - 1))
-                + sizeof(UInt16) * 2 + sizeof(struct vring_used_elem) * num;
+                + sizeof(UInt16) * 3 + sizeof(struct vring_used_elem) * num;
+}
+
+/*
+ * The VIRTIO_RPMSG_F_PADDED_IDX layout: as the standard one, but
+ *
+ *    // The actual descriptors (16 bytes each), from a cache line boundary
+ *    struct vring_desc desc[num];
+ *
+ *    // Written by the Guest: its header ends a cache line of its own
+ *    char pad[VRING_CACHE_LINE - 4];
+ *    UInt16 avail_flags;
+ *    UInt16 avail_idx;
+ *    UInt16 available[num];
+ *    // Written by the Host, on a cache line of its own
+ *    UInt16 used_event_idx;
+ *
+ *    // Padding to the next page boundary.
+ *    char pad[];
+ *
+ *    // Written by the Host: its header ends a cache line of its own
+ *    char pad[VRING_CACHE_LINE - 4];
+ *    UInt16 used_flags;
+ *    UInt16 used_idx;
+ *    struct vring_used_elem used[num];
+ *    // Written by the Guest, on a cache line of its own
+ *    UInt16 avail_event_idx;
+ *
+ * so a side spinning on an index never pulls away the line the other side
+ * is filling ring entries in, and neither event index shares a line with
+ * the other side's ring.  avail->ring and used->ring still follow their
+ * headers, so only the event indices move.
+ */
+#define vring_line_align(a) \
+    (((unsigned long)(a) + VRING_CACHE_LINE - 1) & ~(VRING_CACHE_LINE - 1UL))
+
+static inline void vring_init_padded(struct vring *vr, unsigned int num,
+                                     void *p, unsigned long pagesize)
+{
+    unsigned long avail;
+    unsigned long used;
+
+    avail = vring_line_align((unsigned long)p + num * sizeof(struct vring_desc));
+    vr->num = num;
+    vr->desc = p;
+    vr->avail = (struct vring_avail *)
+                    (avail + VRING_CACHE_LINE - sizeof(UInt16) * 2);
+    vr->used_event = (UInt16 *)vring_line_align(&vr->avail->ring[num]);
+
+    used = ((unsigned long)vr->used_event + VRING_CACHE_LINE + pagesize - 1) &
+                ~(pagesize - 1);
+    vr->used = (struct vring_used *)
+                    (used + VRING_CACHE_LINE - sizeof(UInt16) * 2);
+    vr->avail_event = (UInt16 *)vring_line_align(&vr->used->ring[num]);
+}
+
+static inline unsigned vring_size_padded(unsigned int num,
+                                         unsigned long pagesize)
+{
+    return ((vring_line_align(sizeof(struct vring_desc) * num) +
+                VRING_CACHE_LINE * 2 + vring_line_align(sizeof(UInt16) * num) +
+                pagesize - 1) & ~(pagesize - 1))
+                + VRING_CACHE_LINE * 2 +
+                vring_line_align(sizeof(struct vring_used_elem) * num);
+}
+
+/* The following is used with VIRTIO_RING_F_EVENT_IDX.
+ * Assuming a given event_idx value from the other size, if
+ * we have just incremented index from old to new_idx,
+ * should we trigger an event? */
+static inline int vring_need_event(UInt16 event_idx, UInt16 new_idx,
+                                   UInt16 old)
+{
+    /* Note: Xen has similar logic for notification hold-off
+     * in include/xen/interface/io/ring.h with req_event and req_prod
+     * corresponding to event_idx + 1 and new_idx respectively.
+     * Note also that req_event and req_prod in Xen start at 1,
+     * event indexes in virtio start at 0. */
+    return (UInt16)(new_idx - event_idx - 1) < (UInt16)(new_idx - old);
+}
+
+/*
+ * Packed ring (virtio 1.1, VIRTIO_F_RING_PACKED).
+ *
+ * A single array of descriptors, which the driver (Host) marks available and
+ * the device (Slave) overwrites, in place, as used.  A descriptor's AVAIL and
+ * USED flags are compared with a wrap counter that each side flips every time
+ * it wraps around the ring, so neither side ever reads an index written by
+ * the other.  Chained descriptors are consecutive in the ring.
+ */
+
+/* Mark a descriptor as available or used; compared with the wrap counters */
+#define VRING_PACKED_DESC_F_AVAIL   7
+#define VRING_PACKED_DESC_F_USED    15
+
+/* Event suppression flags */
+#define VRING_PACKED_EVENT_FLAG_ENABLE  0
+#define VRING_PACKED_EVENT_FLAG_DISABLE 1
+/* Only notify when the descriptor at off_wrap is made available/used */
+#define VRING_PACKED_EVENT_FLAG_DESC    2
+
+/* Wrap counter bit of an event suppression off_wrap */
+#define VRING_PACKED_EVENT_F_WRAP_CTR   15
+
+/* Packed ring descriptors: 16 bytes, like split ring ones. */
+struct vring_packed_desc
+{
+    /* Buffer address (guest-physical). */
+    UInt32 addr;
+
+    UInt32 padding; /* Because 64 bits is originally used for addr */
+
+    /* Buffer length. */
+    UInt32 len;
+    /* Buffer ID. */
+    UInt16 id;
+    /* The flags depending on descriptor type. */
+    UInt16 flags;
+};
+
+/* Event suppression: the driver's follows the ring, then the device's. */
+struct vring_packed_desc_event
+{
+    /* Descriptor ring change event offset/wrap counter. */
+    UInt16 off_wrap;
+    /* Descriptor ring change event flags. */
+    UInt16 flags;
+};
+
+struct vring_packed {
+    unsigned int num;
+
+    struct vring_packed_desc *desc;
+
+    /* Written by the driver (Host), read by the device (Slave) */
+    struct vring_packed_desc_event *driver;
+
+    /* Written by the device (Slave), read by the driver (Host) */
+    struct vring_packed_desc_event *device;
+};
+
+/*
+ * With num a power of two, a free-running 16 bit index stands for both a
+ * ring position and a wrap counter, which starts at 1.
+ */
+#define vring_packed_pos(vr, idx)   ((idx) & ((vr)->num - 1))
+#define vring_packed_wrap(vr, idx)  (((idx) & (vr)->num) == 0)
+
+static inline void vring_packed_init(struct vring_packed *vr, unsigned int num,
+                                     void *p)
+{
+    vr->num = num;
+    vr->desc = p;
+    vr->driver = (struct vring_packed_desc_event *)
+                    ((unsigned)p + (num * sizeof(struct vring_packed_desc)));
+    vr->device = vr->driver + 1;
+}
+
+static inline unsigned vring_packed_size(unsigned int num)
+{
+    return (sizeof(struct vring_packed_desc) * num
+            + sizeof(struct vring_packed_desc_event) * 2);
+}
+
+/*
+ * VIRTIO_RPMSG_F_PADDED_IDX: the driver's and the device's event suppression
+ * structures each get a cache line, rather than sharing one with each other
+ * and with the end of the ring.
+ */
+static inline void vring_packed_init_padded(struct vring_packed *vr,
+                                            unsigned int num, void *p)
+{
+    vr->num = num;
+    vr->desc = p;
+    vr->driver = (struct vring_packed_desc_event *)vring_line_align(
+                    (unsigned long)p + num * sizeof(struct vring_packed_desc));
+    vr->device = (struct vring_packed_desc_event *)
+                    ((unsigned long)vr->driver + VRING_CACHE_LINE);
+}
+
+static inline unsigned vring_packed_size_padded(unsigned int num)
+{
+    return (vring_line_align(sizeof(struct vring_packed_desc) * num)
+            + VRING_CACHE_LINE * 2);
 }
 
 #ifdef __KERNEL__
@@ -87,12 +87,36 @@
 #define CONSOLE_VRING0_DA               0xA0008000
 #define CONSOLE_VRING1_DA               0xA000C000
 
+/*
+ * Vrings of the rpmsg vdevs for MessageQCopy's high and bulk priority
+ * classes, built with RPMSG_PRIORITY_VDEVS (AppM3's vrings are at
+ * 0xA0010000 and 0xA0014000)
+ */
+#define RPMSG_HIGH_VRING0_DA          0xA0018000
+#define RPMSG_HIGH_VRING1_DA          0xA001C000
+
+#define RPMSG_BULK_VRING0_DA          0xA0020000
+#define RPMSG_BULK_VRING1_DA          0xA0024000
+
 #define BUFS0_DA                0xA0040000
 #define BUFS1_DA                0xA0080000
 
+/*
+ * The last 256KB of the IPC window are for the vrings between SysM3 and
+ * AppM3, which the host never uses: their own devmem entry keeps the host
+ * off them.  The vrings are at its start (0xA00C0000 and 0xA00C4000),
+ * their handshake words at 0xA00C8000 and the buffers SysM3 provides for
+ * them at 0xA00D0000 (see VirtQueue.c and MessageQCopy.c).
+ */
+#define CORELINK_DA             0xA00C0000
+#define CORELINK_PA             0xA90C0000
+#define CORELINK_SIZE           0x00040000
+
 /*
  * sizes of the virtqueues (expressed in number of buffers supported,
- * and must be power of 2)
+ * and must be power of 2).  VirtQueue_create takes each vring's size,
+ * alignment and address from the entries below; the size of the buffers
+ * themselves is up to the host.
  */
 #define RPMSG_VQ0_SIZE                256
 #define RPMSG_VQ1_SIZE                256
@@ -100,6 +124,12 @@
 #define CONSOLE_VQ0_SIZE                256
 #define CONSOLE_VQ1_SIZE                256
 
+#define RPMSG_HIGH_VQ0_SIZE           64
+#define RPMSG_HIGH_VQ1_SIZE           64
+
+#define RPMSG_BULK_VQ0_SIZE           256
+#define RPMSG_BULK_VQ1_SIZE           256
+
 /* Size constants must match those used on host: include/asm-generic/sizes.h */
 #define SZ_1M                           0x00100000
 #define SZ_2M                           0x00200000
@@ -118,75 +148,26 @@
 
 #  define TEXT_SIZE  (SZ_4M)
 
-/* virtio ids: keep in sync with the linux "include/linux/virtio_ids.h" */
-#define VIRTIO_ID_CONSOLE	3 /* virtio console */
-#define VIRTIO_ID_RPMSG		7 /* virtio remote processor messaging */
-
-/* Indices of rpmsg virtio features we support */
-#define VIRTIO_RPMSG_F_NS	0 /* RP supports name service notifications */
+#include <ti/resources/rsc_types.h>
+#include <ti/ipc/rpmsg/virtio_ring.h>
 
 /* flip up bits whose indices represent features we support */
-#define RPMSG_IPU_C0_FEATURES         1
-
-/* Resource info: Must match include/linux/remoteproc.h: */
-#define TYPE_CARVEOUT    0
-#define TYPE_DEVMEM      1
-#define TYPE_TRACE       2
-#define TYPE_VDEV  3
-
-struct fw_rsc_carveout {
-	u32 type;
-	u32 da;
-	u32 pa;
-	u32 len;
-	u32 flags;
-	u32 reserved;
-	char name[32];
-};
-
-struct fw_rsc_devmem {
-	u32 type;
-	u32 da;
-	u32 pa;
-	u32 len;
-	u32 flags;
-	u32 reserved;
-	char name[32];
-};
-
-struct fw_rsc_trace {
-	u32 type;
-	u32 da;
-	u32 len;
-	u32 reserved;
-	char name[32];
-};
-
-struct fw_rsc_vdev_vring {
-	u32 da; /* device address */
-	u32 align;
-	u32 num;
-	u32 notifyid;
-	u32 reserved;
-};
-
-struct fw_rsc_vdev {
-	u32 type;
-	u32 id;
-	u32 notifyid;
-	u32 dfeatures;
-	u32 gfeatures;
-	u32 config_len;
-	char status;
-	char num_of_vrings;
-	char reserved[2];
-};
+#define RPMSG_IPU_C0_FEATURES   ((1 << VIRTIO_RPMSG_F_NS) | \
+                                 (1 << VIRTIO_RING_F_EVENT_IDX) | \
+                                 (1 << VIRTIO_RING_F_INDIRECT_DESC) | \
+                                 (1 << VIRTIO_RPMSG_F_PADDED_IDX))
+
+#ifdef RPMSG_PRIORITY_VDEVS
+#define NUM_ENTRIES	16
+#else
+#define NUM_ENTRIES	14
+#endif
 
 struct resource_table {
-	u32 version;
-	u32 num;
-	u32 reserved[2];
-	u32 offset[13];
+	UInt32 version;
+	UInt32 num;
+	UInt32 reserved[2];
+	UInt32 offset[NUM_ENTRIES];
 
 	/* rpmsg vdev entry */
 	struct fw_rsc_vdev rpmsg_vdev;
@@ -198,6 +179,17 @@ struct resource_table {
 	struct fw_rsc_vdev_vring console_vring0;
 	struct fw_rsc_vdev_vring console_vring1;
 
+#ifdef RPMSG_PRIORITY_VDEVS
+	/* rpmsg vdev entries of the high and bulk priority classes */
+	struct fw_rsc_vdev rpmsg_high_vdev;
+	struct fw_rsc_vdev_vring rpmsg_high_vring0;
+	struct fw_rsc_vdev_vring rpmsg_high_vring1;
+
+	struct fw_rsc_vdev rpmsg_bulk_vdev;
+	struct fw_rsc_vdev_vring rpmsg_bulk_vring0;
+	struct fw_rsc_vdev_vring rpmsg_bulk_vring1;
+#endif
+
 	/* data carveout entry */
 	struct fw_rsc_carveout data_cout;
 
@@ -230,22 +222,29 @@ struct resource_table {
 
 	/* devmem entry */
 	struct fw_rsc_devmem devmem7;
+
+	/* devmem entry of the vrings between the M3 cores */
+	struct fw_rsc_devmem devmem8;
 };
 
 extern char * xdc_runtime_SysMin_Module_State_0_outbuf__A;
-#define TRACEBUFADDR (u32)&xdc_runtime_SysMin_Module_State_0_outbuf__A
+#define TRACEBUFADDR (UInt32)&xdc_runtime_SysMin_Module_State_0_outbuf__A
 
 #pragma DATA_SECTION(resources, ".resource_table")
 #pragma DATA_ALIGN(resources, 4096)
 
 struct resource_table resources = {
 	1, /* we're the first version that implements this */
-	13, /* number of entries in the table */
+	NUM_ENTRIES, /* number of entries in the table */
 	0, 0, /* reserved, must be zero */
 	/* offsets to entries */
 	{
 		offsetof(struct resource_table, rpmsg_vdev),
 		offsetof(struct resource_table, console_vdev),
+#ifdef RPMSG_PRIORITY_VDEVS
+		offsetof(struct resource_table, rpmsg_high_vdev),
+		offsetof(struct resource_table, rpmsg_bulk_vdev),
+#endif
 		offsetof(struct resource_table, data_cout),
 		offsetof(struct resource_table, text_cout),
 		offsetof(struct resource_table, trace),
@@ -257,6 +256,7 @@ struct resource_table resources = {
 		offsetof(struct resource_table, devmem5),
 		offsetof(struct resource_table, devmem6),
 		offsetof(struct resource_table, devmem7),
+		offsetof(struct resource_table, devmem8),
 	},
 
 	/* rpmsg vdev entry */
@@ -279,6 +279,28 @@ struct resource_table resources = {
 	{ CONSOLE_VRING0_DA, 4096, CONSOLE_VQ0_SIZE, 4, 0 },
 	{ CONSOLE_VRING1_DA, 4096, CONSOLE_VQ1_SIZE, 5, 0 },
 
+#ifdef RPMSG_PRIORITY_VDEVS
+	/* rpmsg vdev of the high priority class */
+	{
+		TYPE_VDEV, VIRTIO_ID_RPMSG, 6,
+		RPMSG_IPU_C0_FEATURES, 0, 0, 0, 2, { 0, 0 },
+		/* no config data */
+	},
+	/* the two vrings */
+	{ RPMSG_HIGH_VRING0_DA, 4096, RPMSG_HIGH_VQ0_SIZE, 7, 0 },
+	{ RPMSG_HIGH_VRING1_DA, 4096, RPMSG_HIGH_VQ1_SIZE, 8, 0 },
+
+	/* rpmsg vdev of the bulk priority class */
+	{
+		TYPE_VDEV, VIRTIO_ID_RPMSG, 9,
+		RPMSG_IPU_C0_FEATURES, 0, 0, 0, 2, { 0, 0 },
+		/* no config data */
+	},
+	/* the two vrings */
+	{ RPMSG_BULK_VRING0_DA, 4096, RPMSG_BULK_VQ0_SIZE, 10, 0 },
+	{ RPMSG_BULK_VRING1_DA, 4096, RPMSG_BULK_VQ1_SIZE, 11, 0 },
+#endif
+
 	{
 		TYPE_CARVEOUT, DATA_DA, 0, DATA_SIZE, 0, 0, "IPU_MEM_DATA",
 	},
@@ -292,7 +314,8 @@ struct resource_table resources = {
 	},
 
 	{
-		TYPE_DEVMEM, IPC_DA, IPC_PA, SZ_1M, 0, 0, "IPU_MEM_IPC",
+		TYPE_DEVMEM, IPC_DA, IPC_PA, CORELINK_DA - IPC_DA, 0, 0,
+		"IPU_MEM_IPC",
 	},
 
 	{
@@ -336,6 +359,11 @@ struct resource_table resources = {
 		IPU_IVAHD_SL2, L3_IVAHD_SL2,
 		SZ_16M, 0, 0, "IPU_IVAHD_SL2",
 	},
+
+	{
+		TYPE_DEVMEM, CORELINK_DA, CORELINK_PA, CORELINK_SIZE, 0, 0,
+		"IPU_MEM_CORELINK",
+	},
 };
 
 #endif /* _RSC_TABLE_H_ */
@@ -0,0 +1,824 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== BiosSim.c ========
+ *  vqsim implementations of the few xdc.runtime/SYS/BIOS services used by
+ *  VirtQueue.c, and (for mqsim) MessageQCopy.c.
+ */
+
+/* For PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP */
+#define _GNU_SOURCE
+
+#include <xdc/std.h>
+#include <xdc/runtime/System.h>
+#include <xdc/runtime/Error.h>
+#include <xdc/runtime/Memory.h>
+#include <xdc/runtime/Registry.h>
+#include <xdc/runtime/Timestamp.h>
+
+#include <ti/sysbios/BIOS.h>
+#include <ti/sysbios/hal/Cache.h>
+#include <ti/sysbios/hal/Hwi.h>
+#include <ti/sysbios/knl/Clock.h>
+#include <ti/sysbios/knl/Semaphore.h>
+#include <ti/sysbios/knl/Swi.h>
+#include <ti/sysbios/gates/GateSwi.h>
+#include <ti/sysbios/heaps/HeapBuf.h>
+#include <ti/sdo/utils/List.h>
+#include <ti/ipc/MultiProc.h>
+#include <ti/pm/IpcPower.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+
+#include "VqSim.h"
+
+/* Same order as MultiProc.setConfig() in DucatiCore0.cfg */
+static String procNames[] = { "HOST", "CORE0", "CORE1", "DSP" };
+static UInt16 localId = MultiProc_INVALIDID;
+
+UInt32 BiosSim_cacheWbAllCount = 0;
+
+/* Nests, like Hwi_disable() */
+static pthread_mutex_t hwiLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/* Swis run, and GateSwi is entered, with this held */
+static pthread_mutex_t swiLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static UInt swiNesting = 0;     /* times its owner holds it */
+
+#define MAXSWIS         4
+#define MAXCLOCKS       4
+
+struct Swi_Object {
+    Swi_FuncPtr     fxn;
+    UArg            arg0;
+    UArg            arg1;
+    Bool            posted;     /* within swiLock */
+};
+
+struct GateSwi_Object {
+    Int             dummy;
+};
+
+struct Clock_Object {
+    Clock_FuncPtr   fxn;
+    UArg            arg;
+    UInt32          period;
+    Bool            active;     /* within swiLock */
+};
+
+struct Semaphore_Object {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    Int             count;
+};
+
+struct HeapBuf_Object {
+    SizeT           blockSize;
+    Ptr             freeList;   /* linked through the first word */
+};
+
+struct List_Object {
+    List_Elem       elem;       /* head: the list is circular */
+};
+
+static Swi_Handle swis[MAXSWIS];
+static Clock_Handle clocks[MAXCLOCKS];
+
+/* The Swi this thread is running, if any */
+static __thread Swi_Handle curSwi = NULL;
+
+/*!
+ *  ======== Error_init ========
+ */
+Void Error_init(Error_Block *eb)
+{
+    if (eb) {
+        eb->id = 0;
+    }
+}
+
+/*!
+ *  ======== Error_raise ========
+ */
+Void Error_raise(Error_Block *eb, Int id, IArg arg1, IArg arg2)
+{
+    System_printf("Error_raise: id %d (0x%lx, 0x%lx)\n", id, (long)arg1,
+            (long)arg2);
+    System_abort("vqsim: fatal error\n");
+}
+
+/*!
+ *  ======== Error_print ========
+ */
+Void Error_print(Error_Block *eb)
+{
+    System_printf("Error_print: id %d\n", eb ? eb->id : 0);
+}
+
+/*!
+ *  ======== Hwi_disable ========
+ */
+UInt Hwi_disable()
+{
+    pthread_mutex_lock(&hwiLock);
+
+    return (0);
+}
+
+/*!
+ *  ======== Hwi_restore ========
+ */
+Void Hwi_restore(UInt key)
+{
+    pthread_mutex_unlock(&hwiLock);
+}
+
+/*!
+ *  ======== Memory_alloc ========
+ */
+Ptr Memory_alloc(Ptr heap, size_t size, size_t align, Error_Block *eb)
+{
+#if defined(BIOSSIM_DIRTY_ALLOC)
+    /* BIOS heaps don't clear: show up fields never set, as on the target */
+    Ptr block = malloc(size);
+
+    if (block != NULL) {
+        memset(block, 0xA5, size);
+    }
+
+    return (block);
+#else
+    /* BIOS heaps don't clear, but a deterministic simulation is preferable */
+    return (calloc(1, size));
+#endif
+}
+
+/*!
+ *  ======== Memory_calloc ========
+ */
+Ptr Memory_calloc(Ptr heap, size_t size, size_t align, Error_Block *eb)
+{
+    return (calloc(1, size));
+}
+
+/*!
+ *  ======== Memory_free ========
+ */
+Void Memory_free(Ptr heap, Ptr block, size_t size)
+{
+    free(block);
+}
+
+/*!
+ *  ======== Cache_inv ========
+ */
+Void Cache_inv(Ptr blockPtr, SizeT byteCnt, Bits16 type, Bool wait)
+{
+    VqSim_ctrl->remoteCacheInv++;
+}
+
+/*!
+ *  ======== Cache_wb ========
+ */
+Void Cache_wb(Ptr blockPtr, SizeT byteCnt, Bits16 type, Bool wait)
+{
+    VqSim_ctrl->remoteCacheWb++;
+}
+
+/*!
+ *  ======== Cache_wbAll ========
+ */
+Void Cache_wbAll()
+{
+    BiosSim_cacheWbAllCount++;
+}
+
+/*!
+ *  ======== Clock_getTicks ========
+ */
+UInt32 Clock_getTicks()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((UInt32)(ts.tv_sec * 1000 + ts.tv_nsec / 1000000));
+}
+
+/*!
+ *  ======== Timestamp_get32 ========
+ */
+Bits32 Timestamp_get32()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((Bits32)(ts.tv_sec * 1000000000ULL + ts.tv_nsec));
+}
+
+/*!
+ *  ======== Timestamp_getFreq ========
+ */
+Void Timestamp_getFreq(Types_FreqHz *freq)
+{
+    freq->hi = 0;
+    freq->lo = 1000000000;
+}
+
+/*!
+ *  ======== Registry_addModule ========
+ */
+Registry_Result Registry_addModule(Registry_Desc *desc, String modName)
+{
+    desc->modName = modName;
+
+    return (Registry_SUCCESS);
+}
+
+/*
+ *  ======== runSwis ========
+ *  Run the posted Swis, until none is.  Call with swiLock held once.
+ */
+static Void runSwis()
+{
+    Bool ran;
+    Int  i;
+
+    do {
+        ran = FALSE;
+        for (i = 0; i < MAXSWIS; i++) {
+            if ((swis[i] != NULL) && swis[i]->posted) {
+                swis[i]->posted = FALSE;
+                curSwi = swis[i];
+                swis[i]->fxn(swis[i]->arg0, swis[i]->arg1);
+                curSwi = NULL;
+                ran = TRUE;
+            }
+        }
+    } while (ran);
+}
+
+/*!
+ *  ======== Swi_Params_init ========
+ */
+Void Swi_Params_init(Swi_Params *params)
+{
+    memset(params, 0, sizeof(Swi_Params));
+}
+
+/*!
+ *  ======== Swi_create ========
+ */
+Swi_Handle Swi_create(Swi_FuncPtr fxn, const Swi_Params *params,
+                      Error_Block *eb)
+{
+    Swi_Handle swi = NULL;
+    Int        i;
+
+    pthread_mutex_lock(&swiLock);
+    for (i = 0; i < MAXSWIS; i++) {
+        if (swis[i] == NULL) {
+            swi = calloc(1, sizeof(struct Swi_Object));
+            swi->fxn = fxn;
+            if (params) {
+                swi->arg0 = params->arg0;
+                swi->arg1 = params->arg1;
+            }
+            swis[i] = swi;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&swiLock);
+
+    return (swi);
+}
+
+/*!
+ *  ======== Swi_delete ========
+ */
+Void Swi_delete(Swi_Handle *handle)
+{
+    Int i;
+
+    pthread_mutex_lock(&swiLock);
+    for (i = 0; i < MAXSWIS; i++) {
+        if (swis[i] == *handle) {
+            swis[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&swiLock);
+
+    free(*handle);
+    *handle = NULL;
+}
+
+/*!
+ *  ======== Swi_post ========
+ */
+Void Swi_post(Swi_Handle handle)
+{
+    pthread_mutex_lock(&swiLock);
+    handle->posted = TRUE;
+    if (++swiNesting == 1) {
+        runSwis();
+    }
+    swiNesting--;
+    pthread_mutex_unlock(&swiLock);
+}
+
+/*!
+ *  ======== Swi_self ========
+ */
+Swi_Handle Swi_self()
+{
+    return (curSwi);
+}
+
+/*!
+ *  ======== GateSwi_Params_init ========
+ */
+Void GateSwi_Params_init(GateSwi_Params *params)
+{
+    memset(params, 0, sizeof(GateSwi_Params));
+}
+
+/*!
+ *  ======== GateSwi_create ========
+ */
+GateSwi_Handle GateSwi_create(const GateSwi_Params *params, Error_Block *eb)
+{
+    return (calloc(1, sizeof(struct GateSwi_Object)));
+}
+
+/*!
+ *  ======== GateSwi_delete ========
+ */
+Void GateSwi_delete(GateSwi_Handle *handle)
+{
+    free(*handle);
+    *handle = NULL;
+}
+
+/*!
+ *  ======== GateSwi_enter ========
+ */
+IArg GateSwi_enter(GateSwi_Handle handle)
+{
+    pthread_mutex_lock(&swiLock);
+    swiNesting++;
+
+    return (0);
+}
+
+/*!
+ *  ======== GateSwi_leave ========
+ *  Swis posted meanwhile run now, as the gate is left.
+ */
+Void GateSwi_leave(GateSwi_Handle handle, IArg key)
+{
+    if (swiNesting == 1) {
+        runSwis();
+    }
+    swiNesting--;
+    pthread_mutex_unlock(&swiLock);
+}
+
+/*!
+ *  ======== Clock_Params_init ========
+ */
+Void Clock_Params_init(Clock_Params *params)
+{
+    memset(params, 0, sizeof(Clock_Params));
+}
+
+/*!
+ *  ======== Clock_create ========
+ */
+Clock_Handle Clock_create(Clock_FuncPtr fxn, UInt timeout,
+                          const Clock_Params *params, Error_Block *eb)
+{
+    Clock_Handle clock = NULL;
+    Int          i;
+
+    pthread_mutex_lock(&swiLock);
+    for (i = 0; i < MAXCLOCKS; i++) {
+        if (clocks[i] == NULL) {
+            clock = calloc(1, sizeof(struct Clock_Object));
+            clock->fxn = fxn;
+            if (params) {
+                clock->arg = params->arg;
+                clock->period = params->period;
+                clock->active = params->startFlag;
+            }
+            clocks[i] = clock;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&swiLock);
+
+    return (clock);
+}
+
+/*!
+ *  ======== Clock_delete ========
+ */
+Void Clock_delete(Clock_Handle *handle)
+{
+    Int i;
+
+    pthread_mutex_lock(&swiLock);
+    for (i = 0; i < MAXCLOCKS; i++) {
+        if (clocks[i] == *handle) {
+            clocks[i] = NULL;
+        }
+    }
+    pthread_mutex_unlock(&swiLock);
+
+    free(*handle);
+    *handle = NULL;
+}
+
+/*!
+ *  ======== Clock_start ========
+ */
+Void Clock_start(Clock_Handle handle)
+{
+    pthread_mutex_lock(&swiLock);
+    handle->active = TRUE;
+    pthread_mutex_unlock(&swiLock);
+}
+
+/*!
+ *  ======== Clock_stop ========
+ */
+Void Clock_stop(Clock_Handle handle)
+{
+    pthread_mutex_lock(&swiLock);
+    handle->active = FALSE;
+    pthread_mutex_unlock(&swiLock);
+}
+
+/*!
+ *  ======== BiosSim_clockTick ========
+ *  Clock functions run in the Clock Swi, so other Swis run after them.
+ */
+Void BiosSim_clockTick()
+{
+    Clock_Handle clock;
+    Int          i;
+
+    pthread_mutex_lock(&swiLock);
+    swiNesting++;
+    for (i = 0; i < MAXCLOCKS; i++) {
+        if (((clock = clocks[i]) != NULL) && clock->active) {
+            /* One-shot Clocks stop as they expire */
+            clock->active = (clock->period != 0);
+            clock->fxn(clock->arg);
+        }
+    }
+    if (swiNesting == 1) {
+        runSwis();
+    }
+    swiNesting--;
+    pthread_mutex_unlock(&swiLock);
+}
+
+/*!
+ *  ======== Semaphore_create ========
+ */
+Semaphore_Handle Semaphore_create(Int count, Ptr params, Error_Block *eb)
+{
+    Semaphore_Handle   sem;
+    pthread_condattr_t attr;
+
+    sem = calloc(1, sizeof(struct Semaphore_Object));
+    if (sem) {
+        /* Timeouts are in Clock ticks, which are CLOCK_MONOTONIC */
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&sem->cond, &attr);
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_init(&sem->lock, NULL);
+        sem->count = count;
+    }
+
+    return (sem);
+}
+
+/*!
+ *  ======== Semaphore_delete ========
+ */
+Void Semaphore_delete(Semaphore_Handle *handle)
+{
+    pthread_cond_destroy(&(*handle)->cond);
+    pthread_mutex_destroy(&(*handle)->lock);
+    free(*handle);
+    *handle = NULL;
+}
+
+/*!
+ *  ======== Semaphore_pend ========
+ */
+Bool Semaphore_pend(Semaphore_Handle handle, UInt timeout)
+{
+    struct timespec deadline;
+    Bool            status = FALSE;
+    Int             err = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout / 1000;
+    deadline.tv_nsec += (timeout % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&handle->lock);
+    while ((handle->count == 0) && (timeout != 0) && (err != ETIMEDOUT)) {
+        if (timeout == BIOS_WAIT_FOREVER) {
+            pthread_cond_wait(&handle->cond, &handle->lock);
+        }
+        else {
+            err = pthread_cond_timedwait(&handle->cond, &handle->lock,
+                                         &deadline);
+        }
+    }
+    if (handle->count > 0) {
+        handle->count--;
+        status = TRUE;
+    }
+    pthread_mutex_unlock(&handle->lock);
+
+    return (status);
+}
+
+/*!
+ *  ======== Semaphore_post ========
+ */
+Void Semaphore_post(Semaphore_Handle handle)
+{
+    pthread_mutex_lock(&handle->lock);
+    handle->count++;
+    pthread_cond_signal(&handle->cond);
+    pthread_mutex_unlock(&handle->lock);
+}
+
+/*!
+ *  ======== Semaphore_getCount ========
+ */
+Int Semaphore_getCount(Semaphore_Handle handle)
+{
+    Int count;
+
+    pthread_mutex_lock(&handle->lock);
+    count = handle->count;
+    pthread_mutex_unlock(&handle->lock);
+
+    return (count);
+}
+
+/*!
+ *  ======== HeapBuf_Params_init ========
+ */
+Void HeapBuf_Params_init(HeapBuf_Params *params)
+{
+    memset(params, 0, sizeof(HeapBuf_Params));
+}
+
+/*!
+ *  ======== HeapBuf_create ========
+ */
+HeapBuf_Handle HeapBuf_create(const HeapBuf_Params *params, Error_Block *eb)
+{
+    HeapBuf_Handle heap;
+    Ptr            *block;
+    UInt           i;
+
+    heap = calloc(1, sizeof(struct HeapBuf_Object));
+    if (heap) {
+        heap->blockSize = params->blockSize;
+        for (i = params->numBlocks; i > 0; i--) {
+            /* Lowest block first, as on target */
+            block = (Ptr *)((UInt8 *)params->buf +
+                            (i - 1) * params->blockSize);
+            *block = heap->freeList;
+            heap->freeList = block;
+        }
+    }
+
+    return (heap);
+}
+
+/*!
+ *  ======== HeapBuf_delete ========
+ */
+Void HeapBuf_delete(HeapBuf_Handle *handle)
+{
+    free(*handle);
+    *handle = NULL;
+}
+
+/*!
+ *  ======== HeapBuf_alloc ========
+ */
+Ptr HeapBuf_alloc(HeapBuf_Handle handle, SizeT size, SizeT align,
+                  Error_Block *eb)
+{
+    Ptr  block = NULL;
+    UInt key;
+
+    if (size > handle->blockSize) {
+        return (NULL);
+    }
+
+    key = Hwi_disable();
+    if ((block = handle->freeList) != NULL) {
+        handle->freeList = *(Ptr *)block;
+    }
+    Hwi_restore(key);
+
+    return (block);
+}
+
+/*!
+ *  ======== HeapBuf_free ========
+ */
+Void HeapBuf_free(HeapBuf_Handle handle, Ptr block, SizeT size)
+{
+    UInt key;
+
+    key = Hwi_disable();
+    *(Ptr *)block = handle->freeList;
+    handle->freeList = block;
+    Hwi_restore(key);
+}
+
+/*!
+ *  ======== List_create ========
+ */
+List_Handle List_create(const List_Params *params, Error_Block *eb)
+{
+    List_Handle list;
+
+    list = calloc(1, sizeof(struct List_Object));
+    if (list) {
+        list->elem.next = list->elem.prev = &list->elem;
+    }
+
+    return (list);
+}
+
+/*!
+ *  ======== List_delete ========
+ */
+Void List_delete(List_Handle *handle)
+{
+    free(*handle);
+    *handle = NULL;
+}
+
+/*!
+ *  ======== List_empty ========
+ */
+Bool List_empty(List_Handle handle)
+{
+    return (handle->elem.next == &handle->elem);
+}
+
+/*!
+ *  ======== List_get ========
+ */
+Ptr List_get(List_Handle handle)
+{
+    List_Elem *elem;
+    UInt      key;
+
+    key = Hwi_disable();
+    elem = handle->elem.next;
+    if (elem == &handle->elem) {
+        elem = NULL;
+    }
+    else {
+        handle->elem.next = elem->next;
+        elem->next->prev = &handle->elem;
+    }
+    Hwi_restore(key);
+
+    return (elem);
+}
+
+/*!
+ *  ======== List_put ========
+ */
+Void List_put(List_Handle handle, List_Elem *elem)
+{
+    UInt key;
+
+    key = Hwi_disable();
+    elem->next = &handle->elem;
+    elem->prev = handle->elem.prev;
+    handle->elem.prev->next = elem;
+    handle->elem.prev = elem;
+    Hwi_restore(key);
+}
+
+/*!
+ *  ======== List_remove ========
+ */
+Void List_remove(List_Handle handle, List_Elem *elem)
+{
+    UInt key;
+
+    key = Hwi_disable();
+    elem->prev->next = elem->next;
+    elem->next->prev = elem->prev;
+    Hwi_restore(key);
+}
+
+/*!
+ *  ======== MultiProc_getId ========
+ */
+UInt16 MultiProc_getId(String name)
+{
+    UInt16 i;
+
+    for (i = 0; i < sizeof(procNames) / sizeof(procNames[0]); i++) {
+        if (strcmp(name, procNames[i]) == 0) {
+            return (i);
+        }
+    }
+
+    return (MultiProc_INVALIDID);
+}
+
+/*!
+ *  ======== MultiProc_getName ========
+ */
+String MultiProc_getName(UInt16 id)
+{
+    return (id < sizeof(procNames) / sizeof(procNames[0]) ?
+            procNames[id] : NULL);
+}
+
+/*!
+ *  ======== MultiProc_self ========
+ */
+UInt16 MultiProc_self()
+{
+    return (localId);
+}
+
+/*!
+ *  ======== MultiProc_setLocalId ========
+ */
+Void MultiProc_setLocalId(UInt16 id)
+{
+    localId = id;
+}
+
+/*!
+ *  ======== IpcPower_init ========
+ */
+Void IpcPower_init()
+{
+}
+
+/*!
+ *  ======== IpcPower_suspend ========
+ */
+Void IpcPower_suspend()
+{
+}
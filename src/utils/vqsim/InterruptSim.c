@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== InterruptSim.c ========
+ *  vqsim replacement for InterruptM3.c: mailbox FIFOs in shared memory,
+ *  with an eventfd per processor standing in for the interrupt line.
+ */
+
+#include <xdc/std.h>
+#include <xdc/runtime/System.h>
+
+#include <ti/sysbios/hal/Hwi.h>
+#include <ti/ipc/MultiProc.h>
+#include <ti/ipc/rpmsg/InterruptM3.h>
+
+#include <sched.h>
+#include <unistd.h>
+
+#include "VqSim.h"
+
+Int VqSim_efdRemote = -1;
+Int VqSim_efdHost = -1;
+VqSim_Ctrl *VqSim_ctrl = NULL;
+
+static Hwi_FuncPtr userFxn = NULL;
+
+/*!
+ *  ======== VqSim_mbxSend ========
+ */
+Void VqSim_mbxSend(VqSim_Mailbox *mbx, Int efd, UInt32 msg,
+                   VqSim_Mailbox *drain)
+{
+    UInt64 one = 1;
+    UInt32 discard;
+
+    if (mbx->head - mbx->tail >= VQSIM_MBX_DEPTH) {
+        mbx->full++;
+        while (mbx->head - mbx->tail >= VQSIM_MBX_DEPTH) {
+            /* The host stops draining once it is done: drop late kicks */
+            if (VqSim_ctrl->stop) {
+                return;
+            }
+            while (drain && VqSim_mbxRecv(drain, &discard)) {
+            }
+            sched_yield();
+        }
+    }
+
+    mbx->fifo[mbx->head % VQSIM_MBX_DEPTH] = msg;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    mbx->head++;
+    mbx->sent++;
+
+    if (write(efd, &one, sizeof(one)) != sizeof(one)) {
+        System_abort("VqSim_mbxSend: eventfd write failed\n");
+    }
+}
+
+/*!
+ *  ======== VqSim_mbxRecv ========
+ */
+Bool VqSim_mbxRecv(VqSim_Mailbox *mbx, UInt32 *msg)
+{
+    if (mbx->tail == mbx->head) {
+        return (FALSE);
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    *msg = mbx->fifo[mbx->tail % VQSIM_MBX_DEPTH];
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    mbx->tail++;
+
+    return (TRUE);
+}
+
+/*!
+ *  ======== VqSim_doorbellWait ========
+ */
+Void VqSim_doorbellWait(Int efd)
+{
+    UInt64 count;
+
+    if (read(efd, &count, sizeof(count)) != sizeof(count)) {
+        System_abort("VqSim_doorbellWait: eventfd read failed\n");
+    }
+}
+
+/*
+ *************************************************************************
+ *                      InterruptM3 API (remote side)
+ *************************************************************************
+ */
+
+/*!
+ *  ======== InterruptM3_intEnable ========
+ */
+Void InterruptM3_intEnable()
+{
+}
+
+/*!
+ *  ======== InterruptM3_intDisable ========
+ */
+Void InterruptM3_intDisable()
+{
+}
+
+/*!
+ *  ======== InterruptM3_intRegister ========
+ */
+Void InterruptM3_intRegister(Hwi_FuncPtr fxn)
+{
+    userFxn = fxn;
+}
+
+/*!
+ *  ======== InterruptM3_intSend ========
+ *  Only the host is modelled; messages to other cores are dropped.
+ *  A mailbox register write is atomic, so concurrent senders (vqsim -t)
+ *  are serialised here.
+ */
+Void InterruptM3_intSend(UInt16 remoteProcId, UArg arg)
+{
+    UInt key;
+
+    if (remoteProcId == MultiProc_getId("HOST")) {
+        key = Hwi_disable();
+        VqSim_mbxSend(&VqSim_ctrl->toHost, VqSim_efdHost, (UInt32)arg, NULL);
+        Hwi_restore(key);
+    }
+}
+
+/*!
+ *  ======== InterruptM3_intClear ========
+ */
+UInt InterruptM3_intClear()
+{
+    UInt32 arg;
+
+    if (!VqSim_mbxRecv(&VqSim_ctrl->toRemote, &arg)) {
+        return (InterruptM3_INVALIDPAYLOAD);
+    }
+
+    return (arg);
+}
+
+/*!
+ *  ======== InterruptM3_isr ========
+ */
+Void InterruptM3_isr(UArg arg)
+{
+    UArg payload;
+
+    payload = InterruptM3_intClear();
+    if (payload != InterruptM3_INVALIDPAYLOAD) {
+        userFxn(payload);
+    }
+}
@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== VqSim.h ========
+ *  Host-side VirtQueue loopback simulator: shared memory and doorbells.
+ *
+ *  The IPC window is a POSIX shared memory segment mapped at IPC_DA in both
+ *  the "host" (A9) and "remote" (SysM3) processes, so the unmodified
+ *  VirtQueue.c address translation and vring placement apply as-is.  The
+ *  layout follows src/ti/resources/rsc_table.h:
+ *
+ *      IPC_DA + 0x00000    rpmsg vring0 (SYSM3 -> A9, IPU_MEM_VRING0)
+ *      IPC_DA + 0x04000    rpmsg vring1 (A9 -> SYSM3, IPU_MEM_VRING1)
+ *      IPC_DA + 0x40000    BUFS0_DA: 256 x 512 byte rx buffers (host view)
+ *      IPC_DA + 0x80000    BUFS1_DA: 256 x 512 byte tx buffers (host view)
+ *      IPC_DA + 0xC0000    INDIR0_DA: rx indirect descriptor tables
+ *      IPC_DA + 0xD0000    INDIR1_DA: tx indirect descriptor tables
+ *
+ *  The mailbox is replaced by a small FIFO per direction, placed right after
+ *  the IPC window, plus an eventfd per side as the interrupt line.
+ */
+
+#ifndef VqSim__include
+#define VqSim__include
+
+#include <xdc/std.h>
+
+#include <ti/resources/rsc_types.h>
+
+/* Must match IPC_DA/IPC_PA and the rpmsg vdev entries in rsc_table.h */
+#define VQSIM_IPC_DA            0xA0000000U
+#define VQSIM_IPC_PA            0xA9000000U
+#define VQSIM_IPC_SIZE          0x00100000U
+
+#define VQSIM_VRING0_DA         0xA0000000U
+#define VQSIM_VRING1_DA         0xA0004000U
+#define VQSIM_BUFS0_DA          0xA0040000U
+#define VQSIM_BUFS1_DA          0xA0080000U
+#define VQSIM_INDIR0_DA         0xA00C0000U
+#define VQSIM_INDIR1_DA         0xA00D0000U
+
+/* Largest vring (the vrings are 16KB apart), and the default */
+#define VQSIM_NUM_BUFS          256
+#define VQSIM_BUF_SIZE          512
+#define VQSIM_VRING_ALIGN       4096
+
+/* Largest message, in buffers (as MAXMSGSEGS in MessageQCopy.c) */
+#define VQSIM_MAX_SEGS          8
+
+/* Control block, just past the IPC window */
+#define VQSIM_CTRL_DA           (VQSIM_IPC_DA + VQSIM_IPC_SIZE)
+#define VQSIM_SHM_SIZE          (VQSIM_IPC_SIZE + 4096)
+
+/* The OMAP4 mailbox FIFOs are 4 messages deep */
+#define VQSIM_MBX_DEPTH         4
+
+/* Must match ID_SYSM3_TO_A9/ID_A9_TO_SYSM3 in VirtQueue.c */
+#define VQSIM_ID_SYSM3_TO_A9    0
+#define VQSIM_ID_A9_TO_SYSM3    1
+
+typedef struct VqSim_Mailbox {
+    volatile UInt32     fifo[VQSIM_MBX_DEPTH];
+    volatile UInt32     head;       /* written by the sender only */
+    volatile UInt32     tail;       /* written by the receiver only */
+    volatile UInt32     sent;       /* number of interrupts raised */
+    volatile UInt32     full;       /* times the sender found the FIFO full */
+} VqSim_Mailbox;
+
+/*
+ * The rpmsg and IPC window parts of rsc_table.h, as the host loader leaves
+ * them in memory
+ */
+typedef struct VqSim_ResourceTable {
+    UInt32                      version;
+    UInt32                      num;
+    UInt32                      reserved[2];
+    UInt32                      offset[2];
+
+    struct fw_rsc_vdev          rpmsg_vdev;
+    struct fw_rsc_vdev_vring    rpmsg_vring0;
+    struct fw_rsc_vdev_vring    rpmsg_vring1;
+    struct fw_rsc_devmem        ipc_devmem;
+} VqSim_ResourceTable;
+
+typedef struct VqSim_Ctrl {
+    VqSim_ResourceTable rsc;
+    VqSim_Mailbox       toRemote;
+    VqSim_Mailbox       toHost;
+    volatile UInt32     stop;
+
+    /* VirtQueue_setPollBudget() of the remote's receive vring */
+    UInt32              pollSpins;
+
+    /* Remote threads sending the replies concurrently, 0 for none */
+    UInt32              workers;
+
+    /* Remote side statistics, read by the host at the end of a run */
+    volatile UInt32     remoteWakeups;
+    volatile UInt32     remoteSwiRuns;
+    volatile UInt32     remoteDropped;
+    volatile UInt32     remoteCacheInv;
+    volatile UInt32     remoteCacheWb;
+    volatile UInt32     remotePollHits;
+} VqSim_Ctrl;
+
+/* Same layout as MessageQCopy_MsgHeader (struct rpmsg_hdr on Linux) */
+typedef struct VqSim_MsgHeader {
+    Bits32  srcAddr;
+    Bits32  dstAddr;
+    Bits32  reserved;
+    Bits16  dataLen;
+    Bits16  flags;
+    UInt8   payload[];
+} VqSim_MsgHeader;
+
+/* eventfd doorbells, created before fork() */
+extern Int VqSim_efdRemote;
+extern Int VqSim_efdHost;
+
+extern VqSim_Ctrl *VqSim_ctrl;
+
+static inline Void *VqSim_paToVa(UInt32 pa)
+{
+    return ((Void *)(UArg)((pa & (VQSIM_IPC_SIZE - 1)) | VQSIM_IPC_DA));
+}
+
+static inline UInt32 VqSim_vaToPa(Void *va)
+{
+    return (((UInt32)(UArg)va & (VQSIM_IPC_SIZE - 1)) | VQSIM_IPC_PA);
+}
+
+/*
+ * Post a mailbox message and ring the receiver's doorbell.  Like the real
+ * mailbox, this spins while the FIFO is full; if 'drain' is not NULL it is
+ * emptied meanwhile, so two senders can never wait on each other.
+ */
+Void VqSim_mbxSend(VqSim_Mailbox *mbx, Int efd, UInt32 msg,
+                   VqSim_Mailbox *drain);
+
+/* Pop one mailbox message; returns FALSE if the FIFO is empty */
+Bool VqSim_mbxRecv(VqSim_Mailbox *mbx, UInt32 *msg);
+
+/* Block until the doorbell is rung (returns immediately if already rung) */
+Void VqSim_doorbellWait(Int efd);
+
+/* Remote side entry point (VqSimRemote.c) */
+Int VqSimRemote_run();
+
+#endif /* VqSim__include */
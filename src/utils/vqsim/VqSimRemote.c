@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== VqSimRemote.c ========
+ *  The "remote" (SysM3) side of vqsim: an echo server on top of the real
+ *  VirtQueue.c, structured like MessageQCopy_swiFxn/MessageQCopy_send.
+ */
+
+#include <xdc/std.h>
+#include <xdc/runtime/System.h>
+
+#include <ti/ipc/MultiProc.h>
+#include <ti/ipc/rpmsg/InterruptM3.h>
+#include <ti/ipc/rpmsg/VirtQueue.h>
+
+#include <pthread.h>
+#include <string.h>
+
+#include "VqSim.h"
+
+/* Same batch size as MessageQCopy_swiFxn */
+#define ECHO_BATCH      16
+
+#define MAX_WORKERS     8
+
+static VirtQueue_Handle virtQueue_toHost;
+static VirtQueue_Handle virtQueue_fromHost;
+
+/*
+ * With -t, the batch being echoed is handed to worker threads, which send
+ * the replies concurrently, as tasks calling MessageQCopy_send would.
+ */
+static pthread_t workers[MAX_WORKERS];
+static pthread_barrier_t batchStart;
+static pthread_barrier_t batchDone;
+static Int16 batchTokens[ECHO_BATCH];
+static VqSim_MsgHeader *batchMsgs[ECHO_BATCH];
+static int batchLens[ECHO_BATCH];
+static Int batchCount;
+static Bool workersStop = FALSE;
+
+/* Stands in for Swi_post() from the VirtQueue callback */
+static Bool swiPosted = FALSE;
+
+/*
+ *  ======== callback_availBufReady ========
+ */
+static Void callback_availBufReady(VirtQueue_Handle vq)
+{
+    if (vq == virtQueue_fromHost) {
+        VirtQueue_disableCallback(vq);
+        swiPosted = TRUE;
+    }
+}
+
+/*
+ *  ======== copyChained ========
+ *  Copy the payload of a message spanning several buffers into a chained
+ *  reply buffer, the way MessageQCopy_swiFxn gathers such messages and
+ *  MessageQCopy_send scatters them.  Returns FALSE if the reply buffer is
+ *  too small.
+ */
+static Bool copyChained(Int16 token, VqSim_MsgHeader *msg, Int16 replyToken,
+                        VqSim_MsgHeader *reply)
+{
+    VirtQueue_Seg src[VQSIM_MAX_SEGS];
+    VirtQueue_Seg dst[VQSIM_MAX_SEGS];
+    Int numSrc;
+    Int numDst;
+    Int s = 0;
+    Int d = 0;
+    UInt remaining = msg->dataLen;
+    UInt chunk;
+
+    numSrc = VirtQueue_getBufChain(virtQueue_fromHost, token, src,
+                                   VQSIM_MAX_SEGS);
+    numDst = VirtQueue_getBufChain(virtQueue_toHost, replyToken, dst,
+                                   VQSIM_MAX_SEGS);
+
+    /* The headers take up the start of the first segments */
+    src[0].buf = msg->payload;
+    src[0].len -= sizeof(VqSim_MsgHeader);
+    dst[0].buf = reply->payload;
+    dst[0].len -= sizeof(VqSim_MsgHeader);
+
+    while (remaining > 0) {
+        if (s == numSrc || d == numDst) {
+            return (FALSE);
+        }
+
+        chunk = remaining;
+        if (src[s].len < chunk) {
+            chunk = src[s].len;
+        }
+        if (dst[d].len < chunk) {
+            chunk = dst[d].len;
+        }
+        memcpy(dst[d].buf, src[s].buf, chunk);
+        remaining -= chunk;
+
+        src[s].buf = (Char *)src[s].buf + chunk;
+        if ((src[s].len -= chunk) == 0) {
+            s++;
+        }
+        dst[d].buf = (Char *)dst[d].buf + chunk;
+        if ((dst[d].len -= chunk) == 0) {
+            d++;
+        }
+    }
+
+    return (TRUE);
+}
+
+/*
+ *  ======== makeReply ========
+ *  Fill in the reply to a message; returns its length.
+ */
+static int makeReply(Int16 token, VqSim_MsgHeader *msg, int len,
+                     Int16 replyToken, VqSim_MsgHeader *reply)
+{
+    reply->dataLen = msg->dataLen;
+    if (msg->dataLen + sizeof(VqSim_MsgHeader) <= len) {
+        memcpy(reply->payload, msg->payload, msg->dataLen);
+    }
+    else if (!copyChained(token, msg, replyToken, reply)) {
+        /* The host counts this as an error */
+        reply->dataLen = 0;
+    }
+    reply->dstAddr = msg->srcAddr;
+    reply->srcAddr = msg->dstAddr;
+    reply->flags = 0;
+    reply->reserved = 0;
+
+    return (msg->dataLen + sizeof(VqSim_MsgHeader));
+}
+
+/*
+ *  ======== workerFxn ========
+ *  Send the replies to every numWorkers'th message of each batch, the way
+ *  MessageQCopy_send does: claim, fill, publish, kick.
+ */
+static Void *workerFxn(Void *arg)
+{
+    Int self = (Int)(UArg)arg;
+    Int numWorkers = VqSim_ctrl->workers;
+    VqSim_MsgHeader *reply;
+    Int16 replyToken;
+    int replyLen;
+    Int i;
+
+    for (;;) {
+        pthread_barrier_wait(&batchStart);
+        if (workersStop) {
+            break;
+        }
+
+        for (i = self; i < batchCount; i += numWorkers) {
+            replyToken = VirtQueue_claimAvailBuf(virtQueue_toHost,
+                                                 (Void **)&reply, &replyLen);
+            if (replyToken < 0) {
+                __atomic_fetch_add(&VqSim_ctrl->remoteDropped, 1,
+                                   __ATOMIC_RELAXED);
+                continue;
+            }
+
+            replyLen = makeReply(batchTokens[i], batchMsgs[i], batchLens[i],
+                                 replyToken, reply);
+            VirtQueue_publishUsedBuf(virtQueue_toHost, replyToken, replyLen);
+            VirtQueue_kick(virtQueue_toHost);
+        }
+
+        pthread_barrier_wait(&batchDone);
+    }
+
+    return (NULL);
+}
+
+/*
+ *  ======== echoSwiFxn ========
+ *  Bounce every message from the host back on the toHost vring, a batch at
+ *  a time: one used index update per vring and one kick per batch.
+ */
+static Void echoSwiFxn()
+{
+    VqSim_MsgHeader *msgs[ECHO_BATCH];
+    VqSim_MsgHeader *replies[ECHO_BATCH];
+    Int16 tokens[ECHO_BATCH];
+    Int16 replyTokens[ECHO_BATCH];
+    int lens[ECHO_BATCH];
+    int replyLens[ECHO_BATCH];
+    Bool usedBufAdded = FALSE;
+    Int count;
+    Int numReplies;
+    Int i;
+
+    VqSim_ctrl->remoteSwiRuns++;
+
+    VirtQueue_disableCallback(virtQueue_fromHost);
+
+    do {
+        while ((count = VirtQueue_getAvailBufs(virtQueue_fromHost, tokens,
+                                    (Void **)msgs, lens, ECHO_BATCH)) > 0) {
+
+            if (VqSim_ctrl->workers > 0) {
+                /* The fromHost buffers stay ours until all are replied to */
+                memcpy(batchTokens, tokens, count * sizeof(Int16));
+                memcpy(batchMsgs, msgs, count * sizeof(VqSim_MsgHeader *));
+                memcpy(batchLens, lens, count * sizeof(int));
+                batchCount = count;
+                pthread_barrier_wait(&batchStart);
+                pthread_barrier_wait(&batchDone);
+                numReplies = 0;
+            }
+            else {
+                numReplies = VirtQueue_getAvailBufs(virtQueue_toHost,
+                                    replyTokens, (Void **)replies, replyLens,
+                                    count);
+                for (i = 0; i < numReplies; i++) {
+                    replyLens[i] = makeReply(tokens[i], msgs[i], lens[i],
+                                             replyTokens[i], replies[i]);
+                }
+                VqSim_ctrl->remoteDropped += count - numReplies;
+            }
+
+            if (numReplies > 0) {
+                VirtQueue_addUsedBufs(virtQueue_toHost, replyTokens,
+                                      replyLens, numReplies);
+                VirtQueue_kick(virtQueue_toHost);
+            }
+
+            for (i = 0; i < count; i++) {
+                lens[i] = 0;
+            }
+            VirtQueue_addUsedBufs(virtQueue_fromHost, tokens, lens, count);
+            usedBufAdded = TRUE;
+        }
+    } while (!VirtQueue_enableCallback(virtQueue_fromHost));
+
+    if (usedBufAdded) {
+        VirtQueue_kick(virtQueue_fromHost);
+    }
+}
+
+/*
+ *  ======== VqSimRemote_run ========
+ */
+Int VqSimRemote_run()
+{
+    UInt16 hostProcId;
+    UInt i;
+
+    MultiProc_setLocalId(MultiProc_getId("CORE0"));
+    hostProcId = MultiProc_getId("HOST");
+
+    VirtQueue_setResourceTable(&VqSim_ctrl->rsc);
+    VirtQueue_startup();
+
+    virtQueue_toHost = VirtQueue_create(callback_availBufReady, hostProcId,
+                                        ID_SYSM3_TO_A9);
+    virtQueue_fromHost = VirtQueue_create(callback_availBufReady, hostProcId,
+                                          ID_A9_TO_SYSM3);
+    if (!virtQueue_toHost || !virtQueue_fromHost) {
+        System_printf("VqSimRemote_run: VirtQueue_create failed\n");
+        return (1);
+    }
+
+    /* As MessageQCopy_init: toHost kicks are of no interest */
+    VirtQueue_disableCallback(virtQueue_toHost);
+    VirtQueue_setPollBudget(virtQueue_fromHost, VqSim_ctrl->pollSpins);
+
+    if (VqSim_ctrl->workers > 0) {
+        pthread_barrier_init(&batchStart, NULL, VqSim_ctrl->workers + 1);
+        pthread_barrier_init(&batchDone, NULL, VqSim_ctrl->workers + 1);
+        for (i = 0; i < VqSim_ctrl->workers; i++) {
+            pthread_create(&workers[i], NULL, workerFxn, (Void *)(UArg)i);
+        }
+    }
+
+    while (!VqSim_ctrl->stop) {
+        /* As MessageQCopy_recv, before it blocks */
+        if (VirtQueue_poll(virtQueue_fromHost)) {
+            VqSim_ctrl->remotePollHits++;
+            swiPosted = TRUE;
+        }
+        else {
+            VqSim_doorbellWait(VqSim_efdRemote);
+            VqSim_ctrl->remoteWakeups++;
+        }
+
+        /* One InterruptM3_isr per pending mailbox message, as in hardware */
+        while (VqSim_ctrl->toRemote.tail != VqSim_ctrl->toRemote.head) {
+            InterruptM3_isr(0);
+        }
+
+        if (swiPosted) {
+            swiPosted = FALSE;
+            echoSwiFxn();
+        }
+    }
+
+    if (VqSim_ctrl->workers > 0) {
+        workersStop = TRUE;
+        pthread_barrier_wait(&batchStart);
+        for (i = 0; i < VqSim_ctrl->workers; i++) {
+            pthread_join(workers[i], NULL);
+        }
+    }
+
+    VirtQueue_dumpStats(virtQueue_toHost);
+    VirtQueue_dumpStats(virtQueue_fromHost);
+    System_flush();
+
+    return (0);
+}
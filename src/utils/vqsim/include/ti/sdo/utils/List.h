@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== ti/sdo/utils/List.h ========
+ *  vqsim: doubly linked lists; put, get and remove are atomic.
+ */
+
+#ifndef ti_sdo_utils_List__include
+#define ti_sdo_utils_List__include
+
+#include <xdc/runtime/Error.h>
+
+typedef struct List_Elem {
+    struct List_Elem    *next;
+    struct List_Elem    *prev;
+} List_Elem;
+
+typedef struct List_Object *List_Handle;
+
+typedef struct List_Params {
+    Int     dummy;
+} List_Params;
+
+List_Handle List_create(const List_Params *params, Error_Block *eb);
+Void List_delete(List_Handle *handle);
+Bool List_empty(List_Handle handle);
+Ptr List_get(List_Handle handle);
+Void List_put(List_Handle handle, List_Elem *elem);
+Void List_remove(List_Handle handle, List_Elem *elem);
+
+#endif /* ti_sdo_utils_List__include */
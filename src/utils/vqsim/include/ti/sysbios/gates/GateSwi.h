@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== ti/sysbios/gates/GateSwi.h ========
+ *  vqsim: all GateSwi instances share the one lock Swis run under.
+ */
+
+#ifndef ti_sysbios_gates_GateSwi__include
+#define ti_sysbios_gates_GateSwi__include
+
+#include <xdc/runtime/Error.h>
+
+typedef struct GateSwi_Object *GateSwi_Handle;
+
+typedef struct GateSwi_Params {
+    Int     dummy;
+} GateSwi_Params;
+
+Void GateSwi_Params_init(GateSwi_Params *params);
+GateSwi_Handle GateSwi_create(const GateSwi_Params *params, Error_Block *eb);
+Void GateSwi_delete(GateSwi_Handle *handle);
+IArg GateSwi_enter(GateSwi_Handle handle);
+Void GateSwi_leave(GateSwi_Handle handle, IArg key);
+
+#endif /* ti_sysbios_gates_GateSwi__include */
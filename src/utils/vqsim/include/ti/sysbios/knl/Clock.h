@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== ti/sysbios/knl/Clock.h ========
+ *  vqsim: one tick per millisecond of CLOCK_MONOTONIC.  Clock objects only
+ *  run when BiosSim_clockTick() is called.
+ */
+
+#ifndef ti_sysbios_knl_Clock__include
+#define ti_sysbios_knl_Clock__include
+
+#include <xdc/runtime/Error.h>
+
+typedef struct Clock_Object *Clock_Handle;
+
+typedef Void (*Clock_FuncPtr)(UArg);
+
+typedef struct Clock_Params {
+    UInt32  period;
+    Bool    startFlag;
+    UArg    arg;
+} Clock_Params;
+
+Void Clock_Params_init(Clock_Params *params);
+Clock_Handle Clock_create(Clock_FuncPtr fxn, UInt timeout,
+                          const Clock_Params *params, Error_Block *eb);
+Void Clock_delete(Clock_Handle *handle);
+Void Clock_start(Clock_Handle handle);
+Void Clock_stop(Clock_Handle handle);
+UInt32 Clock_getTicks();
+
+/* Run the Clock functions started, as if their timeouts expired */
+Void BiosSim_clockTick();
+
+#endif /* ti_sysbios_knl_Clock__include */
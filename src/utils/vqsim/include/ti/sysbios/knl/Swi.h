@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== ti/sysbios/knl/Swi.h ========
+ *  vqsim: Swi_post() runs the Swi right away in the posting thread, as it
+ *  preempts the posting Task, unless a Swi is running or GateSwi is
+ *  entered: then it runs as that ends.  Only one Swi runs at a time.
+ */
+
+#ifndef ti_sysbios_knl_Swi__include
+#define ti_sysbios_knl_Swi__include
+
+#include <xdc/runtime/Error.h>
+
+typedef struct Swi_Object *Swi_Handle;
+
+typedef Void (*Swi_FuncPtr)(UArg, UArg);
+
+typedef struct Swi_Params {
+    UArg    arg0;
+    UArg    arg1;
+    UInt    priority;
+} Swi_Params;
+
+Void Swi_Params_init(Swi_Params *params);
+Swi_Handle Swi_create(Swi_FuncPtr fxn, const Swi_Params *params,
+                      Error_Block *eb);
+Void Swi_delete(Swi_Handle *handle);
+Void Swi_post(Swi_Handle handle);
+Swi_Handle Swi_self();
+
+#endif /* ti_sysbios_knl_Swi__include */
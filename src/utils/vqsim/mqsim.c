@@ -0,0 +1,1592 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== mqsim.c ========
+ *  Host tests of MessageQCopy.c.
+ *
+ *  Builds the target's MessageQCopy.c and VirtQueue.c unmodified, as CORE0,
+ *  in one process, against the SYS/BIOS stand-ins of BiosSim.c.  The test
+ *  Tasks are threads; Swi_post() runs the Swi right away.  The host side
+ *  of the rpmsg vrings is played here, over the IPC window mapped at
+ *  IPC_DA as in vqsim, and a host kick calls VirtQueue_isr directly.
+ *
+ *  A forked child is CORE1, linked to CORE0 over the vrings CORE0 drives
+ *  in CORE_LINK.  Interrupts between the two go through a pipe each way,
+ *  a thread per core calling VirtQueue_isr for each one.  CORE1 echoes
+ *  what CORE0 sends it, and sends CORE0 bursts of messages on request.
+ *  Both are built with a Memory_alloc that does not clear, as on the
+ *  target, so fields left unset show up.
+ *
+ *  Each test exercises one feature: receiving in batches (recvMany),
+ *  endpoint sets, callback endpoints, zero-copy receive and send, sending
+ *  to the host with and without waiting for buffers, the Swi budget, the
+ *  link to CORE1, and, last, the size classes of the copy heaps, which
+ *  also finds any copy the tests before leaked.
+ *
+ *  Usage: mqsim
+ *
+ *  Exits non-zero if any check fails.
+ */
+
+#include <xdc/std.h>
+#include <xdc/runtime/System.h>
+
+#include <ti/sysbios/knl/Clock.h>
+#include <ti/sysbios/knl/Swi.h>
+#include <ti/sysbios/gates/GateSwi.h>
+#include <ti/ipc/MultiProc.h>
+#include <ti/ipc/rpmsg/InterruptM3.h>
+#include <ti/ipc/rpmsg/MessageQCopy.h>
+#include <ti/ipc/rpmsg/VirtQueue.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "VqSim.h"
+#include "../../ti/ipc/rpmsg/virtio_ring.h"
+
+/* Must match CORELINK_DA/CORELINK_PA/CORELINK_SIZE in rsc_table.h */
+#define MQSIM_CORELINK_DA       0xA00C0000U
+#define MQSIM_CORELINK_PA       0xA90C0000U
+#define MQSIM_CORELINK_SIZE     0x00040000U
+
+#define HOST_ENDPT              1024
+
+/* CORE1's endpoints: one echoing messages, one sending bursts of them */
+#define CORE1_ECHO_ENDPT        61
+#define CORE1_BURST_ENDPT       62
+
+/* Longest a CORE0 receive waits for CORE1, in ms */
+#define CORE_WAIT               1000
+
+/* Times a send to the other core is tried, a ms apart, for a buffer */
+#define CORE_SEND_TRIES         1000
+
+/* Sent to CORE1 on its interrupt pipe once CORE0 laid out the vrings */
+#define MQSIM_GO                0xFFFFFFFF
+
+/*
+ * Copies MessageQCopy.c can hold at once, by size class: the number of
+ * blocks of that class and the larger ones (MAXSMALLBUFFERS and so on)
+ */
+#define SMALL_COPIES            (512 + 256 + 128 + 8)
+#define MEDIUM_COPIES           (256 + 128 + 8)
+#define MSGBUF_COPIES           (128 + 8)
+#define LARGE_COPIES            (8)
+
+/* Largest payload in one vring buffer */
+#define MAX_BUF_PAYLOAD         (VQSIM_BUF_SIZE - sizeof(VqSim_MsgHeader))
+
+#define CHECK(cond)             check((cond), #cond, __LINE__)
+
+/* rsc_table.h's rpmsg vdev, and the devmem entries VirtQueue.c needs */
+typedef struct MqSim_ResourceTable {
+    UInt32                      version;
+    UInt32                      num;
+    UInt32                      reserved[2];
+    UInt32                      offset[3];
+
+    struct fw_rsc_vdev          rpmsg_vdev;
+    struct fw_rsc_vdev_vring    rpmsg_vring0;
+    struct fw_rsc_vdev_vring    rpmsg_vring1;
+    struct fw_rsc_devmem        ipc_devmem;
+    struct fw_rsc_devmem        corelink_devmem;
+} MqSim_ResourceTable;
+
+/* One vring, as the host (virtio driver) sees it */
+typedef struct HostRing {
+    struct vring        vr;
+    UInt32              id;         /* notify id */
+    UInt32              bufs;       /* buffer i is bufs + i * VQSIM_BUF_SIZE */
+    UInt16              availIdx;   /* buffers made available */
+    UInt16              lastUsed;   /* used buffers reaped */
+} HostRing;
+
+/* A callback endpoint's record of its calls */
+typedef struct CallbackLog {
+    UInt                calls;
+    UInt                notInSwi;   /* calls not made by a Swi */
+    MessageQCopy_Handle handle;
+    UArg                arg;
+    UInt16              len;
+    UInt32              src;
+    UInt8               data[MessageQCopy_MAX_DATA_SIZE];
+} CallbackLog;
+
+/* Stands in for InterruptSim.c: BiosSim.c counts cache operations here */
+static VqSim_Ctrl ctrl;
+VqSim_Ctrl *VqSim_ctrl = &ctrl;
+
+static MqSim_ResourceTable rscTable;
+
+static HostRing rxRing;     /* vring0: CORE0 -> host */
+static HostRing txRing;     /* vring1: host -> CORE0 */
+
+/* Free tx descriptors, as a stack */
+static UInt16 txFree[VQSIM_NUM_BUFS];
+static UInt txNumFree = 0;
+
+/* VirtQueue_isr, as VirtQueue_startup registers it */
+static Hwi_FuncPtr isrFxn = NULL;
+
+static UInt16 hostProcId;
+static UInt16 selfProcId;
+static UInt16 peerProcId;   /* the other M3 core */
+
+/* Interrupts from the other core are read from irqIn, to it written to irqOut */
+static Int irqIn = -1;
+static Int irqOut = -1;
+static GateSwi_Handle irqGate;
+static pthread_t irqThread;
+
+static pid_t core1Pid;
+
+static UInt errors = 0;
+
+/* A Task made to run a function a while later, see later() */
+static pthread_t laterThread;
+static Void (*laterFxn)(UArg);
+static UArg laterArg;
+static UInt laterMsecs;
+
+/*
+ *  ======== check ========
+ */
+static Void check(Bool ok, String what, Int line)
+{
+    if (!ok) {
+        printf("  FAILED at line %d: %s\n", line, what);
+        errors++;
+    }
+}
+
+/*
+ *  ======== fill ========
+ *  A payload telling messages, and their bytes, apart.
+ */
+static Void fill(UInt8 *data, UInt len, UInt32 seq)
+{
+    UInt i;
+
+    for (i = 0; i < len; i++) {
+        data[i] = (UInt8)(seq + i % 251);
+    }
+}
+
+/*
+ *  ======== filled ========
+ */
+static Bool filled(UInt8 *data, UInt len, UInt32 seq)
+{
+    UInt i;
+
+    for (i = 0; i < len; i++) {
+        if (data[i] != (UInt8)(seq + i % 251)) {
+            return (FALSE);
+        }
+    }
+
+    return (TRUE);
+}
+
+/*
+ *  ======== laterMain ========
+ */
+static Void *laterMain(Void *arg)
+{
+    usleep(laterMsecs * 1000);
+    laterFxn(laterArg);
+
+    return (NULL);
+}
+
+/*
+ *  ======== later ========
+ *  Call fxn(arg) from another Task in 'msecs' milliseconds, for the
+ *  caller to block meanwhile.  laterJoin() waits for it to be done.
+ */
+static Void later(Void (*fxn)(UArg), UArg arg, UInt msecs)
+{
+    laterFxn = fxn;
+    laterArg = arg;
+    laterMsecs = msecs;
+    pthread_create(&laterThread, NULL, laterMain, NULL);
+}
+
+/*
+ *  ======== laterJoin ========
+ */
+static Void laterJoin()
+{
+    pthread_join(laterThread, NULL);
+}
+
+/*
+ *************************************************************************
+ *                      InterruptM3 API (remote side)
+ *************************************************************************
+ */
+
+/*!
+ *  ======== InterruptM3_intRegister ========
+ */
+Void InterruptM3_intRegister(Hwi_FuncPtr fxn)
+{
+    isrFxn = fxn;
+}
+
+/*!
+ *  ======== InterruptM3_intSend ========
+ *  The host reaps its vrings when a test says so, so needs no kick; the
+ *  other core gets its interrupt through the pipe.
+ */
+Void InterruptM3_intSend(UInt16 remoteProcId, UArg arg)
+{
+    UInt32 msg = (UInt32)arg;
+
+    if (remoteProcId == peerProcId) {
+        if (write(irqOut, &msg, sizeof(msg)) != sizeof(msg)) {
+            perror("mqsim: interrupt to other core");
+        }
+    }
+}
+
+/*
+ *  ======== irqMain ========
+ *  The interrupt line from the other core.  VirtQueue_isr runs within
+ *  the Swi gate, so the Swis it posts run as it returns.
+ */
+static Void *irqMain(Void *arg)
+{
+    UInt32 msg;
+    IArg   key;
+
+    while (read(irqIn, &msg, sizeof(msg)) == sizeof(msg)) {
+        key = GateSwi_enter(irqGate);
+        isrFxn(msg);
+        GateSwi_leave(irqGate, key);
+    }
+
+    return (NULL);
+}
+
+/*
+ *  ======== startIrqThread ========
+ *  Call once VirtQueue_startup registered its isr.
+ */
+static Void startIrqThread()
+{
+    irqGate = GateSwi_create(NULL, NULL);
+    pthread_create(&irqThread, NULL, irqMain, NULL);
+}
+
+/*
+ *************************************************************************
+ *                      Host side
+ *************************************************************************
+ */
+
+/*
+ *  ======== hostBuf ========
+ */
+static inline VqSim_MsgHeader *hostBuf(HostRing *r, UInt16 desc)
+{
+    return ((VqSim_MsgHeader *)(UArg)(r->bufs + desc * VQSIM_BUF_SIZE));
+}
+
+/*
+ *  ======== hostKick ========
+ *  Notify CORE0 of new buffers, unless it asked not to be.
+ */
+static Void hostKick(HostRing *r)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (!(r->vr.used->flags & VRING_USED_F_NO_NOTIFY)) {
+        isrFxn(r->id);
+    }
+}
+
+/*
+ *  ======== hostPostRx ========
+ *  Give an rx buffer (back) to CORE0.
+ */
+static Void hostPostRx(UInt16 desc)
+{
+    rxRing.vr.avail->ring[rxRing.availIdx % rxRing.vr.num] = desc;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rxRing.vr.avail->idx = ++rxRing.availIdx;
+}
+
+/*
+ *  ======== hostInit ========
+ *  What rpmsg_probe() does on Linux: all rx buffers made available at
+ *  once, all tx buffers free, and no tx-complete interrupts.  Also lays
+ *  out the resource table, as the host loader leaves it.
+ */
+static Void hostInit()
+{
+    MqSim_ResourceTable *rsc = &rscTable;
+    UInt16              i;
+
+    rsc->version = 1;
+    rsc->num = 3;
+    rsc->offset[0] = offsetof(MqSim_ResourceTable, rpmsg_vdev);
+    rsc->offset[1] = offsetof(MqSim_ResourceTable, ipc_devmem);
+    rsc->offset[2] = offsetof(MqSim_ResourceTable, corelink_devmem);
+
+    rsc->rpmsg_vdev.type = TYPE_VDEV;
+    rsc->rpmsg_vdev.id = VIRTIO_ID_RPMSG;
+    rsc->rpmsg_vdev.dfeatures = 1 << VIRTIO_RPMSG_F_NS;
+    rsc->rpmsg_vdev.gfeatures = 1 << VIRTIO_RPMSG_F_NS;
+    rsc->rpmsg_vdev.num_of_vrings = 2;
+
+    rsc->rpmsg_vring0.da = VQSIM_VRING0_DA;
+    rsc->rpmsg_vring0.align = VQSIM_VRING_ALIGN;
+    rsc->rpmsg_vring0.num = VQSIM_NUM_BUFS;
+    rsc->rpmsg_vring0.notifyid = VQSIM_ID_SYSM3_TO_A9;
+
+    rsc->rpmsg_vring1.da = VQSIM_VRING1_DA;
+    rsc->rpmsg_vring1.align = VQSIM_VRING_ALIGN;
+    rsc->rpmsg_vring1.num = VQSIM_NUM_BUFS;
+    rsc->rpmsg_vring1.notifyid = VQSIM_ID_A9_TO_SYSM3;
+
+    /* The vrings to CORE1 are past the rpmsg ones, as in rsc_table.h */
+    rsc->ipc_devmem.type = TYPE_DEVMEM;
+    rsc->ipc_devmem.da = VQSIM_IPC_DA;
+    rsc->ipc_devmem.pa = VQSIM_IPC_PA;
+    rsc->ipc_devmem.len = MQSIM_CORELINK_DA - VQSIM_IPC_DA;
+    strcpy(rsc->ipc_devmem.name, "IPU_MEM_IPC");
+
+    rsc->corelink_devmem.type = TYPE_DEVMEM;
+    rsc->corelink_devmem.da = MQSIM_CORELINK_DA;
+    rsc->corelink_devmem.pa = MQSIM_CORELINK_PA;
+    rsc->corelink_devmem.len = MQSIM_CORELINK_SIZE;
+    strcpy(rsc->corelink_devmem.name, "IPU_MEM_CORELINK");
+
+    vring_init(&rxRing.vr, VQSIM_NUM_BUFS, (Void *)(UArg)VQSIM_VRING0_DA,
+               VQSIM_VRING_ALIGN);
+    rxRing.id = VQSIM_ID_SYSM3_TO_A9;
+    rxRing.bufs = VQSIM_BUFS0_DA;
+
+    vring_init(&txRing.vr, VQSIM_NUM_BUFS, (Void *)(UArg)VQSIM_VRING1_DA,
+               VQSIM_VRING_ALIGN);
+    txRing.id = VQSIM_ID_A9_TO_SYSM3;
+    txRing.bufs = VQSIM_BUFS1_DA;
+    txRing.vr.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+
+    for (i = 0; i < VQSIM_NUM_BUFS; i++) {
+        rxRing.vr.desc[i].addr = VqSim_vaToPa(hostBuf(&rxRing, i));
+        rxRing.vr.desc[i].len = VQSIM_BUF_SIZE;
+        rxRing.vr.desc[i].flags = VRING_DESC_F_WRITE;
+        hostPostRx(i);
+
+        txFree[i] = VQSIM_NUM_BUFS - 1 - i;
+    }
+    txNumFree = VQSIM_NUM_BUFS;
+}
+
+/*
+ *  ======== hostPost ========
+ *  Make a message from the host available on the tx vring, chaining as
+ *  many buffers as it takes, without a kick.  Returns FALSE if there are
+ *  not enough free.
+ */
+static Bool hostPost(UInt32 dstEndpt, UInt8 *data, UInt16 len)
+{
+    UInt16          descs[VQSIM_MAX_SEGS];
+    UInt            numSegs;
+    UInt            chunk;
+    VqSim_MsgHeader *msg;
+    struct vring_desc *desc;
+    UInt8           *buf;
+    UInt            i;
+
+    numSegs = (sizeof(VqSim_MsgHeader) + len + VQSIM_BUF_SIZE - 1) /
+              VQSIM_BUF_SIZE;
+    if (numSegs > txNumFree) {
+        return (FALSE);
+    }
+
+    for (i = 0; i < numSegs; i++) {
+        descs[i] = txFree[--txNumFree];
+    }
+
+    msg = hostBuf(&txRing, descs[0]);
+    msg->srcAddr = HOST_ENDPT;
+    msg->dstAddr = dstEndpt;
+    msg->reserved = 0;
+    msg->dataLen = len;
+    msg->flags = 0;
+
+    for (i = 0; i < numSegs; i++) {
+        desc = &txRing.vr.desc[descs[i]];
+        buf = (UInt8 *)hostBuf(&txRing, descs[i]);
+        if (i == 0) {
+            buf += sizeof(VqSim_MsgHeader);
+        }
+        chunk = VQSIM_BUF_SIZE - (buf - (UInt8 *)hostBuf(&txRing, descs[i]));
+        if (chunk > len) {
+            chunk = len;
+        }
+        memcpy(buf, data, chunk);
+        data += chunk;
+        len -= chunk;
+
+        desc->addr = VqSim_vaToPa(hostBuf(&txRing, descs[i]));
+        desc->len = (numSegs == 1) ? sizeof(VqSim_MsgHeader) + chunk :
+                                     VQSIM_BUF_SIZE;
+        desc->flags = (i < numSegs - 1) ? VRING_DESC_F_NEXT : 0;
+        desc->next = (i < numSegs - 1) ? descs[i + 1] : 0;
+    }
+
+    txRing.vr.avail->ring[txRing.availIdx % txRing.vr.num] = descs[0];
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    txRing.vr.avail->idx = ++txRing.availIdx;
+
+    return (TRUE);
+}
+
+/*
+ *  ======== hostSend ========
+ *  Send a message from the host: post it, and kick.
+ */
+static Bool hostSend(UInt32 dstEndpt, UInt8 *data, UInt16 len)
+{
+    if (!hostPost(dstEndpt, data, len)) {
+        return (FALSE);
+    }
+    hostKick(&txRing);
+
+    return (TRUE);
+}
+
+/*
+ *  ======== hostSendSeq ========
+ *  Send a message from the host, of a payload made by fill().
+ */
+static Bool hostSendSeq(UInt32 dstEndpt, UInt16 len, UInt32 seq)
+{
+    UInt8 data[MessageQCopy_MAX_DATA_SIZE];
+
+    fill(data, len, seq);
+
+    return (hostSend(dstEndpt, data, len));
+}
+
+/*
+ *  ======== hostReclaim ========
+ *  Take back the tx buffers CORE0 is done with.  Returns the number of
+ *  messages they held.
+ */
+static UInt hostReclaim()
+{
+    struct vring_desc *desc;
+    UInt16 id;
+    UInt   count = 0;
+
+    while (txRing.lastUsed != txRing.vr.used->idx) {
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        id = txRing.vr.used->ring[txRing.lastUsed++ % txRing.vr.num].id;
+        do {
+            desc = &txRing.vr.desc[id];
+            txFree[txNumFree++] = id;
+            id = desc->next;
+        } while (desc->flags & VRING_DESC_F_NEXT);
+        count++;
+    }
+
+    return (count);
+}
+
+/*
+ *  ======== hostRecv ========
+ *  The next message CORE0 sent the host, NULL if none.  Its buffer stays
+ *  the host's until given back with hostPostRx().
+ */
+static VqSim_MsgHeader *hostRecv(UInt16 *desc, UInt32 *len)
+{
+    struct vring_used_elem *used;
+
+    if (rxRing.lastUsed == rxRing.vr.used->idx) {
+        return (NULL);
+    }
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    used = &rxRing.vr.used->ring[rxRing.lastUsed++ % rxRing.vr.num];
+    *desc = used->id;
+    *len = used->len;
+
+    return (hostBuf(&rxRing, used->id));
+}
+
+/*
+ *  ======== hostRecvAll ========
+ *  Give back all rx buffers CORE0 used, and kick it if it asked to be.
+ *  Returns the number of messages they held.
+ */
+static UInt hostRecvAll()
+{
+    UInt16 desc;
+    UInt32 len;
+    UInt   count = 0;
+
+    while (hostRecv(&desc, &len) != NULL) {
+        hostPostRx(desc);
+        count++;
+    }
+    hostKick(&rxRing);
+
+    return (count);
+}
+
+/*
+ *  ======== hostRecvAllLater ========
+ */
+static Void hostRecvAllLater(UArg arg)
+{
+    hostRecvAll();
+}
+
+/*
+ *************************************************************************
+ *                      Tests
+ *************************************************************************
+ */
+
+/*
+ *  ======== sendSeq ========
+ *  Send from this processor a payload made by fill().
+ */
+static Int sendSeq(UInt16 dstProc, UInt32 dstEndpt, UInt32 srcEndpt,
+                   UInt16 len, UInt32 seq)
+{
+    UInt8 data[MessageQCopy_MAX_DATA_SIZE];
+
+    fill(data, len, seq);
+
+    return (MessageQCopy_send(dstProc, dstEndpt, srcEndpt, data, len));
+}
+
+/*
+ *  ======== sendSeqLater ========
+ */
+static Void sendSeqLater(UArg endpt)
+{
+    sendSeq(selfProcId, (UInt32)endpt, (UInt32)endpt, 16, 99);
+}
+
+/*
+ *  ======== hostSendLater ========
+ */
+static Void hostSendLater(UArg endpt)
+{
+    hostSendSeq((UInt32)endpt, 16, 98);
+}
+
+/*
+ *  ======== testRecvMany ========
+ */
+static Void testRecvMany()
+{
+    MessageQCopy_RecvMsg msgs[8];
+    MessageQCopy_Handle  handle;
+    UInt32               endpt;
+    UInt32               start;
+    UInt                 count;
+    UInt                 i;
+
+    handle = MessageQCopy_create(MessageQCopy_ASSIGN_ANY, &endpt);
+    CHECK(handle != NULL);
+
+    /* A batch at most 'max' long, in order, then the rest */
+    for (i = 0; i < 5; i++) {
+        CHECK(sendSeq(selfProcId, endpt, 77, 16 + i, i) ==
+              MessageQCopy_S_SUCCESS);
+    }
+    CHECK(MessageQCopy_recvMany(handle, msgs, 3, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(count == 3);
+    for (i = 0; i < count; i++) {
+        CHECK(msgs[i].len == 16 + i);
+        CHECK(msgs[i].rplyEndpt == 77);
+        CHECK(filled(msgs[i].data, msgs[i].len, i));
+        CHECK(MessageQCopy_releaseBuf(handle, msgs[i].data) ==
+              MessageQCopy_S_SUCCESS);
+    }
+    CHECK(MessageQCopy_recvMany(handle, msgs, 8, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(count == 2);
+    for (i = 0; i < count; i++) {
+        CHECK(msgs[i].len == 19 + i);
+        CHECK(filled(msgs[i].data, msgs[i].len, 3 + i));
+        MessageQCopy_releaseBuf(handle, msgs[i].data);
+    }
+    CHECK(MessageQCopy_recvMany(handle, msgs, 8, &count, 0) ==
+          MessageQCopy_E_TIMEOUT);
+    CHECK(count == 0);
+
+    /* From the host, in their vring buffers */
+    for (i = 0; i < 4; i++) {
+        CHECK(hostSendSeq(endpt, 100, 10 + i));
+    }
+    CHECK(MessageQCopy_recvMany(handle, msgs, 8, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(count == 4);
+    for (i = 0; i < count; i++) {
+        CHECK(msgs[i].len == 100);
+        CHECK(msgs[i].rplyEndpt == HOST_ENDPT);
+        CHECK(filled(msgs[i].data, msgs[i].len, 10 + i));
+        MessageQCopy_releaseBuf(handle, msgs[i].data);
+    }
+    CHECK(hostReclaim() == 4);
+
+    /* Blocking until a message comes, and timing out */
+    later(sendSeqLater, endpt, 20);
+    CHECK(MessageQCopy_recvMany(handle, msgs, 8, &count,
+                                MessageQCopy_FOREVER) ==
+          MessageQCopy_S_SUCCESS);
+    laterJoin();
+    CHECK((count == 1) && filled(msgs[0].data, 16, 99));
+    MessageQCopy_releaseBuf(handle, msgs[0].data);
+
+    start = Clock_getTicks();
+    CHECK(MessageQCopy_recvMany(handle, msgs, 8, &count, 30) ==
+          MessageQCopy_E_TIMEOUT);
+    CHECK(Clock_getTicks() - start >= 30);
+
+    /* Unblocked, with messages queued: those go with the endpoint */
+    sendSeq(selfProcId, endpt, endpt, 16, 0);
+    sendSeq(selfProcId, endpt, endpt, 16, 1);
+    MessageQCopy_unblock(handle);
+    CHECK(MessageQCopy_recvMany(handle, msgs, 8, &count, 0) ==
+          MessageQCopy_E_UNBLOCKED);
+    CHECK(count == 0);
+
+    CHECK(MessageQCopy_delete(&handle) == MessageQCopy_S_SUCCESS);
+    CHECK(handle == NULL);
+}
+
+/*
+ *  ======== testSets ========
+ */
+static Void testSets()
+{
+    MessageQCopy_SetHandle set;
+    MessageQCopy_SetHandle other;
+    MessageQCopy_Handle    handles[4];
+    MessageQCopy_Handle    h1;
+    MessageQCopy_Handle    h2;
+    UInt32                 e1;
+    UInt32                 e2;
+    UInt32                 start;
+    UInt8                  data[16];
+    UInt16                 len;
+    UInt32                 src;
+    UInt                   count;
+
+    set = MessageQCopy_createSet();
+    other = MessageQCopy_createSet();
+    h1 = MessageQCopy_create(MessageQCopy_ASSIGN_ANY, &e1);
+    h2 = MessageQCopy_create(MessageQCopy_ASSIGN_ANY, &e2);
+    CHECK(set && other && h1 && h2);
+
+    CHECK(MessageQCopy_addToSet(set, h1) == MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_addToSet(set, h2) == MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_addToSet(other, h1) == MessageQCopy_E_FAIL);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_E_TIMEOUT);
+    CHECK(count == 0);
+
+    /* Returned while it has messages, and only then */
+    sendSeq(selfProcId, e2, e2, 16, 0);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((count == 1) && (handles[0] == h2));
+    CHECK(MessageQCopy_recv(h2, data, &len, &src, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_E_TIMEOUT);
+
+    sendSeq(selfProcId, e1, e1, 16, 0);
+    sendSeq(selfProcId, e1, e1, 16, 1);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((count == 1) && (handles[0] == h1));
+    MessageQCopy_recv(h1, data, &len, &src, 0);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((count == 1) && (handles[0] == h1));
+    MessageQCopy_recv(h1, data, &len, &src, 0);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_E_TIMEOUT);
+
+    /* At most 'max' at a time, the others left for the next call */
+    sendSeq(selfProcId, e1, e1, 16, 0);
+    sendSeq(selfProcId, e2, e2, 16, 0);
+    CHECK(MessageQCopy_waitSet(set, handles, 1, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(count == 1);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((count == 2) && (handles[0] != handles[1]));
+    MessageQCopy_recv(h1, data, &len, &src, 0);
+    MessageQCopy_recv(h2, data, &len, &src, 0);
+
+    /* From the host, too */
+    CHECK(hostSendSeq(e2, 16, 0));
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((count == 1) && (handles[0] == h2));
+    MessageQCopy_recv(h2, data, &len, &src, 0);
+    CHECK(hostReclaim() == 1);
+
+    /* Not once removed; right away if added with messages waiting */
+    CHECK(MessageQCopy_removeFromSet(set, h1) == MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_removeFromSet(set, h1) == MessageQCopy_E_FAIL);
+    sendSeq(selfProcId, e1, e1, 16, 0);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_E_TIMEOUT);
+    CHECK(MessageQCopy_addToSet(set, h1) == MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((count == 1) && (handles[0] == h1));
+    MessageQCopy_recv(h1, data, &len, &src, 0);
+
+    /* Blocking until a message comes, and timing out */
+    later(sendSeqLater, e2, 20);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count,
+                               MessageQCopy_FOREVER) ==
+          MessageQCopy_S_SUCCESS);
+    laterJoin();
+    CHECK((count == 1) && (handles[0] == h2));
+    MessageQCopy_recv(h2, data, &len, &src, 0);
+
+    later(hostSendLater, e1, 20);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count,
+                               MessageQCopy_FOREVER) ==
+          MessageQCopy_S_SUCCESS);
+    laterJoin();
+    CHECK((count == 1) && (handles[0] == h1));
+    MessageQCopy_recv(h1, data, &len, &src, 0);
+    CHECK(hostReclaim() == 1);
+
+    start = Clock_getTicks();
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 30) ==
+          MessageQCopy_E_TIMEOUT);
+    CHECK(Clock_getTicks() - start >= 30);
+
+    /* An unblocked endpoint is returned, for its receiver to find out */
+    MessageQCopy_unblock(h2);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((count == 1) && (handles[0] == h2));
+
+    /*
+     * An endpoint deleted leaves its set, and one deleted with endpoints
+     * in it lets go of them.
+     */
+    sendSeq(selfProcId, e2, e2, 16, 0);
+    CHECK(MessageQCopy_delete(&h2) == MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_waitSet(set, handles, 4, &count, 0) ==
+          MessageQCopy_E_TIMEOUT);
+    sendSeq(selfProcId, e1, e1, 16, 0);
+    CHECK(MessageQCopy_deleteSet(&set) == MessageQCopy_S_SUCCESS);
+    CHECK(set == NULL);
+    CHECK(MessageQCopy_addToSet(other, h1) == MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_waitSet(other, handles, 4, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((count == 1) && (handles[0] == h1));
+
+    CHECK(MessageQCopy_delete(&h1) == MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_deleteSet(&other) == MessageQCopy_S_SUCCESS);
+}
+
+/*
+ *  ======== logCallback ========
+ *  Record a call, in the CallbackLog it was created with.
+ */
+static Void logCallback(MessageQCopy_Handle handle, UArg arg, Ptr data,
+                        UInt16 len, UInt32 srcEndpt)
+{
+    CallbackLog *log = (CallbackLog *)arg;
+
+    log->calls++;
+    if (Swi_self() == NULL) {
+        log->notInSwi++;
+    }
+    log->handle = handle;
+    log->arg = arg;
+    log->len = len;
+    log->src = srcEndpt;
+    memcpy(log->data, data, len);
+}
+
+/*
+ *  ======== testCallbacks ========
+ */
+static Void testCallbacks()
+{
+    static CallbackLog  log;
+    MessageQCopy_Handle handle;
+    UInt32              endpt;
+    Ptr                 data;
+    UInt16              maxLen;
+
+    memset(&log, 0, sizeof(log));
+    handle = MessageQCopy_createWithCallback(MessageQCopy_ASSIGN_ANY, &endpt,
+                                             logCallback, (UArg)&log);
+    CHECK(handle != NULL);
+
+    /* Sent from a Task of this processor: called by the Swi still */
+    CHECK(sendSeq(selfProcId, endpt, 55, 40, 1) == MessageQCopy_S_SUCCESS);
+    CHECK(log.calls == 1);
+    CHECK((log.handle == handle) && (log.arg == (UArg)&log));
+    CHECK((log.len == 40) && (log.src == 55) && filled(log.data, 40, 1));
+
+    CHECK(MessageQCopy_allocBuf(selfProcId, 56, &data, &maxLen) ==
+          MessageQCopy_S_SUCCESS);
+    fill(data, 200, 2);
+    CHECK(MessageQCopy_sendBuf(selfProcId, endpt, 56, data, 200) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(log.calls == 2);
+    CHECK((log.len == 200) && (log.src == 56) && filled(log.data, 200, 2));
+
+    /* From the host: in its buffer, or chained ones */
+    CHECK(hostSendSeq(endpt, 300, 3));
+    CHECK(log.calls == 3);
+    CHECK((log.len == 300) && (log.src == HOST_ENDPT) &&
+          filled(log.data, 300, 3));
+    CHECK(hostSendSeq(endpt, 1500, 4));
+    CHECK(log.calls == 4);
+    CHECK((log.len == 1500) && filled(log.data, 1500, 4));
+    CHECK(hostReclaim() == 2);
+
+    CHECK(log.notInSwi == 0);
+
+    /* None once deleted */
+    CHECK(MessageQCopy_delete(&handle) == MessageQCopy_S_SUCCESS);
+    CHECK(sendSeq(selfProcId, endpt, 55, 40, 1) == MessageQCopy_E_NOENDPT);
+    CHECK(hostSendSeq(endpt, 300, 3));
+    CHECK(hostReclaim() == 1);
+    CHECK(log.calls == 4);
+}
+
+/*
+ *  ======== testZeroCopy ========
+ */
+static Void testZeroCopy()
+{
+    MessageQCopy_RecvMsg msgs[8];
+    MessageQCopy_Handle  handle;
+    VqSim_MsgHeader      *msg;
+    UInt32               endpt;
+    UInt8                buf[16];
+    Ptr                  data;
+    Ptr                  data2;
+    UInt16               maxLen;
+    UInt16               len;
+    UInt16               desc;
+    UInt32               src;
+    UInt32               used;
+    UInt                 count;
+    UInt                 i;
+
+    handle = MessageQCopy_create(MessageQCopy_ASSIGN_ANY, &endpt);
+    CHECK(handle != NULL);
+
+    /* Host messages stay in their buffers until released */
+    CHECK(MessageQCopy_recvBuf(handle, &data, &len, &src, 0) ==
+          MessageQCopy_E_TIMEOUT);
+    for (i = 0; i < 3; i++) {
+        CHECK(hostSendSeq(endpt, 64, i));
+    }
+    CHECK(MessageQCopy_recvMany(handle, msgs, 8, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(count == 3);
+    for (i = 0; i < count; i++) {
+        CHECK(((UArg)msgs[i].data >= VQSIM_BUFS1_DA) &&
+              ((UArg)msgs[i].data < VQSIM_BUFS1_DA +
+                                    VQSIM_NUM_BUFS * VQSIM_BUF_SIZE));
+        CHECK((msgs[i].len == 64) && filled(msgs[i].data, 64, i));
+    }
+    CHECK(hostReclaim() == 0);
+    for (i = 0; i < count; i++) {
+        CHECK(MessageQCopy_releaseBuf(handle, msgs[i].data) ==
+              MessageQCopy_S_SUCCESS);
+    }
+    CHECK(hostReclaim() == 3);
+
+    /* Chained ones are copied, and given back right away */
+    CHECK(hostSendSeq(endpt, 1000, 5));
+    CHECK(hostReclaim() == 1);
+    CHECK(MessageQCopy_recvBuf(handle, &data, &len, &src, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((len == 1000) && (src == HOST_ENDPT) && filled(data, 1000, 5));
+    MessageQCopy_releaseBuf(handle, data);
+
+    /* MessageQCopy_recv() copies a held message out, and releases it */
+    CHECK(hostSendSeq(endpt, 16, 6));
+    CHECK(MessageQCopy_recv(handle, buf, &len, &src, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((len == 16) && filled(buf, 16, 6));
+    CHECK(hostReclaim() == 1);
+
+    /* Sent straight from a host buffer */
+    CHECK(MessageQCopy_allocBuf(hostProcId, endpt, &data, &maxLen) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(maxLen == MAX_BUF_PAYLOAD);
+    fill(data, 100, 7);
+    CHECK(MessageQCopy_sendBuf(hostProcId, HOST_ENDPT, endpt, data, 100) ==
+          MessageQCopy_S_SUCCESS);
+    msg = hostRecv(&desc, &used);
+    CHECK((msg != NULL) && ((Ptr)msg->payload == data));
+    CHECK((msg != NULL) && (msg->dataLen == 100) &&
+          (msg->srcAddr == endpt) && (msg->dstAddr == HOST_ENDPT) &&
+          filled(msg->payload, 100, 7));
+    CHECK(used == sizeof(VqSim_MsgHeader) + 100);
+    if (msg != NULL) {
+        hostPostRx(desc);
+    }
+
+    /* ... or given back unsent: the next one reserved is the same buffer */
+    CHECK(MessageQCopy_allocBuf(hostProcId, endpt, &data, &maxLen) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_freeBuf(hostProcId, endpt, data) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(hostRecv(&desc, &used) == NULL);
+    CHECK(MessageQCopy_allocBuf(hostProcId, endpt, &data2, &maxLen) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(data2 == data);
+
+    /* ... unless one reserved after it is outstanding: it goes out empty */
+    CHECK(MessageQCopy_allocBuf(hostProcId, endpt, &data, &maxLen) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_freeBuf(hostProcId, endpt, data2) ==
+          MessageQCopy_S_SUCCESS);
+    fill(data, 20, 11);
+    CHECK(MessageQCopy_sendBuf(hostProcId, HOST_ENDPT, endpt, data, 20) ==
+          MessageQCopy_S_SUCCESS);
+    msg = hostRecv(&desc, &used);
+    CHECK((msg != NULL) && ((Ptr)msg->payload == data2) &&
+          (msg->dataLen == 0) && (msg->dstAddr == MessageQCopy_ASSIGN_ANY));
+    if (msg != NULL) {
+        hostPostRx(desc);
+    }
+    msg = hostRecv(&desc, &used);
+    CHECK((msg != NULL) && ((Ptr)msg->payload == data) &&
+          (msg->dataLen == 20) && filled(msg->payload, 20, 11));
+    if (msg != NULL) {
+        hostPostRx(desc);
+    }
+    CHECK(MessageQCopy_freeBuf(hostProcId, endpt, data) ==
+          MessageQCopy_E_FAIL);
+
+    /* ... or a local copy, which the receiver is given as is */
+    CHECK(MessageQCopy_allocBuf(selfProcId, endpt, &data, &maxLen) ==
+          MessageQCopy_S_SUCCESS);
+    fill(data, maxLen, 8);
+    CHECK(MessageQCopy_sendBuf(selfProcId, endpt, 57, data, maxLen) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_recvMany(handle, msgs, 8, &count, 0) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK((count == 1) && (msgs[0].data == data) &&
+          (msgs[0].len == maxLen) && (msgs[0].rplyEndpt == 57));
+    MessageQCopy_releaseBuf(handle, msgs[0].data);
+
+    CHECK(MessageQCopy_allocBuf(selfProcId, endpt, &data, &maxLen) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_sendBuf(selfProcId, endpt + 1, endpt, data, 16) ==
+          MessageQCopy_E_NOENDPT);
+
+    CHECK(MessageQCopy_allocBuf(selfProcId, endpt, &data, &maxLen) ==
+          MessageQCopy_S_SUCCESS);
+    CHECK(MessageQCopy_freeBuf(selfProcId, endpt, data) ==
+          MessageQCopy_S_SUCCESS);
+
+    /* Deleted with messages held: the buffers go back to the host */
+    CHECK(hostSendSeq(endpt, 16, 9));
+    CHECK(hostSendSeq(endpt, 16, 10));
+    CHECK(hostReclaim() == 0);
+    CHECK(MessageQCopy_delete(&handle) == MessageQCopy_S_SUCCESS);
+    CHECK(hostReclaim() == 2);
+}
+
+/*
+ *  ======== testSendToHost ========
+ */
+static Void testSendToHost()
+{
+    VqSim_MsgHeader *msg;
+    UInt32          start;
+    UInt32          used;
+    UInt16          desc;
+    UInt            i;
+
+    CHECK(sendSeq(hostProcId, HOST_ENDPT, 58, MAX_BUF_PAYLOAD, 1) ==
+          MessageQCopy_S_SUCCESS);
+    msg = hostRecv(&desc, &used);
+    CHECK((msg != NULL) && (msg->dataLen == MAX_BUF_PAYLOAD) &&
+          (msg->srcAddr == 58) && filled(msg->payload, MAX_BUF_PAYLOAD, 1));
+    if (msg != NULL) {
+        hostPostRx(desc);
+    }
+
+    /* The host's rx buffers are not chained: nothing is sent */
+    CHECK(sendSeq(hostProcId, HOST_ENDPT, 58, MAX_BUF_PAYLOAD + 1, 1) ==
+          MessageQCopy_E_FAIL);
+    CHECK(hostRecvAll() == 0);
+
+    /* Out of buffers: fail, time out, or wait for the host */
+    for (i = 0; i < VQSIM_NUM_BUFS; i++) {
+        CHECK(sendSeq(hostProcId, HOST_ENDPT, 58, 16, i) ==
+              MessageQCopy_S_SUCCESS);
+    }
+    CHECK(sendSeq(hostProcId, HOST_ENDPT, 58, 16, i) == MessageQCopy_E_FAIL);
+
+    start = Clock_getTicks();
+    CHECK(MessageQCopy_sendTimeout(hostProcId, HOST_ENDPT, 58, "late", 4,
+                                   30) == MessageQCopy_E_TIMEOUT);
+    CHECK(Clock_getTicks() - start >= 30);
+
+    later(hostRecvAllLater, 0, 20);
+    CHECK(MessageQCopy_sendTimeout(hostProcId, HOST_ENDPT, 58, "wait", 4,
+                                   MessageQCopy_FOREVER) ==
+          MessageQCopy_S_SUCCESS);
+    laterJoin();
+
+    /* With no sender waiting, the host is asked not to kick again */
+    CHECK(rxRing.vr.used->flags & VRING_USED_F_NO_NOTIFY);
+    CHECK(hostRecvAll() == 1);
+}
+
+/*
+ *  ======== testSwiBudget ========
+ */
+static Void testSwiBudget()
+{
+    static CallbackLog  log;
+    MessageQCopy_Handle handle;
+    UInt32              endpt;
+    UInt8               data[16];
+    UInt                i;
+
+    /* Timestamp counts in nanoseconds: more than 32 bits' worth */
+    CHECK(MessageQCopy_setSwiBudget(0, 5000000) == MessageQCopy_E_FAIL);
+    CHECK(MessageQCopy_setSwiBudget(0, 1000) == MessageQCopy_S_SUCCESS);
+
+    memset(&log, 0, sizeof(log));
+    handle = MessageQCopy_createWithCallback(MessageQCopy_ASSIGN_ANY, &endpt,
+                                             logCallback, (UArg)&log);
+
+    /* Two messages a run, the rest left to a Clock tick later */
+    CHECK(MessageQCopy_setSwiBudget(2, 0) == MessageQCopy_S_SUCCESS);
+    for (i = 0; i < 5; i++) {
+        fill(data, sizeof(data), i);
+        CHECK(hostPost(endpt, data, sizeof(data)));
+    }
+    hostKick(&txRing);
+    CHECK(log.calls == 2);
+    BiosSim_clockTick();
+    CHECK(log.calls == 4);
+    BiosSim_clockTick();
+    CHECK(log.calls == 5);
+    CHECK(filled(log.data, sizeof(data), 4));
+
+    CHECK(MessageQCopy_setSwiBudget(0, 0) == MessageQCopy_S_SUCCESS);
+    CHECK(hostReclaim() == 5);
+    MessageQCopy_delete(&handle);
+}
+
+/*
+ *  ======== testPriority ========
+ */
+static Void testPriority()
+{
+    MessageQCopy_Handle handle;
+    VqSim_MsgHeader     *msg;
+    UInt32              endpt;
+    UInt32              used;
+    UInt16              desc;
+
+    handle = MessageQCopy_create(MessageQCopy_ASSIGN_ANY, &endpt);
+    CHECK(MessageQCopy_setPriority(handle, MessageQCopy_NUM_PRIORITIES) ==
+          MessageQCopy_E_FAIL);
+    CHECK(MessageQCopy_setPriority(handle, MessageQCopy_PRIORITY_BULK) ==
+          MessageQCopy_S_SUCCESS);
+
+    /* No vdev of its own in the resource table: the normal vrings */
+    CHECK(sendSeq(hostProcId, HOST_ENDPT, endpt, 16, 1) ==
+          MessageQCopy_S_SUCCESS);
+    msg = hostRecv(&desc, &used);
+    CHECK((msg != NULL) && (msg->srcAddr == endpt) &&
+          filled(msg->payload, 16, 1));
+    if (msg != NULL) {
+        hostPostRx(desc);
+    }
+
+    MessageQCopy_delete(&handle);
+}
+
+/*
+ *  ======== fillClass ========
+ *  Send 'len' byte messages to an endpoint until out of memory, then
+ *  receive them all.  Returns the number sent.
+ */
+static UInt fillClass(MessageQCopy_Handle handle, UInt32 endpt, UInt16 len)
+{
+    UInt8  data[MessageQCopy_MAX_DATA_SIZE];
+    UInt16 got;
+    UInt32 src;
+    UInt   sent = 0;
+    UInt   i;
+    Int    status;
+
+    while ((status = sendSeq(selfProcId, endpt, endpt, len, sent)) ==
+           MessageQCopy_S_SUCCESS) {
+        sent++;
+    }
+    CHECK(status == MessageQCopy_E_MEMORY);
+
+    for (i = 0; i < sent; i++) {
+        CHECK(MessageQCopy_recv(handle, data, &got, &src, 0) ==
+              MessageQCopy_S_SUCCESS);
+        CHECK((got == len) && filled(data, len, i));
+    }
+    CHECK(MessageQCopy_recv(handle, data, &got, &src, 0) ==
+          MessageQCopy_E_TIMEOUT);
+
+    return (sent);
+}
+
+/*
+ *  ======== sendCoreSeq ========
+ *  Send to the other core a payload made by fill(), trying again while
+ *  it has not returned a buffer: its vrings do not kick waiting senders.
+ */
+static Int sendCoreSeq(UInt32 dstEndpt, UInt32 srcEndpt, UInt16 len,
+                       UInt32 seq)
+{
+    UInt8 data[MessageQCopy_MAX_DATA_SIZE];
+    Int   status;
+    UInt  i;
+
+    fill(data, len, seq);
+
+    for (i = 0; i < CORE_SEND_TRIES; i++) {
+        status = MessageQCopy_send(peerProcId, dstEndpt, srcEndpt, data, len);
+        if (status != MessageQCopy_E_FAIL) {
+            break;
+        }
+        usleep(1000);
+    }
+
+    return (status);
+}
+
+/*
+ *  ======== core1Serve ========
+ *  CORE1: answer the messages queued on one of its endpoints.  Returns
+ *  FALSE once told to quit, with an empty message to the echo endpoint.
+ */
+static Bool core1Serve(MessageQCopy_Handle handle, UInt32 endpt)
+{
+    UInt8  data[MessageQCopy_MAX_DATA_SIZE];
+    UInt16 len;
+    UInt32 src;
+    UInt32 count;
+    UInt32 i;
+
+    while (MessageQCopy_recv(handle, data, &len, &src, 0) ==
+           MessageQCopy_S_SUCCESS) {
+        if (endpt == CORE1_ECHO_ENDPT) {
+            if (len == 0) {
+                return (FALSE);
+            }
+            CHECK(MessageQCopy_send(peerProcId, src, endpt, data, len) ==
+                  MessageQCopy_S_SUCCESS);
+        }
+        else {
+            /* A burst of 'count' messages, as sendCoreSeq makes them */
+            memcpy(&count, data, sizeof(count));
+            for (i = 0; i < count; i++) {
+                CHECK(sendCoreSeq(src, endpt, 16 + i % 400, i) ==
+                      MessageQCopy_S_SUCCESS);
+            }
+        }
+    }
+
+    return (TRUE);
+}
+
+/*
+ *  ======== core1Main ========
+ *  The CORE1 process: serves its two endpoints, waiting on both as a set,
+ *  until CORE0 tells it to quit.  Returns its exit status.
+ */
+static Int core1Main()
+{
+    MessageQCopy_SetHandle set;
+    MessageQCopy_Handle    handles[2];
+    MessageQCopy_Handle    echo;
+    MessageQCopy_Handle    burst;
+    UInt32                 endpt;
+    UInt32                 msg;
+    UInt                   count;
+    UInt                   i;
+    Bool                   serving = TRUE;
+
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+
+    /* Until CORE0 laid out the vrings, it answers no request for them */
+    do {
+        if (read(irqIn, &msg, sizeof(msg)) != sizeof(msg)) {
+            return (1);
+        }
+    } while (msg != MQSIM_GO);
+
+    MultiProc_setLocalId(MultiProc_getId("CORE1"));
+    hostProcId = MultiProc_getId("HOST");
+    selfProcId = MultiProc_self();
+    peerProcId = MultiProc_getId("CORE0");
+
+    /* CORE1 has no resource table of its own */
+    VirtQueue_setResourceTable(NULL);
+    VirtQueue_startup();
+    MessageQCopy_init(hostProcId);
+    startIrqThread();
+
+    echo = MessageQCopy_create(CORE1_ECHO_ENDPT, &endpt);
+    burst = MessageQCopy_create(CORE1_BURST_ENDPT, &endpt);
+    set = MessageQCopy_createSet();
+    CHECK(echo && burst && set);
+    MessageQCopy_addToSet(set, echo);
+    MessageQCopy_addToSet(set, burst);
+
+    while (serving) {
+        if (MessageQCopy_waitSet(set, handles, 2, &count,
+                                 MessageQCopy_FOREVER) !=
+            MessageQCopy_S_SUCCESS) {
+            CHECK(FALSE);
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            if (!core1Serve(handles[i], (handles[i] == echo) ?
+                            CORE1_ECHO_ENDPT : CORE1_BURST_ENDPT)) {
+                serving = FALSE;
+            }
+        }
+    }
+
+    MessageQCopy_delete(&echo);
+    MessageQCopy_delete(&burst);
+    MessageQCopy_deleteSet(&set);
+
+    printf("mqsim: CORE1            %s\n", (errors == 0) ? "ok" : "FAILED");
+
+    return (errors == 0 ? 0 : 1);
+}
+
+/*
+ *  ======== recvCoreSeq ========
+ *  Receive, within CORE_WAIT, a message made by fill() from the other
+ *  core's endpoint 'src'.
+ */
+static Bool recvCoreSeq(MessageQCopy_Handle handle, UInt32 src, UInt16 len,
+                        UInt32 seq)
+{
+    UInt8  data[MessageQCopy_MAX_DATA_SIZE];
+    UInt16 got;
+    UInt32 from;
+
+    if (MessageQCopy_recv(handle, data, &got, &from, CORE_WAIT) !=
+        MessageQCopy_S_SUCCESS) {
+        CHECK(!"no message from CORE1");
+        return (FALSE);
+    }
+    CHECK((got == len) && (from == src) && filled(data, len, seq));
+
+    return (TRUE);
+}
+
+/*
+ *  ======== testCoreLink ========
+ *  Messages both ways between CORE0, driving the vrings, and CORE1.
+ */
+static Void testCoreLink()
+{
+    static CallbackLog   log;
+    MessageQCopy_RecvMsg msgs[16];
+    MessageQCopy_Handle  handle;
+    MessageQCopy_Handle  cbHandle;
+    UInt32               endpt;
+    UInt32               cbEndpt;
+    UInt32               burst;
+    UInt32               got;
+    UInt32               i;
+    UInt32               j;
+    UInt                 count;
+    UInt16               maxLen;
+    Ptr                  data;
+    Int                  status;
+    Bool                 linked = TRUE;
+    UInt                 before = errors;
+
+    handle = MessageQCopy_create(MessageQCopy_ASSIGN_ANY, &endpt);
+
+    /*
+     * Echoed back a window at a time: the 64 buffers of each vring are
+     * used over many times, CORE0 taking them back as CORE1 returns them.
+     */
+    for (i = 0; (i < 320) && linked; i += 16) {
+        for (j = i; j < i + 16; j++) {
+            CHECK(sendCoreSeq(CORE1_ECHO_ENDPT, endpt,
+                              1 + j * 7 % MAX_BUF_PAYLOAD, j) ==
+                  MessageQCopy_S_SUCCESS);
+        }
+        for (j = i; (j < i + 16) && linked; j++) {
+            linked = recvCoreSeq(handle, CORE1_ECHO_ENDPT,
+                                 1 + j * 7 % MAX_BUF_PAYLOAD, j);
+        }
+    }
+
+    /* Straight from a buffer of the vring to CORE1 */
+    for (i = 0; (i < CORE_SEND_TRIES) && linked; i++) {
+        if ((status = MessageQCopy_allocBuf(peerProcId, endpt, &data,
+                &maxLen)) == MessageQCopy_S_SUCCESS) {
+            break;
+        }
+        usleep(1000);
+    }
+    if (linked) {
+        /* One given back unsent is sent in later */
+        CHECK(status == MessageQCopy_S_SUCCESS);
+        CHECK(MessageQCopy_freeBuf(peerProcId, endpt, data) ==
+              MessageQCopy_S_SUCCESS);
+        CHECK(MessageQCopy_allocBuf(peerProcId, endpt, &data, &maxLen) ==
+              MessageQCopy_S_SUCCESS);
+        CHECK(maxLen == MAX_BUF_PAYLOAD);
+        fill(data, maxLen, 7);
+        CHECK(MessageQCopy_sendBuf(peerProcId, CORE1_ECHO_ENDPT, endpt, data,
+                                   maxLen) == MessageQCopy_S_SUCCESS);
+        linked = recvCoreSeq(handle, CORE1_ECHO_ENDPT, MAX_BUF_PAYLOAD, 7);
+    }
+
+    /* More from CORE1 than its vring has buffers, in batches */
+    burst = 200;
+    if (linked) {
+        CHECK(MessageQCopy_send(peerProcId, CORE1_BURST_ENDPT, endpt, &burst,
+                                sizeof(burst)) == MessageQCopy_S_SUCCESS);
+    }
+    for (got = 0; (got < burst) && linked; got += count) {
+        if (MessageQCopy_recvMany(handle, msgs, 16, &count, CORE_WAIT) !=
+            MessageQCopy_S_SUCCESS) {
+            CHECK(!"no burst from CORE1");
+            linked = FALSE;
+            break;
+        }
+        for (i = 0; i < count; i++) {
+            CHECK((msgs[i].len == 16 + (got + i) % 400) &&
+                  (msgs[i].rplyEndpt == CORE1_BURST_ENDPT) &&
+                  filled(msgs[i].data, msgs[i].len, got + i));
+            MessageQCopy_releaseBuf(handle, msgs[i].data);
+        }
+    }
+
+    /* ... and to a callback endpoint, called by the Swi */
+    memset(&log, 0, sizeof(log));
+    cbHandle = MessageQCopy_createWithCallback(MessageQCopy_ASSIGN_ANY,
+            &cbEndpt, logCallback, (UArg)&log);
+    burst = 100;
+    if (linked) {
+        CHECK(MessageQCopy_send(peerProcId, CORE1_BURST_ENDPT, cbEndpt,
+                                &burst, sizeof(burst)) ==
+              MessageQCopy_S_SUCCESS);
+        for (i = 0; (i < CORE_WAIT) && (log.calls < burst); i++) {
+            usleep(1000);
+        }
+        CHECK(log.calls == burst);
+        CHECK(log.notInSwi == 0);
+        CHECK((log.src == CORE1_BURST_ENDPT) &&
+              (log.len == 16 + (burst - 1) % 400) &&
+              filled(log.data, log.len, burst - 1));
+    }
+
+    /* An empty message to the echo endpoint ends CORE1 */
+    if (errors == before) {
+        CHECK(sendCoreSeq(CORE1_ECHO_ENDPT, endpt, 0, 0) ==
+              MessageQCopy_S_SUCCESS);
+    }
+    else {
+        kill(core1Pid, SIGKILL);
+    }
+    CHECK(waitpid(core1Pid, &status, 0) == core1Pid);
+    CHECK(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+
+    MessageQCopy_delete(&cbHandle);
+    MessageQCopy_delete(&handle);
+}
+
+/*
+ *  ======== testSizeClasses ========
+ *  A message takes a block of the smallest class it fits, or of a larger
+ *  one once those run out.  Run last: every block must be free again.
+ */
+static Void testSizeClasses()
+{
+    MessageQCopy_Handle handle;
+    UInt32              endpt;
+    Int                 pass;
+
+    handle = MessageQCopy_create(MessageQCopy_ASSIGN_ANY, &endpt);
+
+    /* Twice, to see each block went back to the heap it is from */
+    for (pass = 0; pass < 2; pass++) {
+        CHECK(fillClass(handle, endpt, 8) == SMALL_COPIES);
+        CHECK(fillClass(handle, endpt, 100) == MEDIUM_COPIES);
+        CHECK(fillClass(handle, endpt, 400) == MSGBUF_COPIES);
+        CHECK(fillClass(handle, endpt, 2000) == LARGE_COPIES);
+    }
+
+    MessageQCopy_delete(&handle);
+}
+
+/*
+ *  ======== runTest ========
+ */
+static Void runTest(String name, Void (*test)())
+{
+    UInt before = errors;
+
+    test();
+    printf("mqsim: %-16s %s\n", name, (errors == before) ? "ok" : "FAILED");
+}
+
+/*
+ *  ======== mapIpcWindow ========
+ */
+static Int mapIpcWindow()
+{
+    Void *addr;
+
+    /*
+     * Same address as the M3 sees, so VirtQueue.c needs no changes, and
+     * shared with CORE1, forked later
+     */
+    addr = mmap((Void *)(UArg)VQSIM_IPC_DA, VQSIM_IPC_SIZE,
+                PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (addr != (Void *)(UArg)VQSIM_IPC_DA) {
+        perror("mqsim: mmap at IPC_DA");
+        return (-1);
+    }
+
+    return (0);
+}
+
+/*
+ *  ======== main ========
+ */
+int main(int argc, char *argv[])
+{
+    Int    toCore0[2];
+    Int    toCore1[2];
+    UInt32 go = MQSIM_GO;
+
+    if (mapIpcWindow() < 0) {
+        return (1);
+    }
+
+    /* CORE1 starts with nothing set up, and waits for CORE0 to be */
+    if ((pipe(toCore0) < 0) || (pipe(toCore1) < 0)) {
+        perror("mqsim: pipe");
+        return (1);
+    }
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    if ((core1Pid = fork()) < 0) {
+        perror("mqsim: fork");
+        return (1);
+    }
+    if (core1Pid == 0) {
+        irqIn = toCore1[0];
+        irqOut = toCore0[1];
+        close(toCore0[0]);
+        close(toCore1[1]);
+        exit(core1Main());
+    }
+    irqIn = toCore0[0];
+    irqOut = toCore1[1];
+    close(toCore0[1]);
+    close(toCore1[0]);
+
+    hostInit();
+
+    MultiProc_setLocalId(MultiProc_getId("CORE0"));
+    hostProcId = MultiProc_getId("HOST");
+    selfProcId = MultiProc_self();
+    peerProcId = MultiProc_getId("CORE1");
+
+    VirtQueue_setResourceTable(&rscTable);
+    VirtQueue_startup();
+    MessageQCopy_init(hostProcId);
+    startIrqThread();
+
+    if (write(irqOut, &go, sizeof(go)) != sizeof(go)) {
+        perror("mqsim: starting CORE1");
+        return (1);
+    }
+
+    runTest("recvMany", testRecvMany);
+    runTest("sets", testSets);
+    runTest("callbacks", testCallbacks);
+    runTest("zero-copy", testZeroCopy);
+    runTest("send to host", testSendToHost);
+    runTest("Swi budget", testSwiBudget);
+    runTest("priority", testPriority);
+    runTest("CORE1 link", testCoreLink);
+    runTest("size classes", testSizeClasses);
+
+    MessageQCopy_finalize();
+
+    printf("  errors:            %u\n", errors);
+
+    return (errors == 0 ? 0 : 1);
+}
@@ -0,0 +1,753 @@
+/*
+ * Copyright (c) 2012, Texas Instruments Incorporated
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * *  Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ * *  Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * *  Neither the name of Texas Instruments Incorporated nor the names of
+ *    its contributors may be used to endorse or promote products derived
+ *    from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+/*
+ *  ======== vqsim.c ========
+ *  Host-side VirtQueue loopback simulator.
+ *
+ *  Forks a "remote" process running the real VirtQueue.c (see
+ *  VqSimRemote.c) and plays the Linux virtio_rpmsg_bus side in the parent:
+ *  it fills the rx vring with empty buffers, sends messages on the tx
+ *  vring with up to 'window' of them in flight, and reports round trip
+ *  cost, ring occupancy and interrupt (kick) rates.
+ *
+ *  Usage: vqsim [-n messages] [-w window] [-s payload size] [-r ring size]
+ *               [-p spins] [-t workers] [-e] [-c]
+ *
+ *  -e makes the host acknowledge VIRTIO_RING_F_EVENT_IDX in the resource
+ *  table, and use event indices instead of the vring flags.
+ *
+ *  -c makes it acknowledge VIRTIO_RPMSG_F_PADDED_IDX, so both sides lay the
+ *  vrings out with each side's indices on cache lines of their own.
+ *
+ *  Built with VIRTIO_RING_PACKED (vqsim-packed), both sides use the packed
+ *  ring layout instead of the split one.
+ *
+ *  Payloads that do not fit in one buffer are sent, and received, in
+ *  indirect buffers of consecutive 512 byte buffers, as Linux virtio does
+ *  for multi-segment buffers once VIRTIO_RING_F_INDIRECT_DESC is agreed.
+ */
+
+#include <xdc/std.h>
+
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "VqSim.h"
+#include "../../ti/ipc/rpmsg/virtio_ring.h"
+
+#define HOST_ENDPT      1024
+#define ECHO_ENDPT      51
+
+typedef struct Host_Stats {
+    UInt64  sumNs;
+    UInt64  minNs;
+    UInt64  maxNs;
+    UInt64  txOccupancySum;
+    UInt32  txOccupancyMax;
+    UInt32  rxFreeMin;
+    UInt32  hostWakeups;
+    UInt32  kicksSuppressed;
+    UInt32  errors;
+} Host_Stats;
+
+/*
+ * One vring, as the host (virtio driver) sees it.  Buffer 'head' is always
+ * at bufs + head * numSegs * VQSIM_BUF_SIZE, whatever the ring layout.
+ */
+typedef struct HostRing {
+#if defined(VIRTIO_RING_PACKED)
+    struct vring_packed vr;
+#else
+    struct vring        vr;
+#endif
+    UInt32  id;         /* notify id */
+    UInt32  bufs;       /* buffer area */
+    UInt32  tables;     /* indirect descriptor tables */
+    UInt16  flags;      /* VRING_DESC_F_WRITE for rx buffers */
+    UInt16  availIdx;   /* buffers made available (free-running) */
+    UInt16  lastUsed;   /* used buffers reaped (free-running) */
+} HostRing;
+
+static HostRing rxRing;     /* vring0: SYSM3 -> A9 */
+static HostRing txRing;     /* vring1: A9 -> SYSM3 */
+
+/* Free tx buffers, as a stack */
+static UInt16 txFree[VQSIM_NUM_BUFS];
+static UInt16 txNumFree = 0;
+static Bool eventIdx = FALSE;
+static Bool paddedIdx = FALSE;
+
+/* Vring size, as put in the resource table */
+static UInt16 ringNum = VQSIM_NUM_BUFS;
+
+/* Buffers per message, and the resulting number of vring entries used */
+static UInt16 numSegs = 1;
+static UInt16 numHeads = VQSIM_NUM_BUFS;
+
+static Host_Stats stats;
+
+/* Payload sent, and expected back (after the timestamp) */
+static UInt8 pattern[VQSIM_MAX_SEGS * VQSIM_BUF_SIZE];
+
+static inline UInt64 nowNs()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((UInt64)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/*
+ *  ======== hostBuf ========
+ */
+static inline Void *hostBuf(HostRing *r, UInt16 head)
+{
+    return ((Void *)(UArg)(r->bufs + head * numSegs * VQSIM_BUF_SIZE));
+}
+
+/*
+ *  ======== hostBufDesc ========
+ *  Descriptor for buffer 'head': the buffer itself, or the indirect table
+ *  spreading it over numSegs consecutive buffers.
+ */
+static Void hostBufDesc(HostRing *r, UInt16 head, UInt32 *addr, UInt32 *len,
+                        UInt16 *flags)
+{
+    if (numSegs == 1) {
+        *addr = VqSim_vaToPa(hostBuf(r, head));
+        *len = VQSIM_BUF_SIZE;
+        *flags = r->flags;
+    }
+    else {
+        *addr = VqSim_vaToPa((Void *)(UArg)(r->tables +
+                    head * VQSIM_MAX_SEGS * sizeof(struct vring_desc)));
+        *len = numSegs * sizeof(struct vring_desc);
+        *flags = VRING_DESC_F_INDIRECT;
+    }
+}
+
+/*
+ *  ======== hostRingInit ========
+ */
+static Void hostRingInit(HostRing *r, UInt32 da, UInt32 id, UInt32 bufs,
+                         UInt32 tables, UInt16 flags)
+{
+    struct vring_desc *table;
+    UInt16 head;
+    UInt16 i;
+
+#if defined(VIRTIO_RING_PACKED)
+    if (paddedIdx) {
+        vring_packed_init_padded(&r->vr, ringNum, (Void *)(UArg)da);
+    }
+    else {
+        vring_packed_init(&r->vr, ringNum, (Void *)(UArg)da);
+    }
+#else
+    if (paddedIdx) {
+        vring_init_padded(&r->vr, ringNum, (Void *)(UArg)da,
+                          VQSIM_VRING_ALIGN);
+    }
+    else {
+        vring_init(&r->vr, ringNum, (Void *)(UArg)da, VQSIM_VRING_ALIGN);
+    }
+#endif
+    r->id = id;
+    r->bufs = bufs;
+    r->tables = tables;
+    r->flags = flags;
+    r->availIdx = 0;
+    r->lastUsed = 0;
+
+    for (head = 0; head < numHeads && numSegs > 1; head++) {
+        table = (struct vring_desc *)(UArg)(tables +
+                    head * VQSIM_MAX_SEGS * sizeof(struct vring_desc));
+        for (i = 0; i < numSegs; i++) {
+            table[i].addr = VqSim_vaToPa((Char *)hostBuf(r, head) +
+                                         i * VQSIM_BUF_SIZE);
+            table[i].len = VQSIM_BUF_SIZE;
+#if defined(VIRTIO_RING_PACKED)
+            /* Packed indirect tables are implicitly chained */
+            ((struct vring_packed_desc *)table)[i].flags = flags;
+#else
+            table[i].flags = flags |
+                             ((i < numSegs - 1) ? VRING_DESC_F_NEXT : 0);
+            table[i].next = i + 1;
+#endif
+        }
+    }
+
+#if !defined(VIRTIO_RING_PACKED)
+    /* Split ring descriptors never change: buffer i is descriptor i */
+    for (head = 0; head < numHeads; head++) {
+        hostBufDesc(r, head, &r->vr.desc[head].addr, &r->vr.desc[head].len,
+                    &r->vr.desc[head].flags);
+    }
+#endif
+}
+
+/*
+ *  ======== hostRingPost ========
+ *  Make buffer 'head' available, 'len' bytes of it if not 0.
+ */
+static Void hostRingPost(HostRing *r, UInt16 head, UInt32 len)
+{
+#if defined(VIRTIO_RING_PACKED)
+    struct vring_packed_desc *desc;
+    UInt16 flags;
+
+    desc = &r->vr.desc[vring_packed_pos(&r->vr, r->availIdx)];
+    hostBufDesc(r, head, &desc->addr, &desc->len, &flags);
+    if (len != 0 && numSegs == 1) {
+        desc->len = len;
+    }
+    desc->id = head;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    desc->flags = flags | (vring_packed_wrap(&r->vr, r->availIdx) ?
+                           (1 << VRING_PACKED_DESC_F_AVAIL) :
+                           (1 << VRING_PACKED_DESC_F_USED));
+#else
+    if (len != 0 && numSegs == 1) {
+        r->vr.desc[head].len = len;
+    }
+    r->vr.avail->ring[r->availIdx % r->vr.num] = head;
+
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    r->vr.avail->idx = r->availIdx + 1;
+#endif
+    r->availIdx++;
+}
+
+/*
+ *  ======== hostRingGetUsed ========
+ */
+static Bool hostRingGetUsed(HostRing *r, UInt16 *head)
+{
+#if defined(VIRTIO_RING_PACKED)
+    struct vring_packed_desc *desc;
+
+    desc = &r->vr.desc[vring_packed_pos(&r->vr, r->lastUsed)];
+    if (((desc->flags >> VRING_PACKED_DESC_F_USED) & 1) !=
+        vring_packed_wrap(&r->vr, r->lastUsed)) {
+        return (FALSE);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    *head = desc->id;
+#else
+    if (r->lastUsed == r->vr.used->idx) {
+        return (FALSE);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    *head = r->vr.used->ring[r->lastUsed % r->vr.num].id;
+#endif
+    r->lastUsed++;
+
+    return (TRUE);
+}
+
+/*
+ *  ======== hostRingInterrupts ========
+ *  Ask the remote to interrupt us for the next used buffer, or never.
+ */
+static Void hostRingInterrupts(HostRing *r, Bool enable)
+{
+#if defined(VIRTIO_RING_PACKED)
+    if (!enable) {
+        r->vr.driver->flags = VRING_PACKED_EVENT_FLAG_DISABLE;
+    }
+    else if (eventIdx) {
+        r->vr.driver->off_wrap = vring_packed_pos(&r->vr, r->lastUsed) |
+                (vring_packed_wrap(&r->vr, r->lastUsed) <<
+                 VRING_PACKED_EVENT_F_WRAP_CTR);
+        r->vr.driver->flags = VRING_PACKED_EVENT_FLAG_DESC;
+    }
+    else {
+        r->vr.driver->flags = VRING_PACKED_EVENT_FLAG_ENABLE;
+    }
+#else
+    if (!enable) {
+        /* Like rpmsg_probe() does for "tx-complete" interrupts */
+        r->vr.avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+        vring_used_event(&r->vr) = r->lastUsed - 1;
+    }
+    else {
+        vring_used_event(&r->vr) = r->lastUsed;
+    }
+#endif
+}
+
+/*
+ *  ======== hostRingKick ========
+ *  Notify the remote that availIdx moved on from 'old', unless it asked
+ *  not to be (no-notify flag, or its avail event index wasn't crossed).
+ */
+static Void hostRingKick(HostRing *r, UInt16 old)
+{
+    Bool suppress;
+#if defined(VIRTIO_RING_PACKED)
+    struct vring_packed_desc_event *event = r->vr.device;
+    UInt16 eventIdx;
+#endif
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+#if defined(VIRTIO_RING_PACKED)
+    if (event->flags == VRING_PACKED_EVENT_FLAG_DESC) {
+        eventIdx = (r->availIdx & ~(r->vr.num - 1)) |
+                   (event->off_wrap & ~(1 << VRING_PACKED_EVENT_F_WRAP_CTR));
+        if ((event->off_wrap >> VRING_PACKED_EVENT_F_WRAP_CTR) !=
+            vring_packed_wrap(&r->vr, r->availIdx)) {
+            eventIdx -= r->vr.num;
+        }
+        suppress = !vring_need_event(eventIdx, r->availIdx, old);
+    }
+    else {
+        suppress = (event->flags == VRING_PACKED_EVENT_FLAG_DISABLE);
+    }
+#else
+    suppress = eventIdx ?
+            !vring_need_event(vring_avail_event(&r->vr), r->availIdx, old) :
+            (r->vr.used->flags & VRING_USED_F_NO_NOTIFY);
+#endif
+
+    if (suppress) {
+        stats.kicksSuppressed++;
+        return;
+    }
+
+    VqSim_mbxSend(&VqSim_ctrl->toRemote, VqSim_efdRemote, r->id,
+                  &VqSim_ctrl->toHost);
+}
+
+/*
+ *  ======== hostInitResourceTable ========
+ *  The firmware's rpmsg vdev and IPC window, with the host's feature
+ *  acknowledgement.
+ */
+static Void hostInitResourceTable()
+{
+    VqSim_ResourceTable *rsc = &VqSim_ctrl->rsc;
+
+    rsc->version = 1;
+    rsc->num = 2;
+    rsc->offset[0] = offsetof(VqSim_ResourceTable, rpmsg_vdev);
+    rsc->offset[1] = offsetof(VqSim_ResourceTable, ipc_devmem);
+
+    rsc->rpmsg_vdev.type = TYPE_VDEV;
+    rsc->rpmsg_vdev.id = VIRTIO_ID_RPMSG;
+    rsc->rpmsg_vdev.dfeatures = (1 << VIRTIO_RPMSG_F_NS) |
+                                (1 << VIRTIO_RING_F_EVENT_IDX) |
+                                (1 << VIRTIO_RING_F_INDIRECT_DESC) |
+                                (1 << VIRTIO_RPMSG_F_PADDED_IDX);
+    rsc->rpmsg_vdev.gfeatures = rsc->rpmsg_vdev.dfeatures &
+                                ~(eventIdx ? 0 : (1 << VIRTIO_RING_F_EVENT_IDX)) &
+                                ~(paddedIdx ? 0 : (1 << VIRTIO_RPMSG_F_PADDED_IDX));
+    rsc->rpmsg_vdev.num_of_vrings = 2;
+
+    rsc->rpmsg_vring0.da = VQSIM_VRING0_DA;
+    rsc->rpmsg_vring0.align = VQSIM_VRING_ALIGN;
+    rsc->rpmsg_vring0.num = ringNum;
+    rsc->rpmsg_vring0.notifyid = VQSIM_ID_SYSM3_TO_A9;
+
+    rsc->rpmsg_vring1.da = VQSIM_VRING1_DA;
+    rsc->rpmsg_vring1.align = VQSIM_VRING_ALIGN;
+    rsc->rpmsg_vring1.num = ringNum;
+    rsc->rpmsg_vring1.notifyid = VQSIM_ID_A9_TO_SYSM3;
+
+    /* The remote translates the addresses in the vrings with this */
+    rsc->ipc_devmem.type = TYPE_DEVMEM;
+    rsc->ipc_devmem.da = VQSIM_IPC_DA;
+    rsc->ipc_devmem.pa = VQSIM_IPC_PA;
+    rsc->ipc_devmem.len = VQSIM_IPC_SIZE;
+    strcpy(rsc->ipc_devmem.name, "IPU_MEM_IPC");
+}
+
+/*
+ *  ======== hostInitRings ========
+ *  What rpmsg_probe() does on Linux: all rx buffers made available at once,
+ *  all tx buffers on a free list.  Each takes numSegs buffers.
+ */
+static Void hostInitRings()
+{
+    UInt16 i;
+
+    memset((Void *)(UArg)VQSIM_IPC_DA, 0, VQSIM_SHM_SIZE);
+
+    hostInitResourceTable();
+
+    hostRingInit(&rxRing, VQSIM_VRING0_DA, VQSIM_ID_SYSM3_TO_A9,
+                 VQSIM_BUFS0_DA, VQSIM_INDIR0_DA, VRING_DESC_F_WRITE);
+    hostRingInit(&txRing, VQSIM_VRING1_DA, VQSIM_ID_A9_TO_SYSM3,
+                 VQSIM_BUFS1_DA, VQSIM_INDIR1_DA, 0);
+
+    for (i = 0; i < numHeads; i++) {
+        hostRingPost(&rxRing, i, 0);
+        txFree[i] = numHeads - 1 - i;
+    }
+    txNumFree = numHeads;
+
+    hostRingInterrupts(&rxRing, TRUE);
+    hostRingInterrupts(&txRing, FALSE);
+}
+
+/*
+ *  ======== hostSend ========
+ */
+static Void hostSend(UInt32 seq, UInt16 size)
+{
+    VqSim_MsgHeader *msg;
+    UInt64 stamp = nowNs();
+    UInt16 head;
+    UInt16 occupancy;
+
+    head = txFree[--txNumFree];
+
+    msg = hostBuf(&txRing, head);
+    msg->srcAddr = HOST_ENDPT;
+    msg->dstAddr = ECHO_ENDPT;
+    msg->reserved = seq;
+    msg->dataLen = size;
+    msg->flags = 0;
+    memcpy(msg->payload, pattern, size);
+    memcpy(msg->payload, &stamp, sizeof(stamp));
+
+    hostRingPost(&txRing, head, sizeof(VqSim_MsgHeader) + size);
+
+    occupancy = (UInt16)(txRing.availIdx - txRing.lastUsed);
+    stats.txOccupancySum += occupancy;
+    if (occupancy > stats.txOccupancyMax) {
+        stats.txOccupancyMax = occupancy;
+    }
+
+    hostRingKick(&txRing, txRing.availIdx - 1);
+}
+
+/*
+ *  ======== hostReap ========
+ *  Returns the number of echoed messages received.
+ */
+static UInt32 hostReap(UInt16 size)
+{
+    VqSim_MsgHeader *msg;
+    UInt64 stamp;
+    UInt64 ns;
+    UInt32 received = 0;
+    UInt16 rxFree;
+    UInt16 rxOldAvail = rxRing.availIdx;
+    UInt16 head;
+
+    /* Reclaim tx buffers the remote has consumed */
+    while (hostRingGetUsed(&txRing, &head)) {
+        txFree[txNumFree++] = head;
+    }
+
+    /*
+     * No tx-complete interrupts, unless we ran out of tx buffers (every
+     * one may be echoed before the remote returns it): then, as
+     * rpmsg_send() does, ask for one, and look again in case the remote
+     * returned some before it saw the request.
+     */
+    hostRingInterrupts(&txRing, txNumFree == 0);
+    if (txNumFree == 0) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (hostRingGetUsed(&txRing, &head)) {
+            txFree[txNumFree++] = head;
+        }
+    }
+
+    /* Consume echoed messages and give the buffers straight back */
+    while (hostRingGetUsed(&rxRing, &head)) {
+        msg = hostBuf(&rxRing, head);
+
+        memcpy(&stamp, msg->payload, sizeof(stamp));
+        ns = nowNs() - stamp;
+        stats.sumNs += ns;
+        if (ns < stats.minNs) {
+            stats.minNs = ns;
+        }
+        if (ns > stats.maxNs) {
+            stats.maxNs = ns;
+        }
+        if (msg->dataLen != size || msg->dstAddr != HOST_ENDPT ||
+            msg->srcAddr != ECHO_ENDPT ||
+            memcmp(msg->payload + sizeof(stamp), pattern + sizeof(stamp),
+                   size - sizeof(stamp))) {
+            stats.errors++;
+        }
+
+        hostRingPost(&rxRing, head, 0);
+        received++;
+    }
+
+    /* Empty buffers the remote had left, before they were given back */
+    rxFree = (UInt16)(rxOldAvail - rxRing.lastUsed);
+    if (rxFree < stats.rxFreeMin) {
+        stats.rxFreeMin = rxFree;
+    }
+
+    /* Interrupt us on the next echoed message */
+    hostRingInterrupts(&rxRing, TRUE);
+
+    if (received) {
+        hostRingKick(&rxRing, rxOldAvail);
+    }
+
+    return (received);
+}
+
+/*
+ *  ======== hostRun ========
+ */
+static Void hostRun(UInt32 count, UInt32 window, UInt16 size)
+{
+    UInt32 sent = 0;
+    UInt32 received = 0;
+    UInt32 discard;
+    UInt32 got;
+    UInt64 start;
+    UInt64 elapsed;
+    VqSim_Ctrl *ctrl = VqSim_ctrl;
+
+    memset(&stats, 0, sizeof(stats));
+    stats.minNs = ~0ULL;
+    stats.rxFreeMin = numHeads;
+
+    start = nowNs();
+
+    while (received < count) {
+        while (sent < count && sent - received < window && txNumFree > 0) {
+            hostSend(sent++, size);
+        }
+
+        got = hostReap(size);
+
+        /* Sleep, unless the reap freed up tx buffers we can send on */
+        if (got == 0 && (sent == count || sent - received >= window ||
+                         txNumFree == 0)) {
+            VqSim_doorbellWait(VqSim_efdHost);
+            stats.hostWakeups++;
+            while (VqSim_mbxRecv(&ctrl->toHost, &discard)) {
+            }
+        }
+        received += got;
+    }
+
+    elapsed = nowNs() - start;
+
+    printf("vqsim: %u messages, window %u, payload %u bytes%s, "
+           "%s ring of %u%s%s\n", count, window, size,
+           numSegs > 1 ? " (indirect)" : "",
+#if defined(VIRTIO_RING_PACKED)
+           "packed",
+#else
+           "split",
+#endif
+           ringNum, eventIdx ? ", event index" : "",
+           paddedIdx ? ", padded indices" : "");
+    printf("  throughput:        %.0f msgs/s (%.2f us/msg)\n",
+           count * 1e9 / elapsed, elapsed / 1e3 / count);
+    printf("  round trip:        avg %.2f us, min %.2f us, max %.2f us\n",
+           stats.sumNs / 1e3 / count, stats.minNs / 1e3, stats.maxNs / 1e3);
+    printf("  tx ring occupancy: avg %.1f, max %u of %u\n",
+           (double)stats.txOccupancySum / count, stats.txOccupancyMax,
+           numHeads);
+    printf("  rx ring free min:  %u of %u\n", stats.rxFreeMin, numHeads);
+    printf("  kicks host->remote: %u (%.2f/msg), suppressed %u\n",
+           ctrl->toRemote.sent, (double)ctrl->toRemote.sent / count,
+           stats.kicksSuppressed);
+    printf("  kicks remote->host: %u (%.2f/msg)\n",
+           ctrl->toHost.sent, (double)ctrl->toHost.sent / count);
+    printf("  mailbox full:      host %u, remote %u\n",
+           ctrl->toRemote.full, ctrl->toHost.full);
+    printf("  wakeups:           host %u, remote %u (swi runs %u)\n",
+           stats.hostWakeups, ctrl->remoteWakeups, ctrl->remoteSwiRuns);
+    printf("  remote polls:      %u found buffers (of %u swi runs)\n",
+           ctrl->remotePollHits, ctrl->remoteSwiRuns);
+    printf("  cache ops:         inv %.2f/msg, wb %.2f/msg\n",
+           (double)ctrl->remoteCacheInv / count,
+           (double)ctrl->remoteCacheWb / count);
+    printf("  errors:            %u, dropped by remote %u\n",
+           stats.errors, ctrl->remoteDropped);
+}
+
+/*
+ *  ======== mapIpcWindow ========
+ */
+static Int mapIpcWindow()
+{
+    char name[32];
+    Void *addr;
+    Int fd;
+
+    snprintf(name, sizeof(name), "/vqsim-%d", (int)getpid());
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        perror("vqsim: shm_open");
+        return (-1);
+    }
+    shm_unlink(name);
+
+    if (ftruncate(fd, VQSIM_SHM_SIZE) < 0) {
+        perror("vqsim: ftruncate");
+        close(fd);
+        return (-1);
+    }
+
+    /* Same address as the M3 sees, so VirtQueue.c needs no changes */
+    addr = mmap((Void *)(UArg)VQSIM_IPC_DA, VQSIM_SHM_SIZE,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED_NOREPLACE,
+                fd, 0);
+    close(fd);
+    if (addr != (Void *)(UArg)VQSIM_IPC_DA) {
+        perror("vqsim: mmap at IPC_DA");
+        return (-1);
+    }
+
+    VqSim_ctrl = (VqSim_Ctrl *)(UArg)VQSIM_CTRL_DA;
+
+    return (0);
+}
+
+/*
+ *  ======== main ========
+ */
+int main(int argc, char *argv[])
+{
+    UInt32 count = 100000;
+    UInt32 window = 1;
+    UInt32 size = 16;
+    UInt32 pollSpins = 0;
+    UInt32 workers = 0;
+    UInt64 one = 1;
+    UInt32 i;
+    Int status;
+    Int opt;
+    pid_t pid;
+
+    while ((opt = getopt(argc, argv, "n:w:s:r:p:t:ec")) != -1) {
+        switch (opt) {
+            case 'n':
+                count = strtoul(optarg, NULL, 0);
+                break;
+            case 'w':
+                window = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                size = strtoul(optarg, NULL, 0);
+                break;
+            case 'r':
+                ringNum = strtoul(optarg, NULL, 0);
+                break;
+            case 'p':
+                pollSpins = strtoul(optarg, NULL, 0);
+                break;
+            case 't':
+                workers = strtoul(optarg, NULL, 0);
+                break;
+            case 'e':
+                eventIdx = TRUE;
+                break;
+            case 'c':
+                paddedIdx = TRUE;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n messages] [-w window] "
+                        "[-s payload size] [-r ring size] [-p spins] [-t workers] [-e] [-c]\n",
+                        argv[0]);
+                return (1);
+        }
+    }
+
+    numSegs = (sizeof(VqSim_MsgHeader) + size + VQSIM_BUF_SIZE - 1) /
+              VQSIM_BUF_SIZE;
+    numHeads = ringNum / numSegs;
+
+    if (ringNum == 0 || ringNum > VQSIM_NUM_BUFS || (ringNum & (ringNum - 1)) ||
+        count == 0 || window == 0 || window > numHeads ||
+        size < sizeof(UInt64) || numSegs > VQSIM_MAX_SEGS || workers > 8) {
+        fprintf(stderr, "vqsim: invalid arguments\n");
+        return (1);
+    }
+
+    for (i = 0; i < size; i++) {
+        /* Not a multiple of the buffer size, so misplaced segments show */
+        pattern[i] = i % 251;
+    }
+
+    if (mapIpcWindow() < 0) {
+        return (1);
+    }
+
+    VqSim_efdRemote = eventfd(0, 0);
+    VqSim_efdHost = eventfd(0, 0);
+    if (VqSim_efdRemote < 0 || VqSim_efdHost < 0) {
+        perror("vqsim: eventfd");
+        return (1);
+    }
+
+    hostInitRings();
+    VqSim_ctrl->pollSpins = pollSpins;
+    VqSim_ctrl->workers = workers;
+
+    pid = fork();
+    if (pid < 0) {
+        perror("vqsim: fork");
+        return (1);
+    }
+    if (pid == 0) {
+        _exit(VqSimRemote_run());
+    }
+
+    hostRun(count, window, (UInt16)size);
+
+    /* The remote prints its VirtQueue counters as it stops */
+    fflush(stdout);
+    VqSim_ctrl->stop = 1;
+    if (write(VqSim_efdRemote, &one, sizeof(one)) != sizeof(one)) {
+        perror("vqsim: eventfd write");
+    }
+    waitpid(pid, &status, 0);
+
+    return ((WIFEXITED(status) && WEXITSTATUS(status) == 0 &&
+             stats.errors == 0) ? 0 : 1);
+}